@@ -1,8 +1,137 @@
 #include <stdio.h>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <system_error>
 #include <ubench/ubench.hpp>
 
+#include <cellarium/file.hpp>
+#include <cellarium/storage.hpp>
+#include <cellarium/paged_storage.hpp>
+#include <cellarium/columnar_storage.hpp>
 
-int main() {
 
+struct quote {
+  std::int64_t time;
+  double bid;
+  double ask;
+  std::int32_t volume;
+}; // quote
+
+
+constexpr std::uint32_t capacity = 1 << 20;
+
+
+auto const quote_header = cellarium::header::make<quote>(1, capacity, 0.7f, {
+  cellarium::field::with_offset(cellarium::field::i64("time", ""), offsetof(quote, time)),
+  cellarium::field::with_offset(cellarium::field::f64("bid", ""), offsetof(quote, bid)),
+  cellarium::field::with_offset(cellarium::field::f64("ask", ""), offsetof(quote, ask)),
+  cellarium::field::with_offset(cellarium::field::i32("volume", ""), offsetof(quote, volume))
+});
+
+
+void benchmark_file() {
+  auto f = cellarium::file::create("benchmark.file");
+  f.resize(capacity * sizeof(quote));
+  quote q{};
+  std::int64_t offset = 0;
+
+  auto const written = ubench::run([&]{
+    f.write_at(offset, reinterpret_cast<char const*>(&q), sizeof(q));
+    offset = (offset + sizeof(q)) % (capacity * sizeof(quote));
+  });
+  std::cout << "file::write_at          " << written << std::endl;
+
+  auto const read = ubench::run([&]{
+    f.read_at(offset, reinterpret_cast<char*>(&q), sizeof(q));
+    offset = (offset + sizeof(q)) % (capacity * sizeof(quote));
+  });
+  std::cout << "file::read_at           " << read << std::endl;
+}
+
+
+void benchmark_storage() {
+  cellarium::storage<quote> target;
+  std::error_code ec;
+  if(!target.create("benchmark.storage", quote_header, ec)) {
+    std::cout << "unable to create storage: " << ec.message() << std::endl;
+    return;
+  }
+
+  quote q{1, 1., 2., 3};
+  auto const inserted = ubench::run([&]{
+    auto const index = target.try_insert(q);
+    if(index != target.no_index)
+      target.remove(index);
+  });
+  std::cout << "storage::try_insert     " << inserted << std::endl;
+
+  for(std::uint32_t i = 0; i != capacity / 2; ++i)
+    target.try_insert(q);
+
+  double volume = 0.;
+  auto const scanned = ubench::run([&]{
+    target.for_each([&](quote const& each) { volume += each.volume; });
+  });
+  std::cout << "storage::for_each       " << scanned
+            << " (" << capacity / 2 << " records)" << std::endl;
+}
+
+
+void benchmark_paged_storage() {
+  cellarium::paged_storage<quote> target;
+  std::error_code ec;
+  if(!target.create("benchmark.pages", 16, quote_header, ec)) {
+    std::cout << "unable to create paged storage: " << ec.message() << std::endl;
+    return;
+  }
+
+  quote q{1, 1., 2., 3};
+  auto const inserted = ubench::run([&]{
+    auto const index = target.try_insert(q);
+    if(index != target.no_index)
+      target.remove(index);
+  });
+  std::cout << "paged_storage::try_insert " << inserted << std::endl;
+
+  for(std::uint32_t i = 0; i != capacity * 2; ++i)
+    target.try_insert(q);
+
+  double volume = 0.;
+  auto const scanned = ubench::run([&]{
+    target.for_each([&](quote const& each) { volume += each.volume; });
+  });
+  std::cout << "paged_storage::for_each " << scanned
+            << " (" << capacity * 2 << " records)" << std::endl;
+}
+
+
+void benchmark_columnar_storage() {
+  cellarium::columnar_storage<quote> target;
+  std::error_code ec;
+  if(!target.create("benchmark.columns", quote_header, ec)) {
+    std::cout << "unable to create columnar storage: " << ec.message() << std::endl;
+    return;
+  }
+
+  quote q{1, 1., 2., 3};
+  for(std::uint32_t i = 0; i != capacity / 2; ++i)
+    target.try_insert(q);
+
+  double volume = 0.;
+  auto const volumes = target.column<std::int32_t>(3);
+  auto const scanned = ubench::run([&]{
+    target.occupancy().for_each([&](std::uint32_t i) { volume += volumes[i]; });
+  });
+  std::cout << "columnar_storage::column " << scanned
+            << " (" << capacity / 2 << " records)" << std::endl;
+}
+
+
+int main() {
+  benchmark_file();
+  benchmark_storage();
+  benchmark_paged_storage();
+  benchmark_columnar_storage();
   return 0;
 }
@@ -0,0 +1,282 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <system_error>
+#include <type_traits>
+
+#include "field.hpp"
+#include "occupancy_map.hpp"
+#include "simd.hpp"
+#include "storage.hpp"
+#include "paged_storage.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  // Totals over every element of a numeric field of live records; min and
+  // max are zero when nothing was counted
+  struct summary {
+    std::uint64_t count{0};
+    double sum{.0};
+    double min{.0};
+    double max{.0};
+
+
+    double average() const noexcept {
+      return count == 0 ? .0 : sum / double(count);
+    }
+
+  }; // summary
+
+
+  namespace detail {
+
+    template<typename V> struct totals {
+      using sum_type = std::conditional_t<std::is_floating_point_v<V>, double,
+                         std::conditional_t<std::is_signed_v<V>, std::int64_t, std::uint64_t>>;
+
+      std::uint64_t count{0};
+      sum_type sum{0};
+      V min{std::numeric_limits<V>::max()};
+      V max{std::numeric_limits<V>::lowest()};
+
+
+      void add(V value) noexcept {
+        ++count;
+        sum += sum_type(value);
+        if(value < min)
+          min = value;
+        if(value > max)
+          max = value;
+      }
+
+
+      summary result() const noexcept {
+        summary r;
+        r.count = count;
+        r.sum = double(sum);
+        if(count != 0) {
+          r.min = double(min);
+          r.max = double(max);
+        }
+        return r;
+      }
+
+    }; // totals
+
+
+#if defined(__AVX2__)
+
+    // Totals of fully occupied 64-slot blocks kept in registers
+    template<typename V> struct block_totals {
+      using L = lanes<V>;
+
+      typename L::wide sum{L::wide_zero()};
+      typename L::reg min{L::set1(std::numeric_limits<V>::max())};
+      typename L::reg max{L::set1(std::numeric_limits<V>::lowest())};
+      std::uint64_t count{0};
+
+
+      void add(char const* p, std::size_t stride) noexcept {
+        if(stride == sizeof(V)) {
+          for(unsigned j = 0; j != 64; j += L::count)
+            add(L::load(p + j * sizeof(V)));
+        } else {
+          auto const s = std::int32_t(stride);
+          for(unsigned j = 0; j != 64; j += L::count)
+            add(L::gather(p + j * stride, s));
+        }
+        count += 64;
+      }
+
+
+      void add(typename L::reg v) noexcept {
+        sum = L::add_wide(sum, v);
+        min = L::min(min, v);
+        max = L::max(max, v);
+      }
+
+
+      void merge_into(totals<V>& t) const noexcept {
+        if(count == 0)
+          return;
+        V lows[L::count], highs[L::count];
+        typename L::wide_value sums[4];
+        L::store(lows, min);
+        L::store(highs, max);
+        L::wide_store(sums, sum);
+        t.count += count;
+        for(auto each: sums)
+          t.sum += typename totals<V>::sum_type(each);
+        for(unsigned i = 0; i != L::count; ++i) {
+          if(lows[i] < t.min)
+            t.min = lows[i];
+          if(highs[i] > t.max)
+            t.max = highs[i];
+        }
+      }
+
+    }; // block_totals
+
+#endif // __AVX2__
+
+
+    template<typename V>
+    void add_occupied(char const* column, std::size_t stride, occupancy_map::size_type w,
+                      occupancy_map::word_type bits, totals<V>& t) noexcept {
+      std::size_t const first = std::size_t(w) * occupancy_map::bits_per_word;
+      for(; bits != 0; bits &= bits - 1) {
+        V value;
+        std::memcpy(&value, column + (first + count_trailing_zeros(bits)) * stride, sizeof(V));
+        t.add(value);
+      }
+    }
+
+
+    // Elements of array fields are laid out one after another, so every
+    // element is a column of its own with the same stride
+    template<typename V>
+    void accumulate(char const* base, std::size_t stride, field::size_type elements,
+                    occupancy_map const& occupancy, totals<V>& t) noexcept {
+      occupancy_map::size_type const words = occupancy.words_count();
+      for(field::size_type e = 0; e != elements; ++e) {
+        char const* const column = base + std::size_t(e) * sizeof(V);
+#if defined(__AVX2__)
+        if constexpr(lanes<V>::available) {
+          block_totals<V> blocks;
+          for(occupancy_map::size_type w = 0; w != words; ++w) {
+            occupancy_map::word_type const bits = occupancy.word(w);
+            if(bits == ~occupancy_map::word_type(0))
+              blocks.add(column + std::size_t(w) * occupancy_map::bits_per_word * stride, stride);
+            else
+              add_occupied(column, stride, w, bits, t);
+          }
+          blocks.merge_into(t);
+          continue;
+        }
+#endif
+        for(occupancy_map::size_type w = 0; w != words; ++w)
+          add_occupied(column, stride, w, occupancy.word(w), t);
+      }
+    }
+
+
+    // Calls visit(totals<V>&) with V of the field kind
+    template<typename F>
+    bool aggregate_field(field const& f, F&& visit, summary& result, std::error_code& ec) noexcept {
+      switch(f.kind()) {
+        case field_kind::byte: {
+          totals<for_kind<field_kind::byte>::type> t; visit(t); result = t.result(); return true;
+        }
+        case field_kind::i16: {
+          totals<for_kind<field_kind::i16>::type> t; visit(t); result = t.result(); return true;
+        }
+        case field_kind::u16: {
+          totals<for_kind<field_kind::u16>::type> t; visit(t); result = t.result(); return true;
+        }
+        case field_kind::i32: {
+          totals<for_kind<field_kind::i32>::type> t; visit(t); result = t.result(); return true;
+        }
+        case field_kind::u32: {
+          totals<for_kind<field_kind::u32>::type> t; visit(t); result = t.result(); return true;
+        }
+        case field_kind::i64: {
+          totals<for_kind<field_kind::i64>::type> t; visit(t); result = t.result(); return true;
+        }
+        case field_kind::u64: {
+          totals<for_kind<field_kind::u64>::type> t; visit(t); result = t.result(); return true;
+        }
+        case field_kind::f32: {
+          totals<for_kind<field_kind::f32>::type> t; visit(t); result = t.result(); return true;
+        }
+        case field_kind::f64: {
+          totals<for_kind<field_kind::f64>::type> t; visit(t); result = t.result(); return true;
+        }
+        default:
+          return (ec = std::error_code{error::unsupported_field_kind}), false;
+      }
+    }
+
+
+    inline bool fits(header const& h, field const& f, std::error_code& ec) noexcept {
+      if(f.offset() + f.size_of() > h.data_size())
+        return (ec = std::error_code{error::invalid_specified_header}), false;
+      return true;
+    }
+
+  } // detail
+
+
+  template<typename T>
+  bool aggregate(storage<T> const& source, field const& f, summary& result, std::error_code& ec) noexcept {
+    if(!detail::fits(*source.header(), f, ec))
+      return false;
+    return detail::aggregate_field(f, [&](auto& t) {
+      detail::accumulate(source.data() + f.offset(), storage<T>::record_size, f.capacity(),
+                         source.occupancy(), t);
+    }, result, ec);
+  }
+
+
+  template<typename T>
+  bool aggregate(storage<T> const& source, char const* field_name, summary& result,
+                 std::error_code& ec) noexcept {
+    field const* const f = source.header()->find_field(field_name);
+    if(f == nullptr)
+      return (ec = std::error_code{error::field_not_found}), false;
+    return aggregate(source, *f, result, ec);
+  }
+
+
+  template<typename T>
+  bool aggregate(paged_storage<T> const& source, field const& f, summary& result,
+                 std::error_code& ec) noexcept {
+    if(!detail::fits(*source.page(0).header(), f, ec))
+      return false;
+    return detail::aggregate_field(f, [&](auto& t) {
+      for(typename paged_storage<T>::size_type n = 0; n != source.pages_count(); ++n)
+        detail::accumulate(source.page(n).data() + f.offset(), storage<T>::record_size, f.capacity(),
+                           source.page(n).occupancy(), t);
+    }, result, ec);
+  }
+
+
+  template<typename T>
+  bool aggregate(paged_storage<T> const& source, char const* field_name, summary& result,
+                 std::error_code& ec) noexcept {
+    field const* const f = source.page(0).header()->find_field(field_name);
+    if(f == nullptr)
+      return (ec = std::error_code{error::field_not_found}), false;
+    return aggregate(source, *f, result, ec);
+  }
+
+
+} // cellarium
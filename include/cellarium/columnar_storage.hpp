@@ -0,0 +1,363 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <filesystem>
+#include <system_error>
+#include <type_traits>
+#include <cstring>
+#include <new>
+
+#include "file.hpp"
+#include "mapped_file.hpp"
+#include "header.hpp"
+#include "occupancy_map.hpp"
+#include "occupancy_index.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  // Stores every field of the header as its own contiguous column:
+  //   header | column 0 | column 1 | ... | occupancy map
+  // Columns and occupancy map start at cache line boundaries. Records are
+  // scattered into columns by field offsets, so fields have to cover
+  // distinct parts of T. Slots are always allocated lowest free first
+  template<typename T>
+  class columnar_storage {
+  public:
+
+    static_assert(std::is_trivial_v<T>, "Only trivial types can be stored");
+
+    using path_type = std::filesystem::path;
+    using size_type = cellarium::header::size_type;
+    using index_type = cellarium::header::index_type;
+    using value_type = T;
+
+    static constexpr index_type no_index = cellarium::header::no_index;
+
+
+    columnar_storage() noexcept = default;
+    ~columnar_storage() { close(); }
+    columnar_storage(columnar_storage const&) = delete;
+    columnar_storage& operator = (columnar_storage const&) = delete;
+    explicit operator bool () const noexcept { return header_ != nullptr; }
+    cellarium::header const* header() const noexcept { return header_; }
+    occupancy_map const& occupancy() const noexcept { return occupancy_; }
+    size_type size() const noexcept { return header_->items_count(); }
+
+
+    bool create(path_type const& path, class header const& specified, std::error_code& ec) noexcept {
+
+      close();
+
+      if(!specified || !has_valid_layout(specified))
+        return (ec = std::error_code{error::invalid_specified_header}), false;
+
+      auto f = file::create(path);
+      if(!f)
+        return (ec = file::last_error()), false;
+      if(!f.resize(storage_size(specified, specified.capacity())))
+        return (ec = file::last_error()), false;
+      f.close();
+
+      mapped_file_ = mapped_file::open(path);
+      if(!mapped_file_)
+        return (ec = mapped_file::last_error()), false;
+
+      mapped_region_ = mapped_file_.map();
+      if(mapped_region_.address == nullptr)
+        return (ec = mapped_file::last_error()), false;
+
+      *reinterpret_cast<class header*>(mapped_region_.address) = specified;
+      bind_region();
+      header_->free_index(no_index);
+      header_->high_water_mark(0);
+      header_->items_count(0);
+      header_->allocation(allocation_policy::lowest_free);
+      header_->clean(false);
+
+      return build_free_slots(ec);
+    }
+
+
+    bool open(path_type const& path, class header const& specified, std::error_code& ec) noexcept {
+
+      close();
+
+      if(!specified || !has_valid_layout(specified))
+        return (ec = std::error_code{error::invalid_specified_header}), false;
+
+      class header actual;
+      {
+        auto f = file::open_to_read(path);
+        if(!f)
+          return (ec = file::last_error()), false;
+        if(!f.read(actual))
+          return (ec = file::last_error()), false;
+      }
+
+      if(!actual.has_valid_signature())
+        return (ec = std::error_code{error::not_a_storage_file}), false;
+      if(!actual.has_valid_format_version())
+        return (ec = std::error_code{error::different_format_version}), false;
+      if(actual.data_version() != specified.data_version())
+        return (ec = std::error_code{error::different_data_version}), false;
+      if(actual.data_size() != specified.data_size())
+        return (ec = std::error_code{error::different_data_size}), false;
+
+      auto const file_size = std::filesystem::file_size(path, ec);
+      if(!!ec)
+        return false;
+      if(file_size != static_cast<std::uintmax_t>(storage_size(actual, actual.capacity())))
+        return (ec = std::error_code{error::invalid_file_size}), false;
+
+      mapped_file_ = mapped_file::open(path);
+      if(!mapped_file_)
+        return (ec = mapped_file::last_error()), false;
+
+      mapped_region_ = mapped_file_.map();
+      if(mapped_region_.address == nullptr)
+        return (ec = mapped_file::last_error()), false;
+
+      bind_region();
+      header_->occupancy_factor(specified.occupancy_factor());
+      if(!header_->has_valid_items_count())
+        header_->items_count(occupancy_.count());
+      header_->clean(false);
+
+      size_type const needed_capacity = specified.needed_capacity(header_->items_count());
+      if(needed_capacity > header_->capacity() && !expand_storage(needed_capacity, ec))
+        return false;
+
+      return build_free_slots(ec);
+    }
+
+
+    void close() noexcept {
+      if(header_ == nullptr)
+        return;
+      header_->clean(true);
+      mapped_region_ = mapped_file::region{};
+      mapped_file_ = mapped_file{};
+      header_ = nullptr;
+      occupancy_ = occupancy_map{};
+      free_slots_.clear();
+      fields_count_ = 0;
+    }
+
+
+    index_type try_insert(T const& data) noexcept {
+      index_type const index = free_slots_.find_first(occupancy_);
+      if(index == no_index)
+        return no_index;
+      scatter(index, data);
+      occupancy_.set(index);
+      free_slots_.occupied(occupancy_, index);
+      if(index >= header_->high_water_mark())
+        header_->high_water_mark(index + 1);
+      header_->items_count(header_->items_count() + 1);
+      return index;
+    }
+
+
+    void remove(index_type index) noexcept {
+      occupancy_.reset(index);
+      free_slots_.released(index);
+      header_->items_count(header_->items_count() - 1);
+    }
+
+
+    T get(index_type index) const noexcept {
+      T data{};
+      for(size_type i = 0; i != fields_count_; ++i) {
+        column_info const& c = columns_[i];
+        std::memcpy(reinterpret_cast<char*>(&data) + c.offset, c.base + std::size_t(index) * c.size, c.size);
+      }
+      return data;
+    }
+
+
+    void set(index_type index, T const& data) noexcept {
+      scatter(index, data);
+    }
+
+
+    // Column of n-th header field, one element of field size per slot
+    char const* column_data(size_type n) const noexcept { return columns_[n].base; }
+    char* column_data(size_type n) noexcept { return columns_[n].base; }
+
+
+    template<typename V> V const* column(size_type n) const noexcept {
+      return reinterpret_cast<V const*>(columns_[n].base);
+    }
+
+
+    template<typename V> V* column(size_type n) noexcept {
+      return reinterpret_cast<V*>(columns_[n].base);
+    }
+
+
+    template<typename F> void for_each(F&& f) const {
+      occupancy_.for_each([&](index_type i) { f(get(i)); });
+    }
+
+
+  private:
+
+    struct column_info {
+      char* base;
+      size_type offset;
+      size_type size;
+    }; // column_info
+
+    mapped_file mapped_file_;
+    mapped_file::region mapped_region_;
+    cellarium::header* header_{nullptr};
+    occupancy_map occupancy_;
+    occupancy_index free_slots_;
+    column_info columns_[cellarium::header::fields_capacity];
+    size_type fields_count_{0};
+
+
+    static mapped_file::size_type align(mapped_file::size_type offset) noexcept {
+      return (offset + 63) & ~mapped_file::size_type(63);
+    }
+
+
+    static mapped_file::size_type column_offset(class header const& h, size_type capacity,
+                                                size_type n) noexcept {
+      mapped_file::size_type offset = align(sizeof(class header));
+      for(size_type i = 0; i != n; ++i)
+        offset = align(offset + mapped_file::size_type(capacity) * h.field_at(i).size_of());
+      return offset;
+    }
+
+
+    static mapped_file::size_type occupancy_offset(class header const& h, size_type capacity) noexcept {
+      return column_offset(h, capacity, h.fields_count());
+    }
+
+
+    static mapped_file::size_type storage_size(class header const& h, size_type capacity) noexcept {
+      return occupancy_offset(h, capacity) + occupancy_map::size_of(capacity);
+    }
+
+
+    // Fields are non-empty, inside T and never share a byte, otherwise
+    // scattered columns would alias each other
+    static bool has_valid_layout(class header const& h) noexcept {
+      for(size_type i = 0; i != h.fields_count(); ++i) {
+        field const& f = h.field_at(i);
+        if(f.size_of() == 0 || f.offset() + f.size_of() > h.data_size())
+          return false;
+        for(size_type j = 0; j != i; ++j) {
+          field const& other = h.field_at(j);
+          if(f.offset() < other.offset() + other.size_of() && other.offset() < f.offset() + f.size_of())
+            return false;
+        }
+      }
+      return true;
+    }
+
+
+    void bind_region() noexcept {
+      header_ = reinterpret_cast<class header*>(mapped_region_.address);
+      bind_columns(header_->capacity());
+      occupancy_ = occupancy_map{reinterpret_cast<occupancy_map::word_type*>(
+                                   mapped_region_.address + occupancy_offset(*header_, header_->capacity())),
+                                 header_->capacity()};
+    }
+
+
+    void bind_columns(size_type capacity) noexcept {
+      fields_count_ = header_->fields_count();
+      for(size_type i = 0; i != fields_count_; ++i) {
+        field const& f = header_->field_at(i);
+        columns_[i] = column_info{mapped_region_.address + column_offset(*header_, capacity, i),
+                                  f.offset(), f.size_of()};
+      }
+    }
+
+
+    bool build_free_slots(std::error_code& ec) noexcept {
+      try {
+        free_slots_.build(occupancy_);
+        return true;
+      } catch(std::bad_alloc const&) {
+        ec = std::error_code{error::not_enough_memory};
+        return false;
+      }
+    }
+
+
+    void scatter(index_type index, T const& data) noexcept {
+      for(size_type i = 0; i != fields_count_; ++i) {
+        column_info const& c = columns_[i];
+        std::memcpy(c.base + std::size_t(index) * c.size, reinterpret_cast<char const*>(&data) + c.offset, c.size);
+      }
+    }
+
+
+    // Every column moves up, so they are moved from the last one and the
+    // occupancy map goes first; its tail lies past the old end of file and
+    // reads as zeros. Column tails keep stale bytes, but only for slots past
+    // the high-water mark
+    bool expand_storage(size_type new_capacity, std::error_code& ec) noexcept {
+      size_type const old_capacity = header_->capacity();
+      auto const new_size = storage_size(*header_, new_capacity);
+      header_ = nullptr;
+      occupancy_ = occupancy_map{};
+      mapped_region_ = mapped_file::region{};
+
+      if(!mapped_file_.resize(new_size)) {
+        ec = mapped_file::last_error();
+        return (mapped_file_ = mapped_file{}), false;
+      }
+
+      mapped_region_ = mapped_file_.map();
+      if(mapped_region_.address == nullptr) {
+        ec = mapped_file::last_error();
+        return (mapped_file_ = mapped_file{}), false;
+      }
+
+      char* const base = mapped_region_.address;
+      class header& h = *reinterpret_cast<class header*>(base);
+      std::memmove(base + occupancy_offset(h, new_capacity), base + occupancy_offset(h, old_capacity),
+                   occupancy_map::size_of(old_capacity));
+      for(size_type i = h.fields_count(); i-- != 0;)
+        std::memmove(base + column_offset(h, new_capacity, i), base + column_offset(h, old_capacity, i),
+                     std::size_t(old_capacity) * h.field_at(i).size_of());
+
+      h.capacity(new_capacity);
+      bind_region();
+      return true;
+    }
+
+
+  }; // columnar_storage
+
+
+} // cellarium
@@ -0,0 +1,264 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <system_error>
+
+#include "storage.hpp"
+#include "header.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  // Storage with free list allocation whose try_insert and remove may be
+  // called from many threads at once. Free slots are kept in several
+  // lists threaded through records as usual; a thread pushes to and pops
+  // from its own list and steals from the others only when it is empty.
+  // List heads carry a tag bumped by every change, so a compare-and-swap
+  // never succeeds against a head that was popped and pushed back meanwhile.
+  // Occupancy bits are set and reset atomically and live records are
+  // counted per list. Capacity stays fixed while open; counters and a
+  // single free list are written back by close and checkpoint, a storage
+  // not closed properly is repaired from the occupancy map by open
+  template<typename T>
+  class concurrent_storage {
+  public:
+
+    using storage_type = storage<T>;
+    using path_type = typename storage_type::path_type;
+    using size_type = typename storage_type::size_type;
+    using index_type = typename storage_type::index_type;
+    using value_type = T;
+
+    static constexpr index_type no_index = storage_type::no_index;
+    static constexpr size_type lists_count = 32;
+
+
+    concurrent_storage() noexcept = default;
+    ~concurrent_storage() { close(); }
+    concurrent_storage(concurrent_storage const&) = delete;
+    concurrent_storage& operator = (concurrent_storage const&) = delete;
+    explicit operator bool () const noexcept { return !!storage_; }
+    cellarium::header const* header() const noexcept { return storage_.header(); }
+    size_type capacity() const noexcept { return capacity_; }
+
+
+    size_type size() const noexcept {
+      std::int64_t total = 0;
+      for(auto const& each: counts_)
+        total += each.value.load(std::memory_order_relaxed);
+      return size_type(total);
+    }
+
+
+    // Allocation policy of specified is replaced by free list
+    bool create(path_type const& path, class header const& specified, std::error_code& ec) noexcept {
+      close();
+      if(!storage_.create(path, header::with_allocation(specified, allocation_policy::free_list), ec))
+        return false;
+      return (bind(), true);
+    }
+
+
+    bool open(path_type const& path, class header const& specified, std::error_code& ec) noexcept {
+      close();
+      if(!storage_.open(path, header::with_allocation(specified, allocation_policy::free_list), ec))
+        return false;
+      return (bind(), true);
+    }
+
+
+    // Has to be called with no operation in progress
+    void close() noexcept {
+      if(!storage_)
+        return;
+      std::error_code ec;
+      settle(ec);
+      storage_.close();
+    }
+
+
+    // Writes counters and the free list back, then the storage to disk.
+    // Has to be called with no operation in progress
+    bool checkpoint(std::error_code& ec) noexcept {
+      if(!settle(ec))
+        return false;
+      bind();
+      return storage_.checkpoint(ec);
+    }
+
+
+    index_type try_insert(T const& data) noexcept {
+      size_type const own = own_list();
+      index_type index = pop(own);
+      for(size_type i = 1; index == no_index && i != lists_count; ++i)
+        index = pop((own + i) % lists_count);
+      if(index == no_index) {
+        if(high_water_mark_.load(std::memory_order_relaxed) >= capacity_)
+          return no_index;
+        auto const next = high_water_mark_.fetch_add(1, std::memory_order_relaxed);
+        if(next >= capacity_)
+          return no_index;
+        index = index_type(next);
+      }
+      storage_.records_[index].fill(data);
+      occupancy_word(index).fetch_or(mask_of(index), std::memory_order_release);
+      counts_[own].value.fetch_add(1, std::memory_order_relaxed);
+      return index;
+    }
+
+
+    void remove(index_type index) noexcept {
+      size_type const own = own_list();
+      occupancy_word(index).fetch_and(~mask_of(index), std::memory_order_relaxed);
+      counts_[own].value.fetch_sub(1, std::memory_order_relaxed);
+      push(own, index);
+    }
+
+
+    bool contains(index_type index) const noexcept {
+      return (occupancy_word(index).load(std::memory_order_acquire) & mask_of(index)) != 0;
+    }
+
+
+    // Concurrent access to the same record is up to the caller
+    T const& operator [](index_type index) const noexcept { return storage_[index]; }
+    T& operator [](index_type index) noexcept { return storage_.records_[index].data(); }
+
+
+  private:
+
+    using word_type = occupancy_map::word_type;
+    using head_type = std::uint64_t;
+
+    static_assert(sizeof(std::atomic<index_type>) == sizeof(index_type), "Links have to be plain words");
+    static_assert(sizeof(std::atomic<word_type>) == sizeof(word_type), "Occupancy has to be plain words");
+
+    struct alignas(64) list_head {
+      std::atomic<head_type> value;
+    }; // list_head
+
+    // Inserts minus removes done by threads of a list, negative when they
+    // removed records inserted by others
+    struct alignas(64) list_count {
+      std::atomic<std::int64_t> value;
+    }; // list_count
+
+    storage_type storage_;
+    list_head heads_[lists_count];
+    list_count counts_[lists_count];
+    alignas(64) std::atomic<std::uint64_t> high_water_mark_{0};
+    size_type capacity_{0};
+
+
+    static head_type pack(head_type tag, index_type index) noexcept {
+      return (tag << 32) | index;
+    }
+
+
+    static index_type index_of(head_type head) noexcept { return index_type(head); }
+    static head_type tag_of(head_type head) noexcept { return head >> 32; }
+
+
+    static word_type mask_of(index_type index) noexcept {
+      return word_type(1) << (index % occupancy_map::bits_per_word);
+    }
+
+
+    // Threads get lists round robin in order of their first call
+    static size_type own_list() noexcept {
+      static std::atomic<size_type> threads{0};
+      thread_local size_type const list = threads.fetch_add(1, std::memory_order_relaxed) % lists_count;
+      return list;
+    }
+
+
+    std::atomic<word_type>& occupancy_word(index_type index) const noexcept {
+      return *reinterpret_cast<std::atomic<word_type>*>(
+        const_cast<word_type*>(storage_.occupancy().data()) + index / occupancy_map::bits_per_word);
+    }
+
+
+    // Link to the next free slot shares its place with the record data
+    std::atomic<index_type>& link_of(index_type index) noexcept {
+      return *reinterpret_cast<std::atomic<index_type>*>(storage_.records_ + index);
+    }
+
+
+    index_type pop(size_type list) noexcept {
+      auto& head = heads_[list].value;
+      head_type current = head.load(std::memory_order_acquire);
+      while(index_of(current) != no_index) {
+        // A stale link read from a slot popped meanwhile fails the tag check
+        index_type const next = link_of(index_of(current)).load(std::memory_order_relaxed);
+        if(head.compare_exchange_weak(current, pack(tag_of(current) + 1, next),
+                                      std::memory_order_acquire, std::memory_order_acquire))
+          return index_of(current);
+      }
+      return no_index;
+    }
+
+
+    void push(size_type list, index_type index) noexcept {
+      auto& head = heads_[list].value;
+      head_type current = head.load(std::memory_order_relaxed);
+      do {
+        link_of(index).store(index_of(current), std::memory_order_relaxed);
+      } while(!head.compare_exchange_weak(current, pack(tag_of(current) + 1, index),
+                                          std::memory_order_release, std::memory_order_relaxed));
+    }
+
+
+    // On-disk free list goes to the first list, the others start empty
+    void bind() noexcept {
+      cellarium::header const& h = *storage_.header();
+      capacity_ = h.capacity();
+      high_water_mark_.store(h.high_water_mark(), std::memory_order_relaxed);
+      heads_[0].value.store(pack(0, h.free_index()), std::memory_order_relaxed);
+      counts_[0].value.store(h.items_count(), std::memory_order_relaxed);
+      for(size_type i = 1; i != lists_count; ++i) {
+        heads_[i].value.store(pack(0, no_index), std::memory_order_relaxed);
+        counts_[i].value.store(0, std::memory_order_relaxed);
+      }
+    }
+
+
+    // Lists are merged by threading a single one through free slots below
+    // the high-water mark
+    bool settle(std::error_code& ec) noexcept {
+      auto const mark = high_water_mark_.load(std::memory_order_relaxed);
+      storage_.header_->high_water_mark(index_type(mark < capacity_ ? mark : capacity_));
+      return storage_.repair(ec);
+    }
+
+  }; // concurrent_storage
+
+
+} // cellarium
@@ -0,0 +1,131 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "occupancy_map.hpp"
+
+
+namespace cellarium {
+
+
+  // Bit per page of a mapping modified since it was last drained. Marking
+  // may race with draining from another thread; resizing may not
+  class dirty_pages {
+  public:
+
+    using size_type = std::size_t;
+    using word_type = std::uint64_t;
+
+    static constexpr size_type bits_per_word = 64;
+
+
+    dirty_pages() noexcept = default;
+    dirty_pages(dirty_pages const&) = delete;
+    dirty_pages& operator = (dirty_pages const&) = delete;
+    explicit operator bool () const noexcept { return words_ != nullptr; }
+    size_type page_size() const noexcept { return page_size_; }
+
+
+    // Covers bytes of the mapping keeping marks of pages already covered;
+    // page_size is a power of two. Throws std::bad_alloc
+    void resize(size_type bytes, size_type page_size) {
+      size_type const pages = (bytes + page_size - 1) / page_size;
+      size_type const words_count = (pages + bits_per_word - 1) / bits_per_word;
+      std::unique_ptr<std::atomic<word_type>[]> words{new std::atomic<word_type>[words_count]};
+      for(size_type i = 0; i != words_count; ++i)
+        words[i].store(i < words_count_ ? words_[i].load(std::memory_order_relaxed) : 0,
+                       std::memory_order_relaxed);
+      words_ = std::move(words);
+      words_count_ = words_count;
+      pages_ = pages;
+      page_size_ = page_size;
+    }
+
+
+    void clear() noexcept {
+      words_.reset();
+      words_count_ = 0;
+      pages_ = 0;
+    }
+
+
+    void mark(size_type offset, size_type length) noexcept {
+      size_type const last = (offset + length - 1) / page_size_;
+      for(size_type page = offset / page_size_; page <= last && page < pages_; ++page) {
+        std::atomic<word_type>& word = words_[page / bits_per_word];
+        word_type const bit = word_type(1) << (page % bits_per_word);
+        // Plain load first: hot pages are already marked
+        if((word.load(std::memory_order_relaxed) & bit) == 0)
+          word.fetch_or(bit, std::memory_order_release);
+      }
+    }
+
+
+    void mark_all() noexcept {
+      for(size_type i = 0; i != words_count_; ++i)
+        words_[i].store(~word_type(0), std::memory_order_release);
+    }
+
+
+    // Clears marks and calls f(offset, length) for every run of adjacent
+    // dirty pages, lowest first
+    template<typename F> void drain(F&& f) {
+      size_type run_first = 0, run_length = 0;
+      for(size_type i = 0; i != words_count_; ++i) {
+        word_type bits = words_[i].exchange(0, std::memory_order_acquire);
+        for(; bits != 0; bits &= bits - 1) {
+          size_type const page = i * bits_per_word + detail::count_trailing_zeros(bits);
+          if(page >= pages_)
+            break;
+          if(run_length != 0 && run_first + run_length == page) {
+            ++run_length;
+            continue;
+          }
+          if(run_length != 0)
+            f(run_first * page_size_, run_length * page_size_);
+          run_first = page;
+          run_length = 1;
+        }
+      }
+      if(run_length != 0)
+        f(run_first * page_size_, run_length * page_size_);
+    }
+
+
+  private:
+
+    std::unique_ptr<std::atomic<word_type>[]> words_;
+    size_type words_count_{0};
+    size_type pages_{0};
+    size_type page_size_{1};
+
+  }; // dirty_pages
+
+
+} // cellarium
@@ -34,7 +34,8 @@ namespace cellarium {
     different_data_version, different_data_size, invalid_file_size,
     not_enough_memory, not_enough_pages, storage_not_found_to_open,
     invalid_json_data,
-    merging_incompatible_storages
+    merging_incompatible_storages, unsupported_field_kind, field_not_found,
+    address_space_exhausted, invalid_journal, invalid_index, incompatible_fields
   }; // error
   
   
@@ -45,7 +46,7 @@ namespace cellarium {
     }
     
     std::string message(int code) const noexcept override {
-      switch(code) {
+      switch(error(code)) {
         case error::none:
           return "None";
         case error::invalid_specified_header:
@@ -70,6 +71,18 @@ namespace cellarium {
           return "Unable to merge incompatible storages";
         case error::invalid_json_data:
           return "Invalid JSON data";
+        case error::unsupported_field_kind:
+          return "Field kind is not supported by the operation";
+        case error::field_not_found:
+          return "Field is not found";
+        case error::address_space_exhausted:
+          return "Reserved address space is exhausted";
+        case error::invalid_journal:
+          return "Journal entry does not match the storage";
+        case error::invalid_index:
+          return "Index file does not match the storage";
+        case error::incompatible_fields:
+          return "Fields of the same name have incompatible kinds";
         default:
           return "Unknown";
       }
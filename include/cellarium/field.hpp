@@ -263,6 +263,14 @@ namespace cellarium {
     }
     
     
+    // Same field placed at offset within the record
+    static field with_offset(field const& other, size_type offset) noexcept {
+      field r{other};
+      r.offset(offset);
+      return r;
+    }
+    
+    
     field(field const&) noexcept = default;
     field& operator = (field const&) noexcept = default;
     field_kind kind() const noexcept { return kind_; }
@@ -49,8 +49,12 @@
 #include <handleapi.h>
 
 #else
-  
-#error Unsupported system
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 #endif // WIN32
 
@@ -203,6 +207,40 @@ public:
     return true;
   }
 
+
+  bool sync() noexcept {
+    return FlushFileBuffers(handle_) != 0;
+  }
+
+
+  bool sync_data() noexcept {
+    return FlushFileBuffers(handle_) != 0;
+  }
+
+
+  bool read_at(offset_type offset, char* buffer, size_type size) noexcept {
+    OVERLAPPED at{};
+    at.Offset = DWORD(offset);
+    at.OffsetHigh = DWORD(offset >> 32);
+    DWORD n;
+    bool const ok = ReadFile(handle_, buffer, static_cast<DWORD>(size), &n, &at);
+    if(!ok || n != static_cast<DWORD>(size))
+      return false;
+    return true;
+  }
+
+
+  bool write_at(offset_type offset, char const* buffer, size_type size) noexcept {
+    OVERLAPPED at{};
+    at.Offset = DWORD(offset);
+    at.OffsetHigh = DWORD(offset >> 32);
+    DWORD n;
+    bool const ok = WriteFile(handle_, buffer, static_cast<DWORD>(size), &n, &at);
+    if(!ok || n != static_cast<DWORD>(size))
+      return false;
+    return true;
+  }
+
 private:
 
   handle_type handle_{INVALID_HANDLE_VALUE};
@@ -213,29 +251,26 @@ private:
   using handle_type = int;
 
   static file create(std::filesystem::path const& path) noexcept {
-    int const handle = ::open(path.native().data(), O_CREAT | O_RDWR | O_TRUNC,
+    int const handle = ::open(path.native().data(), O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC,
                               S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
     return file{handle};
   }
 
 
   static file open_to_append(std::filesystem::path const& path) noexcept {
-    int const handle = ::open(path.native().data(), O_WRONLY);
-    if(handle == -1)
-      return file{handle}
-    lseek(handle, 0, SEEK_END);
+    int const handle = ::open(path.native().data(), O_WRONLY | O_APPEND | O_CLOEXEC);
     return file{handle};
   }
 
 
   static file open_to_read(std::filesystem::path const& path) noexcept {
-    int const handle = ::open(path.native().data(), O_RDONLY);
+    int const handle = ::open(path.native().data(), O_RDONLY | O_CLOEXEC);
     return file{handle};
   }
 
 
   static file open_to_rw(std::filesystem::path const& path) noexcept {
-    int const handle = ::open(path.native().data(), O_RDWR);
+    int const handle = ::open(path.native().data(), O_RDWR | O_CLOEXEC);
     return file{handle};
   }
   
@@ -270,27 +305,110 @@ private:
   }
 
 
+  size_type size() const noexcept {
+    struct stat st;
+    if(::fstat(handle_, &st) == -1)
+      return invalid_size;
+    return static_cast<size_type>(st.st_size);
+  }
+
+
   bool read(char* buffer, size_type size) noexcept {
-    size_type const n = ::read(handle_, buffer, size);
-    if(n != size)
-      return false;
+    while(size != 0) {
+      ssize_t const n = ::read(handle_, buffer, static_cast<std::size_t>(size));
+      if(n == -1 && errno == EINTR)
+        continue;
+      if(n <= 0)
+        return false;
+      buffer += n; size -= n;
+    }
     return true;
   }
     
 
   bool write(char const* buffer, size_type size) noexcept {
-    size_type const n = ::write(handle_, buffer, size);
-    if(n != size)
-      return false;
+    while(size != 0) {
+      ssize_t const n = ::write(handle_, buffer, static_cast<std::size_t>(size));
+      if(n == -1 && errno == EINTR)
+        continue;
+      if(n <= 0)
+        return false;
+      buffer += n; size -= n;
+    }
+    return true;
+  }
+
+
+  bool read_at(offset_type offset, char* buffer, size_type size) noexcept {
+    while(size != 0) {
+      ssize_t const n = ::pread(handle_, buffer, static_cast<std::size_t>(size),
+                                static_cast<off_t>(offset));
+      if(n == -1 && errno == EINTR)
+        continue;
+      if(n <= 0)
+        return false;
+      buffer += n; size -= n; offset += n;
+    }
+    return true;
+  }
+
+
+  bool write_at(offset_type offset, char const* buffer, size_type size) noexcept {
+    while(size != 0) {
+      ssize_t const n = ::pwrite(handle_, buffer, static_cast<std::size_t>(size),
+                                 static_cast<off_t>(offset));
+      if(n == -1 && errno == EINTR)
+        continue;
+      if(n <= 0)
+        return false;
+      buffer += n; size -= n; offset += n;
+    }
     return true;
   }
   
 
-  bool resize(size_type size) noexcept {
-    if(ftruncate(handle_, static_cast<off_t>(size)) == -1)
+  bool resize(size_type new_size) noexcept {
+#ifdef __linux__
+    // Growing with fallocate reserves the blocks up front, so later page
+    // faults on the mapping never hit ENOSPC (SIGBUS) and the file stays
+    // contiguous; fall back to ftruncate where it is not supported
+    size_type const old_size = size();
+    if(old_size != invalid_size && new_size > old_size) {
+      int const rc = ::fallocate(handle_, 0, static_cast<off_t>(old_size),
+                                 static_cast<off_t>(new_size - old_size));
+      if(rc == 0)
+        return true;
+      if(errno != EOPNOTSUPP && errno != ENOSYS)
+        return false;
+    }
+#endif // __linux__
+    if(::ftruncate(handle_, static_cast<off_t>(new_size)) == -1)
       return false;
     return true;
   }
+
+
+  bool seek(offset_type offset) noexcept {
+    if(::lseek(handle_, static_cast<off_t>(offset), SEEK_SET) == -1)
+      return false;
+    return true;
+  }
+
+
+  // Data and metadata of the file reach the device
+  bool sync() noexcept {
+    return ::fsync(handle_) == 0;
+  }
+
+
+  // Data reach the device, metadata only when needed to read them back
+  bool sync_data() noexcept {
+#if defined(__linux__)
+    return ::fdatasync(handle_) == 0;
+#else
+    return ::fsync(handle_) == 0;
+#endif
+  }
   
 private:
 
@@ -23,6 +23,8 @@
 #pragma once
 
 
+#include <cstddef>
+#include <string>
 #include <vector>
 #include <filesystem>
 #include <system_error>
@@ -37,6 +39,7 @@ class file_manager {
 public:
 
   using path_type = std::filesystem::path;
+  using size_type = std::size_t;
   
   file_manager() noexcept = default;
   file_manager(file_manager const&) = default;
@@ -54,25 +57,33 @@ public:
   
   bool remove_all(std::error_code& ec) {
     
-    enlist(ec, [](path_type const& path) {
-      std::filesystem::remove(path, ec);
+    std::error_code removing;
+    enlist(ec, [&removing](path_type const& path) {
+      if(!removing)
+        std::filesystem::remove(path, removing);
     });
     
+    if(!ec)
+      ec = removing;
     return !ec;    
   }
   
   
   path_type name_for_page(size_type page_index) const {
     
-    if(page_index == 0)
-      return directory_slash_name_ + extension_;
-    else
-      return directory_slash_name_ + '@' + std::to_string(page_index + 1) + extension_;
+    path_type result{directory_slash_name_};
+    if(page_index != 0)
+      result += '@' + std::to_string(page_index + 1);
+    result += extension_;
+    return result;
   }
   
   
   path_type generate_zero_page_name() const {
-    return directory_slash_name_ + '@' + '0' + extension_;
+    path_type result{directory_slash_name_};
+    result += "@0";
+    result += extension_;
+    return result;
   }
   
   
@@ -91,7 +102,7 @@ public:
 
 private:
 
-  path_type directory_slash_name_
+  path_type directory_slash_name_;
   path_type extension_;
 
   
@@ -101,7 +112,6 @@ private:
     namespace fs = std::filesystem;
     path_type current_name = name_for_page(0);
     
-    std::error_code ec;
     if(!fs::exists(current_name, ec))
       return !ec;
     
@@ -0,0 +1,99 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+
+namespace cellarium {
+
+
+  // Background thread calling flush(ec) of a storage every interval, so
+  // writers never wait for the disk. Stop it before the storage is closed
+  class flusher {
+  public:
+
+    using interval_type = std::chrono::milliseconds;
+
+
+    flusher() noexcept = default;
+    ~flusher() { stop(); }
+    flusher(flusher const&) = delete;
+    flusher& operator = (flusher const&) = delete;
+    bool running() const noexcept { return thread_.joinable(); }
+
+
+    // Throws std::system_error
+    template<typename S> void start(S& target, interval_type interval) {
+      stop();
+      stopping_ = false;
+      thread_ = std::thread{[this, &target, interval] {
+        std::unique_lock<std::mutex> lock{mutex_};
+        while(!wake_.wait_for(lock, interval, [this] { return stopping_; })) {
+          lock.unlock();
+          std::error_code ec;
+          bool const flushed = target.flush(ec);
+          lock.lock();
+          if(!flushed)
+            last_error_ = ec;
+        }
+      }};
+    }
+
+
+    void stop() noexcept {
+      if(!thread_.joinable())
+        return;
+      {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stopping_ = true;
+      }
+      wake_.notify_one();
+      thread_.join();
+    }
+
+
+    // Error of the last failed flush
+    std::error_code last_error() const {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return last_error_;
+    }
+
+
+  private:
+
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_{false};
+    std::error_code last_error_;
+
+  }; // flusher
+
+
+} // cellarium
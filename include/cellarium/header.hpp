@@ -23,7 +23,9 @@
 #pragma once
 
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <initializer_list>
 #include <limits>
 #include "field.hpp"
@@ -32,6 +34,13 @@
 namespace cellarium {
   
   
+  enum class allocation_policy: std::uint32_t {
+    
+    free_list,   // most recently removed slot first
+    lowest_free  // lowest free slot, keeps live records dense at the front
+    
+  }; // allocation_policy
+  
 
   class header {
   public:
@@ -40,7 +49,7 @@ namespace cellarium {
     using size_type = std::uint32_t;
     
     static constexpr std::uint32_t valid_signature = 0xDA1AF11E;
-    static constexpr std::uint32_t valid_format_version = 1;
+    static constexpr std::uint32_t valid_format_version = 6;
     static constexpr size_type fields_capacity = 64;
     static constexpr index_type no_index = index_type(-1);
 
@@ -72,6 +81,13 @@ namespace cellarium {
     }
     
     
+    static header with_allocation(header const& other, allocation_policy policy) {
+      header r{other};
+      r.allocation(policy);
+      return r;
+    }
+    
+    
     header() noexcept = default;
     header(header const&) noexcept = default;
     header& operator = (header const&) noexcept = default;
@@ -82,14 +98,31 @@ namespace cellarium {
     size_type capacity() const noexcept { return capacity_; }
     size_type page_number() const noexcept { return page_number_; }
     index_type free_index() const noexcept { return free_index_; }
+    index_type high_water_mark() const noexcept { return high_water_mark_; }
+    size_type items_count() const noexcept { return items_count_; }
+    bool clean() const noexcept { return clean_ != 0; }
     float occupancy_factor() const noexcept { return occupancy_factor_; }
+    allocation_policy allocation() const noexcept { return allocation_; }
     void free_index(index_type index) noexcept { free_index_ = index; }
+    void high_water_mark(index_type index) noexcept { high_water_mark_ = index; }
+    void items_count(size_type n) noexcept { items_count_ = n; }
+    void clean(bool flag) noexcept { clean_ = flag ? 1 : 0; }
     void capacity(size_type n) noexcept { capacity_ = ceil2(n); }
     void occupancy_factor(float f) noexcept { occupancy_factor_ = f; }
+    void allocation(allocation_policy policy) noexcept { allocation_ = policy; }
     field const* begin() const noexcept { return &fields_[0]; }
     field const* end() const noexcept { return &fields_[fields_count_]; }
     size_type fields_count() const noexcept { return fields_count_; }
     field const& field_at(index_type n) const noexcept { return fields_[n]; }
+
+
+    // nullptr if there is no field with such name
+    field const* find_field(char const* name) const noexcept {
+      for(field const& each: *this)
+        if(std::strcmp(each.name(), name) == 0)
+          return &each;
+      return nullptr;
+    }
             
         
     explicit operator bool () const noexcept {
@@ -107,8 +140,33 @@ namespace cellarium {
     }
     
     
+    bool has_valid_items_count() const noexcept {
+      return clean_ != 0 && items_count_ <= capacity_;
+    }
+    
+    
+    // Capacities are powers of two, at least 2
+    static std::uint32_t ceil2(std::uint32_t n) noexcept {
+      if(n < 2)
+        return 2;
+      n--;
+      n |= n >> 1;
+      n |= n >> 2;
+      n |= n >> 4;
+      n |= n >> 8;
+      n |= n >> 16;
+      n++;
+      return n;
+    }
+    
+    
+    size_type fitting_capacity(size_type size) const noexcept {
+      return ceil2(size_type(size / occupancy_factor_ + 0.5f));
+    }
+    
+    
     size_type needed_capacity(size_type size) const noexcept {
-      size_type r = ceil2(size_type(size / occupancy_factor_ + 0.5f));
+      size_type r = fitting_capacity(size);
       if(capacity_ > r)
         r = capacity_;
       return r;
@@ -131,24 +189,14 @@ namespace cellarium {
     size_type capacity_{0};
     size_type page_number_{0};
     index_type free_index_{no_index};
+    index_type high_water_mark_{0}; // slots from here on were never used
+    size_type items_count_{0};
+    std::uint32_t clean_{1}; // storage was closed properly, items_count_ is exact
     float occupancy_factor_{.0f};
+    allocation_policy allocation_{allocation_policy::free_list};
     size_type fields_count_{0};
     field fields_[fields_capacity];
     
-
-    static std::uint32_t ceil2(std::uint32_t n) {
-      if(n < 2)
-        return 2;
-      n--;
-      n |= n >> 1;
-      n |= n >> 2;
-      n |= n >> 4;
-      n |= n >> 8;
-      n |= n >> 16;
-      n++;
-      return n;
-    }
-
     
     template<typename It>
     header(std::uint32_t data_version, std::uint32_t data_size, size_type capacity,
@@ -172,5 +220,10 @@ namespace cellarium {
     }
 
   }; // header
+
+
+  // Offset of the first record in a storage file: the header rounded up
+  // to a cache line, so records of any alignment up to 64 are aligned
+  inline constexpr std::size_t records_offset = (sizeof(header) + 63) & ~std::size_t(63);
   
 } // cellarium
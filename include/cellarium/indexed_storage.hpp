@@ -0,0 +1,553 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#include "header.hpp"
+#include "storage.hpp"
+#include "paged_storage.hpp"
+#include "unordered_storage.hpp"
+#include "ordered_storage.hpp"
+#include "key.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  enum class index_kind {
+    hash, ordered
+  }; // index_kind
+
+
+  struct index_spec {
+    char const* field_name;
+    index_kind kind;
+  }; // index_spec
+
+
+  // storage<T> or paged_storage<T> with secondary indexes over some of
+  // its fields, kept beside the storage (path with ".<field>.hash" or
+  // ".<field>.btree" appended), at most one of each kind per field. Keys
+  // need not be unique, though equal keys share a probe chain of a hash
+  // index: fields with many duplicates are better indexed ordered. Every
+  // insertion, removal and update changes the indexes along, and queries by field
+  // name use a hash index for equality, an ordered one for equality,
+  // ranges and prefixes, and scan every record when the field has no
+  // index. Indexes persist and are built again when they or the storage
+  // were not closed properly
+  template<typename T, typename S = cellarium::storage<T>>
+  class indexed_storage {
+  public:
+
+    using storage_type = S;
+    using path_type = typename storage_type::path_type;
+    using size_type = typename storage_type::size_type;
+    using index_type = typename storage_type::index_type;
+    using value_type = T;
+
+    static constexpr index_type no_index = storage_type::no_index;
+    static constexpr bool paged = std::is_same_v<S, paged_storage<T>>;
+
+    static_assert(paged || std::is_same_v<S, cellarium::storage<T>>, "Only storage and paged_storage can be indexed");
+
+
+    static path_type index_path(path_type const& path, char const* field_name, index_kind kind) {
+      path_type result = path;
+      result += '.';
+      result += field_name;
+      result += kind == index_kind::hash ? ".hash" : ".btree";
+      return result;
+    }
+
+
+    indexed_storage() noexcept = default;
+    ~indexed_storage() { close(); }
+    indexed_storage(indexed_storage const&) = delete;
+    indexed_storage& operator = (indexed_storage const&) = delete;
+    explicit operator bool () const noexcept { return !!storage_; }
+    storage_type const& storage() const noexcept { return storage_; }
+    size_type size() const noexcept { return storage_.size(); }
+    size_type indexes_count() const noexcept { return indexes_count_; }
+    void growth_factor(size_type factor) noexcept { storage_.growth_factor(factor); }
+
+
+    bool create(path_type const& path, class header const& specified,
+                std::initializer_list<index_spec> indexes, std::error_code& ec) noexcept {
+      close();
+      if(!storage_.create(path, specified, ec))
+        return false;
+      return attach(path, specified, indexes, false, ec);
+    }
+
+
+    bool open(path_type const& path, class header const& specified,
+              std::initializer_list<index_spec> indexes, std::error_code& ec) noexcept {
+      close();
+      bool const clean = storage_clean(path);
+      if(!storage_.open(path, specified, ec))
+        return false;
+      return attach(path, specified, indexes, clean, ec);
+    }
+
+
+    // paged_storage only, throws as paged_storage::create
+    bool create(path_type const& path, size_type max_pages, class header const& specified,
+                std::initializer_list<index_spec> indexes, std::error_code& ec) {
+      close();
+      if(!storage_.create(path, max_pages, specified, ec))
+        return false;
+      return attach(path, specified, indexes, false, ec);
+    }
+
+
+    // paged_storage only, throws as paged_storage::open. Indexes are
+    // rebuilt when pages were merged on opening
+    bool open(path_type const& path, size_type max_pages, class header const& specified,
+              std::initializer_list<index_spec> indexes, std::error_code& ec) {
+      close();
+      bool const clean = storage_clean(path);
+      if(!storage_.open(path, max_pages, specified, ec))
+        return false;
+      return attach(path, specified, indexes, clean, ec);
+    }
+
+
+    void close() noexcept {
+      for(size_type i = 0; i != indexes_count_; ++i) {
+        indexes_[i].hash.close();
+        indexes_[i].tree.close();
+      }
+      indexes_.reset();
+      indexes_count_ = 0;
+      storage_.close();
+    }
+
+
+    // No index when the storage is full; ec is set only when an index can
+    // not be extended, the record is not inserted then
+    index_type try_insert(T const& data, std::error_code& ec) noexcept {
+      if(!reserve_hashes(ec))
+        return no_index;
+      index_type const index = storage_.try_insert(data);
+      if(index == no_index)
+        return no_index;
+      size_type const added = add_keys(index, data, ec);
+      if(added != indexes_count_)
+        return remove_keys(index, data, added), storage_.remove(index), no_index;
+      return index;
+    }
+
+
+    void remove(index_type index) noexcept {
+      remove_keys(index, record(index), indexes_count_);
+      storage_.remove(index);
+    }
+
+
+    // False when an index can not be extended, nothing is updated then
+    bool update(index_type index, T const& data, std::error_code& ec) noexcept {
+      if(!rekey(index, record(index), data, ec))
+        return false;
+      storage_.update(index, data);
+      return true;
+    }
+
+
+    // Calls f(T&) on the record in place. The record is restored and false
+    // returned when an index can not be extended
+    template<typename F> bool modify(index_type index, F&& f, std::error_code& ec) {
+      T const old = record(index);
+      f(storage_[index]);
+      if(rekey(index, old, record(index), ec))
+        return true;
+      storage_.update(index, old);
+      return false;
+    }
+
+
+    T const& operator [](index_type index) const noexcept {
+      return record(index);
+    }
+
+
+    // Some record with key in the field or no index
+    template<typename K> index_type find(char const* field_name, K const& key) const {
+      index_type found = no_index;
+      visit_equal(field_name, key, [&](index_type i) {
+        found = i;
+        return false;
+      });
+      return found;
+    }
+
+
+    // Calls f(index) for records with key in the field, in key order
+    // when the field has an ordered index only
+    template<typename K, typename F> void for_each_equal(char const* field_name, K const& key, F&& f) const {
+      visit_equal(field_name, key, [&](index_type i) {
+        f(i);
+        return true;
+      });
+    }
+
+
+    // Calls f(index) for records with keys in the field in [from, to), in
+    // key order when the field has an ordered index only
+    template<typename K1, typename K2, typename F>
+    void for_range(char const* field_name, K1 const& from, K2 const& to, F&& f) const {
+      record_key const key = key_of(field_name);
+      if(!key || !key.orderable())
+        return;
+      key_buffer lower, upper;
+      normalize(key, from, lower);
+      normalize(key, to, upper);
+      size_type const width = key.normalized_size();
+      if(secondary const* const s = find_index(field_name, index_kind::ordered)) {
+        for(btree_index::cursor c = s->tree.lower_bound(lower.bytes);
+            c && std::memcmp(c.key(), upper.bytes, width) < 0; c.next())
+          f(c.index());
+        return;
+      }
+      for_each_index([&](index_type i) {
+        key_buffer k;
+        normalize(key, key.of(&record(i)), k);
+        if(std::memcmp(k.bytes, lower.bytes, width) >= 0 && std::memcmp(k.bytes, upper.bytes, width) < 0)
+          f(i);
+      });
+    }
+
+
+    // Calls f(index) for records with string keys in the field starting
+    // with prefix, in key order when the field has an ordered index only
+    template<typename F> void for_prefix(char const* field_name, std::string_view prefix, F&& f) const {
+      record_key const key = key_of(field_name);
+      if(!key || prefix.size() > key.size())
+        return;
+      if(secondary const* const s = find_index(field_name, index_kind::ordered)) {
+        key_buffer lower;
+        normalize(key, prefix, lower);
+        for(btree_index::cursor c = s->tree.lower_bound(lower.bytes);
+            c && std::memcmp(c.key(), prefix.data(), prefix.size()) == 0; c.next())
+          f(c.index());
+        return;
+      }
+      for_each_index([&](index_type i) {
+        if(key.of(&record(i)).substr(0, prefix.size()) == prefix)
+          f(i);
+      });
+    }
+
+
+    template<typename F> void for_each(F&& f) const {
+      storage_.for_each(std::forward<F>(f));
+    }
+
+
+  private:
+
+    struct secondary {
+      char name[field::name_capacity + 1];
+      index_kind kind;
+      bool changed; // by the record being rekeyed
+      record_key key;
+      path_type path;
+      hash_index hash;
+      btree_index tree;
+    }; // secondary
+
+    struct key_buffer {
+      unsigned char bytes[btree_index::max_key_size];
+    }; // key_buffer
+
+    storage_type storage_;
+    std::unique_ptr<secondary[]> indexes_;
+    size_type indexes_count_{0};
+
+
+    T const& record(index_type index) const noexcept {
+      return storage_[index];
+    }
+
+
+    template<typename F> void for_each_index(F&& f) const {
+      if constexpr(paged)
+        storage_.for_each_index(std::forward<F>(f));
+      else
+        storage_.occupancy().for_each(std::forward<F>(f));
+    }
+
+
+    cellarium::header const* catalog() const noexcept {
+      if constexpr(paged)
+        return storage_.page(0).header();
+      else
+        return storage_.header();
+    }
+
+
+    // Indexes of paged storage persist only while it has a single page
+    static bool storage_clean(path_type const& path) noexcept {
+      try {
+        if constexpr(paged) {
+          std::error_code ec;
+          auto const files = file_manager{path}.list(ec);
+          if(!!ec || files.size() != 1)
+            return false;
+        }
+        class header actual; size_type items_count; std::error_code ec;
+        return cellarium::storage<T>::read_info(path, actual, items_count, ec) && actual.clean();
+      } catch(std::bad_alloc const&) {
+        return false;
+      }
+    }
+
+
+    bool attach(path_type const& path, class header const& specified,
+                std::initializer_list<index_spec> indexes, bool clean, std::error_code& ec) noexcept {
+      indexes_.reset(new(std::nothrow) secondary[indexes.size()]);
+      if(!indexes_)
+        return (ec = std::error_code{error::not_enough_memory}), close(), false;
+      try {
+        for(index_spec const& spec: indexes) {
+          field const* const found = specified.find_field(spec.field_name);
+          if(found == nullptr)
+            return (ec = std::error_code{error::field_not_found}), close(), false;
+          if(find_index(found->name(), spec.kind) != nullptr)
+            return (ec = std::error_code{error::invalid_specified_header}), close(), false;
+          secondary& s = indexes_[indexes_count_++];
+          std::strcpy(s.name, found->name());
+          s.kind = spec.kind;
+          s.key = record_key{*found};
+          s.path = index_path(path, s.name, s.kind);
+          if(!open_index(s, clean, specified.capacity(), ec))
+            return close(), false;
+        }
+      } catch(std::bad_alloc const&) {
+        return (ec = std::error_code{error::not_enough_memory}), close(), false;
+      }
+      return true;
+    }
+
+
+    bool open_index(secondary& s, bool clean, size_type capacity, std::error_code& ec) noexcept {
+      std::error_code opening;
+      if(s.kind == index_kind::hash) {
+        if(clean && s.hash.open(s.path, s.key, opening) && s.hash.size() == storage_.size())
+          return true;
+        return rebuild(s, capacity, ec);
+      }
+      if(clean && s.tree.open(s.path, s.key, opening) && s.tree.size() == storage_.size())
+        return true;
+      return rebuild(s, capacity, ec);
+    }
+
+
+    // Index for at least items is built again from live records
+    bool rebuild(secondary& s, size_type items, std::error_code& ec) noexcept {
+      if(s.kind == index_kind::hash) {
+        size_type const needed = storage_.size() > items ? storage_.size() : items;
+        if(!s.hash.create(s.path, 2 * needed, s.key, ec))
+          return false;
+        for_each_index([&](index_type i) { s.hash.insert(record_key::hash(s.key.of(&record(i))), i); });
+        return true;
+      }
+      if(!s.tree.create(s.path, s.key, ec))
+        return false;
+      bool done = true;
+      for_each_index([&](index_type i) {
+        key_buffer k;
+        normalize(s.key, s.key.of(&record(i)), k);
+        done = done && s.tree.insert(k.bytes, i, ec);
+      });
+      return done;
+    }
+
+
+    // Hash indexes get room for one more key before anything changes
+    bool reserve_hashes(std::error_code& ec) noexcept {
+      for(size_type i = 0; i != indexes_count_; ++i) {
+        secondary& s = indexes_[i];
+        if(s.kind == index_kind::hash && s.hash.needs_growth() && !rebuild(s, s.hash.size() + 1, ec))
+          return false;
+      }
+      return true;
+    }
+
+
+    bool add_key(secondary& s, index_type index, T const& data, std::error_code& ec) noexcept {
+      if(s.kind == index_kind::hash)
+        return s.hash.insert(record_key::hash(s.key.of(&data)), index), true;
+      key_buffer k;
+      normalize(s.key, s.key.of(&data), k);
+      return s.tree.insert(k.bytes, index, ec);
+    }
+
+
+    void remove_key(secondary& s, index_type index, T const& data) noexcept {
+      if(s.kind == index_kind::hash) {
+        s.hash.erase(record_key::hash(s.key.of(&data)), index);
+        return;
+      }
+      key_buffer k;
+      normalize(s.key, s.key.of(&data), k);
+      s.tree.erase(k.bytes, index);
+    }
+
+
+    // Number of indexes the key of data was added to, stops at the first
+    // failure
+    size_type add_keys(index_type index, T const& data, std::error_code& ec) noexcept {
+      size_type i = 0;
+      for(; i != indexes_count_ && add_key(indexes_[i], index, data, ec); ++i);
+      return i;
+    }
+
+
+    void remove_keys(index_type index, T const& data, size_type count) noexcept {
+      for(size_type i = 0; i != count; ++i)
+        remove_key(indexes_[i], index, data);
+    }
+
+
+    // Moves index from keys of old_data to keys of new_data in indexes
+    // where they differ. New keys are added first, so a failure leaves
+    // every index as it was
+    bool rekey(index_type index, T const& old_data, T const& new_data, std::error_code& ec) noexcept {
+      if(!reserve_hashes(ec))
+        return false;
+      size_type i = 0;
+      for(; i != indexes_count_; ++i) {
+        secondary& s = indexes_[i];
+        s.changed = s.key.of(&old_data) != s.key.of(&new_data);
+        if(s.changed && !add_key(s, index, new_data, ec))
+          break;
+      }
+      if(i != indexes_count_) {
+        while(i-- != 0)
+          if(indexes_[i].changed)
+            remove_key(indexes_[i], index, new_data);
+        return false;
+      }
+      for(i = 0; i != indexes_count_; ++i)
+        if(indexes_[i].changed)
+          remove_key(indexes_[i], index, old_data);
+      return true;
+    }
+
+
+    secondary const* find_index(char const* field_name, index_kind kind) const noexcept {
+      for(size_type i = 0; i != indexes_count_; ++i)
+        if(indexes_[i].kind == kind && std::strcmp(indexes_[i].name, field_name) == 0)
+          return &indexes_[i];
+      return nullptr;
+    }
+
+
+    record_key key_of(char const* field_name) const noexcept {
+      field const* const found = catalog()->find_field(field_name);
+      return found != nullptr ? record_key{*found} : record_key{};
+    }
+
+
+    static void normalize(record_key const& key, std::string_view value, key_buffer& out) noexcept {
+      key.normalize(value, out.bytes);
+    }
+
+
+    static void normalize(record_key const& key, char const* value, key_buffer& out) noexcept {
+      key.normalize(std::string_view{value}, out.bytes);
+    }
+
+
+    template<typename V, typename = std::enable_if_t<std::is_arithmetic_v<V>>>
+    static void normalize(record_key const& key, V value, key_buffer& out) noexcept {
+      char buffer[8];
+      key.normalize(key.encode(value, buffer), out.bytes);
+    }
+
+
+    static std::string_view significant(record_key const&, std::string_view value, char*) noexcept {
+      return value;
+    }
+
+
+    static std::string_view significant(record_key const&, char const* value, char*) noexcept {
+      return std::string_view{value};
+    }
+
+
+    template<typename V, typename = std::enable_if_t<std::is_arithmetic_v<V>>>
+    static std::string_view significant(record_key const& key, V value, char* buffer) noexcept {
+      return key.encode(value, buffer);
+    }
+
+
+    // Calls f(index) for records with key in the field until it returns
+    // false
+    template<typename K, typename F> void visit_equal(char const* field_name, K const& key, F&& f) const {
+      record_key const k = key_of(field_name);
+      if(!k)
+        return;
+      char buffer[8];
+      std::string_view const value = significant(k, key, buffer);
+      if(secondary const* const s = find_index(field_name, index_kind::hash)) {
+        bool more = true;
+        s->hash.for_each_match(record_key::hash(value), [&](index_type i) {
+          if(more && k.of(&record(i)) == value)
+            more = f(i);
+        });
+        return;
+      }
+      if(secondary const* const s = find_index(field_name, index_kind::ordered)) {
+        key_buffer normalized;
+        normalize(k, value, normalized);
+        for(btree_index::cursor c = s->tree.lower_bound(normalized.bytes);
+            c && std::memcmp(c.key(), normalized.bytes, k.normalized_size()) == 0; c.next())
+          if(!f(c.index()))
+            return;
+        return;
+      }
+      bool more = true;
+      for_each_index([&](index_type i) {
+        if(more && k.of(&record(i)) == value)
+          more = f(i);
+      });
+    }
+
+  }; // indexed_storage
+
+
+} // cellarium
@@ -0,0 +1,243 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <vector>
+
+#include "file.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  enum class journal_entry: std::uint32_t {
+    insert, update, remove
+  }; // journal_entry
+
+
+  // Write-ahead log of storage operations. Entries are buffered by append;
+  // commit writes everything buffered with one write and one data sync.
+  // Threads committing while a sync is in progress wait for it and the
+  // next sync covers all of them, so a batch costs one device flush
+  // however many committers it has. Every entry carries its sequence
+  // number and a checksum; replay stops at the first torn or damaged one
+  class journal {
+  public:
+
+    using path_type = std::filesystem::path;
+    using size_type = std::uint32_t;
+    using index_type = std::uint32_t;
+    using sequence_type = std::uint64_t;
+
+
+    struct entry_header {
+      sequence_type sequence;
+      journal_entry kind;
+      index_type index;
+      size_type size;
+      std::uint32_t checksum;
+    }; // entry_header
+
+
+    // Calls apply(kind, index, payload, size) for every intact entry in
+    // order. Missing journal means nothing to replay
+    template<typename F>
+    static bool replay(path_type const& path, F&& apply, std::error_code& ec) {
+      if(!std::filesystem::exists(path, ec))
+        return !ec;
+
+      std::vector<char> content;
+      {
+        auto f = file::open_to_read(path);
+        if(!f)
+          return (ec = file::last_error()), false;
+        auto const size = f.size();
+        if(size == file::invalid_size)
+          return (ec = file::last_error()), false;
+        try {
+          content.resize(std::size_t(size));
+        } catch(std::bad_alloc const&) {
+          return (ec = std::error_code{error::not_enough_memory}), false;
+        }
+        if(size != 0 && !f.read(content.data(), size))
+          return (ec = file::last_error()), false;
+      }
+
+      std::size_t offset = 0;
+      sequence_type expected = 0;
+      while(offset + sizeof(entry_header) <= content.size()) {
+        entry_header h;
+        std::memcpy(&h, content.data() + offset, sizeof(h));
+        char const* const payload = content.data() + offset + sizeof(h);
+        if(offset == 0)
+          expected = h.sequence;
+        if(h.size > content.size() - offset - sizeof(h) || h.sequence != expected
+           || h.checksum != checksum_of(h, payload))
+          break;
+        apply(h.kind, h.index, payload, h.size);
+        offset += sizeof(h) + h.size;
+        ++expected;
+      }
+
+      return true;
+    }
+
+
+    journal() noexcept = default;
+    journal(journal const&) = delete;
+    journal& operator = (journal const&) = delete;
+    explicit operator bool () const noexcept { return !!file_; }
+
+
+    // Bytes made durable since the last reset
+    std::uint64_t size() const noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return size_;
+    }
+
+
+    // Starts an empty journal, entries left by the previous run are
+    // dropped, so replay them first
+    bool open(path_type const& path, std::error_code& ec) noexcept {
+      close();
+      file_ = file::create(path);
+      if(!file_)
+        return (ec = file::last_error()), false;
+      return reset(ec);
+    }
+
+
+    void close() noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      file_.close();
+      buffer_.clear();
+      size_ = 0;
+      failure_.clear();
+    }
+
+
+    // Throws std::bad_alloc, nothing is appended then
+    sequence_type append(journal_entry kind, index_type index, void const* payload, size_type size) {
+      std::lock_guard<std::mutex> lock{mutex_};
+      entry_header h{sequence_, kind, index, size, 0};
+      h.checksum = checksum_of(h, static_cast<char const*>(payload));
+      std::size_t const needed = buffer_.size() + sizeof(h) + size;
+      if(needed > buffer_.capacity())
+        buffer_.reserve(needed > 2 * buffer_.capacity() ? needed : 2 * buffer_.capacity());
+      auto const* const bytes = reinterpret_cast<char const*>(&h);
+      buffer_.insert(buffer_.end(), bytes, bytes + sizeof(h));
+      buffer_.insert(buffer_.end(), static_cast<char const*>(payload), static_cast<char const*>(payload) + size);
+      return sequence_++;
+    }
+
+
+    // Makes every entry appended so far durable. Once a write or sync
+    // fails the journal refuses further commits until reset
+    bool commit(std::error_code& ec) noexcept {
+      std::unique_lock<std::mutex> lock{mutex_};
+      sequence_type const target = sequence_;
+      while(durable_ < target && !failure_) {
+        if(syncing_) {
+          synced_.wait(lock);
+          continue;
+        }
+        syncing_ = true;
+        batch_.swap(buffer_);
+        sequence_type const last = sequence_;
+        lock.unlock();
+
+        std::error_code written;
+        if(!file_.write(batch_.data(), file::size_type(batch_.size())) || !file_.sync_data())
+          written = file::last_error();
+
+        lock.lock();
+        syncing_ = false;
+        if(!written) {
+          durable_ = last;
+          size_ += batch_.size();
+        } else {
+          failure_ = written;
+        }
+        batch_.clear();
+        synced_.notify_all();
+      }
+      if(!!failure_)
+        return (ec = failure_), false;
+      return true;
+    }
+
+
+    // Drops every entry once the storage they describe is durable itself.
+    // Must not run concurrently with commit
+    bool reset(std::error_code& ec) noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      buffer_.clear();
+      durable_ = sequence_;
+      size_ = 0;
+      failure_.clear();
+      if(!file_.resize(0) || !file_.seek(0) || !file_.sync())
+        return (ec = file::last_error()), false;
+      return true;
+    }
+
+
+  private:
+
+    file file_;
+    mutable std::mutex mutex_;
+    std::condition_variable synced_;
+    std::vector<char> buffer_; // appended, not yet written
+    std::vector<char> batch_; // being written
+    sequence_type sequence_{0}; // of the next entry, never goes back
+    sequence_type durable_{0}; // entries before it are durable
+    std::uint64_t size_{0};
+    bool syncing_{false};
+    std::error_code failure_;
+
+
+    // FNV-1a over the header with zero checksum and the payload
+    static std::uint32_t checksum_of(entry_header h, char const* payload) noexcept {
+      h.checksum = 0;
+      std::uint32_t hash = 2166136261u;
+      auto const* const bytes = reinterpret_cast<unsigned char const*>(&h);
+      for(std::size_t i = 0; i != sizeof(h); ++i)
+        hash = (hash ^ bytes[i]) * 16777619u;
+      for(size_type i = 0; i != h.size; ++i)
+        hash = (hash ^ static_cast<unsigned char>(payload[i])) * 16777619u;
+      return hash;
+    }
+
+  }; // journal
+
+
+} // cellarium
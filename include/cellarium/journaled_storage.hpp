@@ -0,0 +1,233 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <new>
+#include <system_error>
+
+#include "storage.hpp"
+#include "journal.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  // Storage whose inserts, removes and updates are logged to a journal
+  // beside the file (path with ".journal" appended). Operations change the
+  // mapping at once and are durable after commit, which threads may call
+  // concurrently to share one sync. Open replays committed operations and
+  // rebuilds counters and free slots from the occupancy map, so the
+  // structure is consistent after a crash; records touched by operations
+  // that were not committed may hold either version. Growth is
+  // checkpointed before any record lands in the grown part, and a file
+  // left longer by an interrupted growth is cut back. Checkpoint writes the
+  // storage and empties the journal, commit does it once the journal
+  // exceeds checkpoint_size
+  template<typename T>
+  class journaled_storage {
+  public:
+
+    using storage_type = cellarium::storage<T>;
+    using path_type = typename storage_type::path_type;
+    using size_type = typename storage_type::size_type;
+    using index_type = typename storage_type::index_type;
+    using value_type = T;
+
+    static constexpr index_type no_index = storage_type::no_index;
+    static constexpr std::uint64_t default_checkpoint_size = std::uint64_t(64) << 20;
+
+
+    static path_type journal_path(path_type const& path) {
+      path_type result = path;
+      result += ".journal";
+      return result;
+    }
+
+
+    journaled_storage() noexcept = default;
+    ~journaled_storage() { close(); }
+    journaled_storage(journaled_storage const&) = delete;
+    journaled_storage& operator = (journaled_storage const&) = delete;
+    explicit operator bool () const noexcept { return !!storage_; }
+    cellarium::header const* header() const noexcept { return storage_.header(); }
+    // Not synchronized with writers
+    storage_type const& storage() const noexcept { return storage_; }
+    std::uint64_t checkpoint_size() const noexcept { return checkpoint_size_; }
+    void checkpoint_size(std::uint64_t bytes) noexcept { checkpoint_size_ = bytes; }
+    void growth_factor(size_type factor) noexcept { storage_.growth_factor(factor); }
+
+
+    size_type size() const noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return storage_.size();
+    }
+
+
+    bool create(path_type const& path, class header const& specified, std::error_code& ec) noexcept {
+      close();
+      storage_.durable(true);
+      if(!storage_.create(path, specified, ec))
+        return false;
+      if(!journal_.open(journal_path(path), ec))
+        return storage_.close(), false;
+      return true;
+    }
+
+
+    bool open(path_type const& path, class header const& specified, std::error_code& ec) noexcept {
+      close();
+      storage_.durable(true);
+      if(!storage_type::trim_unpublished_growth(path, ec) || !storage_.open(path, specified, ec))
+        return false;
+      if(!recover(journal_path(path), ec) || !journal_.open(journal_path(path), ec))
+        return storage_.close(), false;
+      return true;
+    }
+
+
+    // Commits and checkpoints, ignoring failures; call checkpoint first to
+    // see them
+    void close() noexcept {
+      if(!storage_)
+        return;
+      std::error_code ec;
+      checkpoint(ec);
+      journal_.close();
+      storage_.close();
+    }
+
+
+    // Throws std::bad_alloc, the storage is unchanged then
+    index_type try_insert(T const& data) {
+      std::lock_guard<std::mutex> lock{mutex_};
+      if(!make_room())
+        return no_index;
+      index_type const index = storage_.try_insert(data);
+      if(index == no_index)
+        return no_index;
+      try {
+        journal_.append(journal_entry::insert, index, &data, sizeof(T));
+      } catch(std::bad_alloc const&) {
+        storage_.remove(index);
+        throw;
+      }
+      return index;
+    }
+
+
+    // Throws std::bad_alloc, the storage is unchanged then
+    void remove(index_type index) {
+      std::lock_guard<std::mutex> lock{mutex_};
+      journal_.append(journal_entry::remove, index, nullptr, 0);
+      storage_.remove(index);
+    }
+
+
+    // Throws std::bad_alloc, the storage is unchanged then
+    void update(index_type index, T const& data) {
+      std::lock_guard<std::mutex> lock{mutex_};
+      journal_.append(journal_entry::update, index, &data, sizeof(T));
+      storage_.update(index, data);
+    }
+
+
+    T get(index_type index) const noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return storage_[index];
+    }
+
+
+    // Makes every operation done so far durable
+    bool commit(std::error_code& ec) noexcept {
+      if(!journal_.commit(ec))
+        return false;
+      if(journal_.size() < checkpoint_size_)
+        return true;
+      return checkpoint(ec);
+    }
+
+
+    bool checkpoint(std::error_code& ec) noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return journal_.commit(ec) && storage_.checkpoint(ec) && journal_.reset(ec);
+    }
+
+
+  private:
+
+    storage_type storage_;
+    journal journal_;
+    mutable std::mutex mutex_; // operations against checkpoint
+    std::uint64_t checkpoint_size_{default_checkpoint_size};
+
+
+    // Grows a full storage ahead of the insert and checkpoints it: the
+    // first new slot lies where the occupancy map was, so the header has
+    // to name the new capacity on disk before a record is written there
+    bool make_room() noexcept {
+      size_type const capacity = storage_.header()->capacity();
+      size_type const factor = storage_.growth_factor();
+      if(storage_.size() != capacity || factor < 2 || capacity > storage_type::max_capacity / factor)
+        return true;
+      std::error_code ec;
+      return storage_.grow(capacity * factor, ec) && storage_.checkpoint(ec);
+    }
+
+
+    bool recover(path_type const& path, std::error_code& ec) noexcept {
+      bool applied = true;
+      bool const replayed = journal::replay(path,
+        [&](journal_entry kind, index_type index, char const* payload, journal::size_type size) {
+          if(!applied)
+            return;
+          if(index >= storage_.header()->capacity()
+             && (!storage_.grow(index + 1, ec) || !storage_.checkpoint(ec))) {
+            applied = false;
+            return;
+          }
+          if(kind == journal_entry::remove) {
+            storage_.restore_free(index);
+            return;
+          }
+          if(size != sizeof(T)) {
+            ec = std::error_code{error::invalid_journal};
+            applied = false;
+            return;
+          }
+          T data;
+          std::memcpy(&data, payload, sizeof(T));
+          storage_.restore(index, data);
+        }, ec);
+      return replayed && applied && storage_.repair(ec) && storage_.checkpoint(ec);
+    }
+
+  }; // journaled_storage
+
+
+} // cellarium
@@ -0,0 +1,885 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <new>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include "file.hpp"
+#include "header.hpp"
+#include "occupancy_map.hpp"
+#include "simd.hpp"
+#include "parallel.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  namespace detail {
+
+    // First quote, backslash or control character in [first, last), the
+    // bytes that end a run of a JSON string on either side of the codec
+    inline char const* find_json_special(char const* first, char const* last) noexcept {
+      while(last - first >= 16) {
+        auto const group = reinterpret_cast<unsigned char const*>(first);
+        unsigned const mask = match_bytes(group, '"') | match_bytes(group, '\\') | match_below(group, 0x20);
+        if(mask != 0)
+          return first + count_trailing_zeros(mask);
+        first += 16;
+      }
+      while(first != last && *first != '"' && *first != '\\' && static_cast<unsigned char>(*first) >= 0x20)
+        ++first;
+      return first;
+    }
+
+
+    inline char* write_json_escape(char c, char* out) noexcept {
+      static char const hex[] = "0123456789abcdef";
+      *out++ = '\\';
+      switch(c) {
+        case '"':  *out++ = '"'; return out;
+        case '\\': *out++ = '\\'; return out;
+        case '\b': *out++ = 'b'; return out;
+        case '\f': *out++ = 'f'; return out;
+        case '\n': *out++ = 'n'; return out;
+        case '\r': *out++ = 'r'; return out;
+        case '\t': *out++ = 't'; return out;
+        default:
+          std::memcpy(out, "u00", 3);
+          out[3] = hex[static_cast<unsigned char>(c) >> 4];
+          out[4] = hex[c & 0xF];
+          return out + 5;
+      }
+    }
+
+
+    // At most six bytes per input byte
+    inline char* write_json_string(char const* first, char const* last, char* out) noexcept {
+      *out++ = '"';
+      for(;;) {
+        char const* const special = find_json_special(first, last);
+        std::memcpy(out, first, std::size_t(special - first));
+        out += special - first;
+        if(special == last)
+          break;
+        out = write_json_escape(*special, out);
+        first = special + 1;
+      }
+      *out++ = '"';
+      return out;
+    }
+
+
+    inline char* write_utf8(std::uint32_t code, char* out) noexcept {
+      if(code < 0x80) {
+        *out++ = char(code);
+      } else if(code < 0x800) {
+        *out++ = char(0xC0 | code >> 6);
+        *out++ = char(0x80 | (code & 0x3F));
+      } else if(code < 0x10000) {
+        *out++ = char(0xE0 | code >> 12);
+        *out++ = char(0x80 | (code >> 6 & 0x3F));
+        *out++ = char(0x80 | (code & 0x3F));
+      } else {
+        *out++ = char(0xF0 | code >> 18);
+        *out++ = char(0x80 | (code >> 12 & 0x3F));
+        *out++ = char(0x80 | (code >> 6 & 0x3F));
+        *out++ = char(0x80 | (code & 0x3F));
+      }
+      return out;
+    }
+
+
+    inline char16_t load_unit(char const* from, std::size_t n) noexcept {
+      char16_t unit;
+      std::memcpy(&unit, from + n * sizeof(char16_t), sizeof(char16_t));
+      return unit;
+    }
+
+
+    // Units up to the first zero one among count at from; unpaired
+    // surrogates become U+FFFD. At most six bytes per unit
+    inline char* write_json_utf16(char const* from, std::size_t count, char* out) noexcept {
+      *out++ = '"';
+      for(std::size_t i = 0; i != count; ++i) {
+        std::uint32_t code = load_unit(from, i);
+        if(code == 0)
+          break;
+        if(code < 0x80) {
+          char const c = char(code);
+          if(c == '"' || c == '\\' || code < 0x20)
+            out = write_json_escape(c, out);
+          else
+            *out++ = c;
+          continue;
+        }
+        if(code >= 0xD800 && code < 0xDC00 && i + 1 != count
+           && load_unit(from, i + 1) >= 0xDC00 && load_unit(from, i + 1) < 0xE000)
+          code = 0x10000 + ((code - 0xD800) << 10) + (load_unit(from, ++i) - 0xDC00);
+        else if(code >= 0xD800 && code < 0xE000)
+          code = 0xFFFD;
+        out = write_utf8(code, out);
+      }
+      *out++ = '"';
+      return out;
+    }
+
+
+    // Proleptic Gregorian calendar, days since 1970-01-01
+    constexpr std::int64_t days_from_civil(std::int64_t y, unsigned m, unsigned d) noexcept {
+      y -= m <= 2;
+      std::int64_t const era = (y >= 0 ? y : y - 399) / 400;
+      unsigned const yoe = unsigned(y - era * 400);
+      unsigned const doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+      unsigned const doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+      return era * 146097 + std::int64_t(doe) - 719468;
+    }
+
+
+    inline void civil_from_days(std::int64_t z, std::int64_t& y, unsigned& m, unsigned& d) noexcept {
+      z += 719468;
+      std::int64_t const era = (z >= 0 ? z : z - 146096) / 146097;
+      unsigned const doe = unsigned(z - era * 146097);
+      unsigned const yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+      unsigned const doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+      unsigned const mp = (5 * doy + 2) / 153;
+      d = doy - (153 * mp + 2) / 5 + 1;
+      m = mp < 10 ? mp + 3 : mp - 9;
+      y = std::int64_t(yoe) + era * 400 + (m <= 2);
+    }
+
+
+    inline char* write_digits(unsigned value, unsigned width, char* out) noexcept {
+      for(unsigned i = width; i-- != 0; value /= 10)
+        out[i] = char('0' + value % 10);
+      return out + width;
+    }
+
+
+    inline std::int64_t floor_divide(std::int64_t value, std::int64_t by) noexcept {
+      std::int64_t const q = value / by;
+      return q * by > value ? q - 1 : q;
+    }
+
+
+    // Ticks of unit per second since the epoch as "YYYY-MM-DDThh:mm:ss",
+    // with a fraction of 3, 6 or 9 digits below seconds and "Z" for UTC
+    inline char* write_json_time(std::int64_t ticks, std::int64_t unit, bool utc, char* out) noexcept {
+      std::int64_t const seconds = floor_divide(ticks, unit);
+      std::int64_t const fraction = ticks - seconds * unit;
+      std::int64_t const days = floor_divide(seconds, 86400);
+      unsigned const time = unsigned(seconds - days * 86400);
+      std::int64_t year; unsigned month, day;
+      civil_from_days(days, year, month, day);
+      *out++ = '"';
+      if(year >= 0 && year <= 9999)
+        out = write_digits(unsigned(year), 4, out);
+      else
+        out = std::to_chars(out, out + 24, year).ptr;
+      *out++ = '-'; out = write_digits(month, 2, out);
+      *out++ = '-'; out = write_digits(day, 2, out);
+      *out++ = 'T'; out = write_digits(time / 3600, 2, out);
+      *out++ = ':'; out = write_digits(time / 60 % 60, 2, out);
+      *out++ = ':'; out = write_digits(time % 60, 2, out);
+      if(unit != 1) {
+        *out++ = '.';
+        out = write_digits(unsigned(fraction), unit == 1000 ? 3 : unit == 1000000 ? 6 : 9, out);
+      }
+      if(utc)
+        *out++ = 'Z';
+      *out++ = '"';
+      return out;
+    }
+
+
+    inline bool parse_digits(char const*& p, char const* last, unsigned width, unsigned& value) noexcept {
+      if(last - p < std::ptrdiff_t(width))
+        return false;
+      value = 0;
+      for(unsigned i = 0; i != width; ++i, ++p) {
+        if(*p < '0' || *p > '9')
+          return false;
+        value = value * 10 + unsigned(*p - '0');
+      }
+      return true;
+    }
+
+
+    // Inverse of write_json_time; "Z" is optional, a space may separate
+    // date and time and fraction digits past the unit are dropped
+    inline bool parse_json_time(char const* p, char const* last, std::int64_t unit, std::int64_t& ticks) noexcept {
+      std::int64_t year;
+      auto const [year_end, year_ec] = std::from_chars(p, last, year);
+      if(year_ec != std::errc{} || year_end - p < 4)
+        return false;
+      p = year_end;
+      unsigned month, day, hours, minutes, seconds;
+      if(p == last || *p++ != '-' || !parse_digits(p, last, 2, month) || month < 1 || month > 12)
+        return false;
+      if(p == last || *p++ != '-' || !parse_digits(p, last, 2, day) || day < 1 || day > 31)
+        return false;
+      if(p == last || (*p != 'T' && *p != ' '))
+        return false;
+      ++p;
+      if(!parse_digits(p, last, 2, hours) || hours > 23)
+        return false;
+      if(p == last || *p++ != ':' || !parse_digits(p, last, 2, minutes) || minutes > 59)
+        return false;
+      if(p == last || *p++ != ':' || !parse_digits(p, last, 2, seconds) || seconds > 60)
+        return false;
+      std::int64_t fraction = 0;
+      if(p != last && *p == '.') {
+        ++p;
+        char const* const digits = p;
+        std::int64_t scale = unit;
+        for(; p != last && *p >= '0' && *p <= '9'; ++p)
+          if(scale > 1) {
+            scale /= 10;
+            fraction += (*p - '0') * scale;
+          }
+        if(p == digits)
+          return false;
+      }
+      if(p != last && *p == 'Z')
+        ++p;
+      if(p != last || year < -292277 || year > 292277)
+        return false;
+      std::int64_t const total = days_from_civil(year, month, day) * 86400 + hours * 3600 + minutes * 60 + seconds;
+      if(total > std::numeric_limits<std::int64_t>::max() / unit - 1
+         || total < std::numeric_limits<std::int64_t>::min() / unit + 1)
+        return false;
+      ticks = total * unit + fraction;
+      return true;
+    }
+
+
+    inline void skip_json_spaces(char const*& p, char const* last) noexcept {
+      while(p != last && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        ++p;
+    }
+
+
+    inline bool parse_hex4(char const*& p, char const* last, std::uint32_t& code) noexcept {
+      if(last - p < 4)
+        return false;
+      code = 0;
+      for(int i = 0; i != 4; ++i, ++p) {
+        char const c = *p;
+        unsigned digit;
+        if(c >= '0' && c <= '9') digit = unsigned(c - '0');
+        else if(c >= 'a' && c <= 'f') digit = unsigned(c - 'a' + 10);
+        else if(c >= 'A' && c <= 'F') digit = unsigned(c - 'A' + 10);
+        else return false;
+        code = code << 4 | digit;
+      }
+      return true;
+    }
+
+
+    // Decodes the string opening at p into UTF-8 bytes of out and leaves p
+    // past the closing quote. Throws std::bad_alloc
+    inline bool parse_json_string(char const*& p, char const* last, std::string& out) {
+      out.clear();
+      ++p;
+      for(;;) {
+        char const* const special = find_json_special(p, last);
+        out.append(p, std::size_t(special - p));
+        p = special;
+        if(p == last || *p != '\\') {
+          if(p == last || *p != '"')
+            return false;
+          ++p;
+          return true;
+        }
+        if(++p == last)
+          return false;
+        switch(*p++) {
+          case '"':  out.push_back('"'); break;
+          case '\\': out.push_back('\\'); break;
+          case '/':  out.push_back('/'); break;
+          case 'b':  out.push_back('\b'); break;
+          case 'f':  out.push_back('\f'); break;
+          case 'n':  out.push_back('\n'); break;
+          case 'r':  out.push_back('\r'); break;
+          case 't':  out.push_back('\t'); break;
+          case 'u': {
+            std::uint32_t code;
+            if(!parse_hex4(p, last, code))
+              return false;
+            if(code >= 0xD800 && code < 0xDC00 && last - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+              char const* low_at = p + 2;
+              std::uint32_t low;
+              if(parse_hex4(low_at, last, low) && low >= 0xDC00 && low < 0xE000) {
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                p = low_at;
+              }
+            }
+            if(code >= 0xD800 && code < 0xE000)
+              code = 0xFFFD;
+            char bytes[4];
+            out.append(bytes, std::size_t(write_utf8(code, bytes) - bytes));
+            break;
+          }
+          default:
+            return false;
+        }
+      }
+    }
+
+
+    // Skips a value of a key no field is named after. Throws std::bad_alloc
+    inline bool skip_json_value(char const*& p, char const* last, std::string& scratch) {
+      if(p == last)
+        return false;
+      if(*p == '"')
+        return parse_json_string(p, last, scratch);
+      if(*p == '{' || *p == '[') {
+        unsigned depth = 0;
+        do {
+          if(*p == '"') {
+            if(!parse_json_string(p, last, scratch))
+              return false;
+            continue;
+          }
+          if(*p == '{' || *p == '[')
+            ++depth;
+          else if(*p == '}' || *p == ']')
+            --depth;
+          ++p;
+        } while(depth != 0 && p != last);
+        return depth == 0;
+      }
+      char const* const first = p;
+      while(p != last && *p != ',' && *p != '}' && *p != ']'
+            && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        ++p;
+      return p != first;
+    }
+
+  } // detail
+
+
+  // Converts records to and from single-line JSON objects keyed by the
+  // field names of a header: numbers are written with std::to_chars,
+  // floats with fixed or scientific views in that notation, NaN and
+  // infinities as null; integers with time views are ISO 8601 strings,
+  // UTC ones with "Z"; arrays of numbers are JSON arrays and strings are
+  // unescaped UTF-8 or UTF-16. Keys no field is named after are skipped
+  // while reading, fields without a key keep what the record held
+  class json_format {
+  public:
+
+    using size_type = header::size_type;
+
+
+    // Throws std::bad_alloc
+    explicit json_format(header const& h) {
+      max_line_size_ = 3;
+      for(field const& each: h) {
+        column c;
+        c.name = each.name();
+        char prefix[6 * field::name_capacity + 3];
+        char* end = detail::write_json_string(c.name.data(), c.name.data() + c.name.size(), prefix);
+        *end++ = ':';
+        c.prefix.assign(prefix, end);
+        c.kind = each.kind();
+        c.count = each.capacity();
+        c.offset = each.offset();
+        c.view = each.view().kind();
+        c.precision = int(std::min(each.view().precision(), 64u));
+        c.unit = unit_of(c.view);
+        c.utc = c.view >= field_view_kind::utc_time_seconds && c.view <= field_view_kind::utc_time_nanoseconds;
+        if(c.kind == field_kind::utf8 || c.kind == field_kind::utf16) {
+          c.element_size = 6;
+          max_line_size_ += 2 + std::size_t(c.count) * 6;
+        } else {
+          bool const floating = c.kind == field_kind::f32 || c.kind == field_kind::f64;
+          c.element_size = !floating ? (c.unit != 0 ? 48 : 24)
+                           : c.view == field_view_kind::fixed ? 320 + std::size_t(c.precision) : 32;
+          max_line_size_ += c.count == 1 ? c.element_size : 2 + std::size_t(c.count) * (c.element_size + 1);
+        }
+        max_line_size_ += 1 + c.prefix.size();
+        columns_.push_back(std::move(c));
+      }
+    }
+
+
+    // Bytes write never exceeds for one record, line feed included
+    std::size_t max_line_size() const noexcept { return max_line_size_; }
+
+
+    // Writes record as one line and returns the end of it
+    char* write(char const* record, char* out) const noexcept {
+      *out++ = '{';
+      for(std::size_t i = 0; i != columns_.size(); ++i) {
+        column const& c = columns_[i];
+        if(i != 0)
+          *out++ = ',';
+        std::memcpy(out, c.prefix.data(), c.prefix.size());
+        out = write_value(c, record + c.offset, out + c.prefix.size());
+      }
+      *out++ = '}';
+      *out++ = '\n';
+      return out;
+    }
+
+
+    // Reads one object spanning [first, last) into record; trailing
+    // spaces are allowed. Throws std::bad_alloc
+    bool read(char const* first, char const* last, char* record) {
+      char const* p = first;
+      detail::skip_json_spaces(p, last);
+      if(p == last || *p++ != '{')
+        return false;
+      detail::skip_json_spaces(p, last);
+      if(p != last && *p == '}') {
+        ++p;
+      } else {
+        std::size_t expected = 0;
+        for(;;) {
+          if(p == last || *p != '"' || !detail::parse_json_string(p, last, scratch_))
+            return false;
+          detail::skip_json_spaces(p, last);
+          if(p == last || *p++ != ':')
+            return false;
+          detail::skip_json_spaces(p, last);
+          std::size_t const n = find_column(scratch_, expected);
+          if(n == columns_.size()) {
+            if(!detail::skip_json_value(p, last, scratch_))
+              return false;
+          } else {
+            if(!read_value(columns_[n], p, last, record + columns_[n].offset))
+              return false;
+            expected = n + 1;
+          }
+          detail::skip_json_spaces(p, last);
+          if(p == last)
+            return false;
+          if(*p == '}') {
+            ++p;
+            break;
+          }
+          if(*p++ != ',')
+            return false;
+          detail::skip_json_spaces(p, last);
+        }
+      }
+      detail::skip_json_spaces(p, last);
+      return p == last;
+    }
+
+
+  private:
+
+    struct column {
+      std::string name;
+      std::string prefix;
+      field_kind kind;
+      size_type count;
+      size_type offset;
+      field_view_kind view;
+      int precision;
+      std::int64_t unit;
+      bool utc;
+      std::size_t element_size;
+    }; // column
+
+    std::vector<column> columns_;
+    std::size_t max_line_size_{0};
+    std::string scratch_;
+
+
+    static std::int64_t unit_of(field_view_kind view) noexcept {
+      switch(view) {
+        case field_view_kind::utc_time_seconds:
+        case field_view_kind::local_time_seconds: return 1;
+        case field_view_kind::utc_time_milliseconds:
+        case field_view_kind::local_time_milliseconds: return 1000;
+        case field_view_kind::utc_time_microseconds:
+        case field_view_kind::local_time_microseconds: return 1000000;
+        case field_view_kind::utc_time_nanoseconds:
+        case field_view_kind::local_time_nanoseconds: return 1000000000;
+        default: return 0;
+      }
+    }
+
+
+    // Fields are usually met in catalog order, so the one after the
+    // previous match is tried first
+    std::size_t find_column(std::string const& key, std::size_t expected) const noexcept {
+      if(expected < columns_.size() && columns_[expected].name == key)
+        return expected;
+      for(std::size_t i = 0; i != columns_.size(); ++i)
+        if(columns_[i].name == key)
+          return i;
+      return columns_.size();
+    }
+
+
+    template<typename V> static char* write_number(column const& c, char const* from, char* out) noexcept {
+      V value;
+      std::memcpy(&value, from, sizeof(V));
+      char* const last = out + c.element_size;
+      if constexpr(std::is_floating_point_v<V>) {
+        if(!std::isfinite(value)) {
+          std::memcpy(out, "null", 4);
+          return out + 4;
+        }
+        if(c.view == field_view_kind::fixed)
+          return std::to_chars(out, last, value, std::chars_format::fixed, c.precision).ptr;
+        if(c.view == field_view_kind::scientific)
+          return std::to_chars(out, last, value, std::chars_format::scientific).ptr;
+        return std::to_chars(out, last, value).ptr;
+      } else {
+        if(c.unit != 0)
+          return detail::write_json_time(std::int64_t(value), c.unit, c.utc, out);
+        return std::to_chars(out, last, value).ptr;
+      }
+    }
+
+
+    template<typename V> static char* write_numbers(column const& c, char const* from, char* out) noexcept {
+      if(c.count == 1)
+        return write_number<V>(c, from, out);
+      *out++ = '[';
+      for(size_type i = 0; i != c.count; ++i) {
+        if(i != 0)
+          *out++ = ',';
+        out = write_number<V>(c, from + i * sizeof(V), out);
+      }
+      *out++ = ']';
+      return out;
+    }
+
+
+    static char* write_value(column const& c, char const* from, char* out) noexcept {
+      switch(c.kind) {
+        case field_kind::byte: return write_numbers<for_kind<field_kind::byte>::type>(c, from, out);
+        case field_kind::i16:  return write_numbers<for_kind<field_kind::i16>::type>(c, from, out);
+        case field_kind::u16:  return write_numbers<for_kind<field_kind::u16>::type>(c, from, out);
+        case field_kind::i32:  return write_numbers<for_kind<field_kind::i32>::type>(c, from, out);
+        case field_kind::u32:  return write_numbers<for_kind<field_kind::u32>::type>(c, from, out);
+        case field_kind::i64:  return write_numbers<for_kind<field_kind::i64>::type>(c, from, out);
+        case field_kind::u64:  return write_numbers<for_kind<field_kind::u64>::type>(c, from, out);
+        case field_kind::f32:  return write_numbers<for_kind<field_kind::f32>::type>(c, from, out);
+        case field_kind::f64:  return write_numbers<for_kind<field_kind::f64>::type>(c, from, out);
+        case field_kind::utf8: {
+          auto const length = std::find(from, from + c.count, '\0') - from;
+          return detail::write_json_string(from, from + length, out);
+        }
+        case field_kind::utf16: return detail::write_json_utf16(from, c.count, out);
+        default: return out;
+      }
+    }
+
+
+    template<typename V, typename W> static bool fits(W value) noexcept {
+      if constexpr(std::is_signed_v<W>) {
+        if(value < 0)
+          return std::is_signed_v<V> && value >= std::int64_t(std::numeric_limits<V>::min());
+        return std::uint64_t(value) <= std::uint64_t(std::numeric_limits<V>::max());
+      } else {
+        return value <= std::uint64_t(std::numeric_limits<V>::max());
+      }
+    }
+
+
+    // Integers written as 3.0 or 3e2 are taken as long as they are whole
+    // and exact in a double; values out of range of V are invalid
+    template<typename V> bool read_number(column const& c, char const*& p, char const* last, char* to) {
+      V value;
+      if constexpr(std::is_floating_point_v<V>) {
+        if(last - p >= 4 && std::memcmp(p, "null", 4) == 0) {
+          value = std::numeric_limits<V>::quiet_NaN();
+          p += 4;
+        } else {
+          auto const [end, ec] = std::from_chars(p, last, value);
+          if(ec != std::errc{})
+            return false;
+          p = end;
+        }
+      } else {
+        if(c.unit != 0 && p != last && *p == '"') {
+          std::int64_t ticks;
+          if(!detail::parse_json_string(p, last, scratch_)
+             || !detail::parse_json_time(scratch_.data(), scratch_.data() + scratch_.size(), c.unit, ticks)
+             || !fits<V>(ticks))
+            return false;
+          value = V(ticks);
+        } else if(std::is_same_v<V, unsigned char> && last - p >= 4 && std::memcmp(p, "true", 4) == 0) {
+          value = V(1);
+          p += 4;
+        } else if(std::is_same_v<V, unsigned char> && last - p >= 5 && std::memcmp(p, "false", 5) == 0) {
+          value = V(0);
+          p += 5;
+        } else {
+          std::conditional_t<std::is_signed_v<V>, std::int64_t, std::uint64_t> whole;
+          auto const [end, ec] = std::from_chars(p, last, whole);
+          if(ec == std::errc{} && (end == last || (*end != '.' && *end != 'e' && *end != 'E'))) {
+            if(!fits<V>(whole))
+              return false;
+            value = V(whole);
+            p = end;
+          } else {
+            double real;
+            auto const [real_end, real_ec] = std::from_chars(p, last, real);
+            if(real_ec != std::errc{} || real != std::trunc(real) || !(std::fabs(real) <= 9007199254740992.0)
+               || !fits<V>(std::int64_t(real)))
+              return false;
+            value = V(std::int64_t(real));
+            p = real_end;
+          }
+        }
+      }
+      std::memcpy(to, &value, sizeof(V));
+      return true;
+    }
+
+
+    // Elements missing from a shorter array are zeroed
+    template<typename V> bool read_numbers(column const& c, char const*& p, char const* last, char* to) {
+      if(c.count == 1)
+        return read_number<V>(c, p, last, to);
+      if(p == last || *p++ != '[')
+        return false;
+      size_type n = 0;
+      detail::skip_json_spaces(p, last);
+      if(p != last && *p == ']') {
+        ++p;
+      } else {
+        for(;;) {
+          if(n == c.count || !read_number<V>(c, p, last, to + n * sizeof(V)))
+            return false;
+          ++n;
+          detail::skip_json_spaces(p, last);
+          if(p == last)
+            return false;
+          if(*p++ == ']')
+            break;
+          if(p[-1] != ',')
+            return false;
+          detail::skip_json_spaces(p, last);
+        }
+      }
+      std::memset(to + n * sizeof(V), 0, (c.count - n) * sizeof(V));
+      return true;
+    }
+
+
+    // Cut at a character boundary to leave room for the terminating zero
+    void store_utf8(column const& c, char* to) const noexcept {
+      std::size_t n = std::min(scratch_.size(), std::size_t(c.count) - 1);
+      if(n != scratch_.size())
+        while(n != 0 && (static_cast<unsigned char>(scratch_[n]) & 0xC0) == 0x80)
+          --n;
+      std::memcpy(to, scratch_.data(), n);
+      std::memset(to + n, 0, c.count - n);
+    }
+
+
+    // Malformed UTF-8 sequences become U+FFFD
+    void store_utf16(column const& c, char* to) const noexcept {
+      auto const* p = reinterpret_cast<unsigned char const*>(scratch_.data());
+      auto const* const last = p + scratch_.size();
+      std::size_t n = 0;
+      while(p != last) {
+        std::uint32_t code = *p++;
+        if(code >= 0x80) {
+          std::ptrdiff_t const tail = code >= 0xF0 ? 3 : code >= 0xE0 ? 2 : code >= 0xC0 ? 1 : 0;
+          bool valid = tail != 0 && code < 0xF8 && last - p >= tail;
+          for(std::ptrdiff_t i = 0; valid && i != tail; ++i)
+            valid = (p[i] & 0xC0) == 0x80;
+          if(valid) {
+            code &= 0x3Fu >> tail;
+            for(std::ptrdiff_t i = 0; i != tail; ++i)
+              code = code << 6 | (p[i] & 0x3F);
+            p += tail;
+          } else {
+            code = 0xFFFD;
+          }
+        }
+        std::size_t const units = code >= 0x10000 ? 2 : 1;
+        if(n + units > std::size_t(c.count) - 1)
+          break;
+        char16_t unit[2];
+        if(units == 2) {
+          unit[0] = char16_t(0xD800 + ((code - 0x10000) >> 10));
+          unit[1] = char16_t(0xDC00 + ((code - 0x10000) & 0x3FF));
+        } else {
+          unit[0] = char16_t(code);
+        }
+        std::memcpy(to + n * sizeof(char16_t), unit, units * sizeof(char16_t));
+        n += units;
+      }
+      std::memset(to + n * sizeof(char16_t), 0, (c.count - n) * sizeof(char16_t));
+    }
+
+
+    bool read_value(column const& c, char const*& p, char const* last, char* to) {
+      switch(c.kind) {
+        case field_kind::byte: return read_numbers<for_kind<field_kind::byte>::type>(c, p, last, to);
+        case field_kind::i16:  return read_numbers<for_kind<field_kind::i16>::type>(c, p, last, to);
+        case field_kind::u16:  return read_numbers<for_kind<field_kind::u16>::type>(c, p, last, to);
+        case field_kind::i32:  return read_numbers<for_kind<field_kind::i32>::type>(c, p, last, to);
+        case field_kind::u32:  return read_numbers<for_kind<field_kind::u32>::type>(c, p, last, to);
+        case field_kind::i64:  return read_numbers<for_kind<field_kind::i64>::type>(c, p, last, to);
+        case field_kind::u64:  return read_numbers<for_kind<field_kind::u64>::type>(c, p, last, to);
+        case field_kind::f32:  return read_numbers<for_kind<field_kind::f32>::type>(c, p, last, to);
+        case field_kind::f64:  return read_numbers<for_kind<field_kind::f64>::type>(c, p, last, to);
+        case field_kind::utf8:
+          if(p == last || *p != '"' || !detail::parse_json_string(p, last, scratch_))
+            return false;
+          return store_utf8(c, to), true;
+        case field_kind::utf16:
+          if(p == last || *p != '"' || !detail::parse_json_string(p, last, scratch_))
+            return false;
+          return store_utf16(c, to), true;
+        default:
+          return detail::skip_json_value(p, last, scratch_);
+      }
+    }
+
+  }; // json_format
+
+
+  // Buffers are at least this large; a line longer than the import buffer
+  // doubles it
+  constexpr std::size_t json_chunk_size = std::size_t(1) << 20;
+
+
+  // Writes every live record of a storage, paged_storage or
+  // sharded_storage as JSON Lines, fields as cataloged in the header of
+  // its first page
+  template<typename S>
+  bool export_json(S const& source, std::filesystem::path const& path, std::error_code& ec) noexcept {
+    using value_type = typename S::value_type;
+    try {
+      json_format const format{*detail::page_of(source, 0).header()};
+      std::vector<char> buffer(std::max(json_chunk_size, 2 * format.max_line_size()));
+      auto f = file::create(path);
+      if(!f)
+        return (ec = file::last_error()), false;
+      char* const first = buffer.data();
+      char* const limit = first + buffer.size() - format.max_line_size();
+      char* out = first;
+      bool written = true;
+      source.for_each([&](value_type const& data) {
+        if(!written)
+          return;
+        out = format.write(reinterpret_cast<char const*>(&data), out);
+        if(out > limit) {
+          written = f.write(first, file::size_type(out - first));
+          out = first;
+        }
+      });
+      if(!written || !f.write(first, file::size_type(out - first)))
+        return (ec = file::last_error()), false;
+      return true;
+    } catch(std::bad_alloc const&) {
+      return (ec = std::error_code{error::not_enough_memory}), false;
+    }
+  }
+
+
+  // Inserts a record for every line of a JSON Lines file, starting each
+  // from defaults; blank lines are skipped. Fails with invalid_json_data
+  // on the first malformed line and with not_enough_memory when target
+  // cannot take more records, keeping the records inserted before
+  template<typename S>
+  bool import_json(S& target, std::filesystem::path const& path,
+                   typename S::value_type const& defaults, std::error_code& ec) noexcept {
+    using value_type = typename S::value_type;
+    try {
+      json_format format{*detail::page_of(target, 0).header()};
+      std::vector<char> buffer(json_chunk_size);
+      auto f = file::open_to_read(path);
+      if(!f)
+        return (ec = file::last_error()), false;
+      file::size_type remaining = f.size();
+      if(remaining == file::invalid_size)
+        return (ec = file::last_error()), false;
+
+      auto const insert = [&](char const* first, char const* last) {
+        char const* p = first;
+        detail::skip_json_spaces(p, last);
+        if(p == last)
+          return true;
+        value_type data = defaults;
+        if(!format.read(p, last, reinterpret_cast<char*>(&data)))
+          return (ec = std::error_code{error::invalid_json_data}), false;
+        if(target.try_insert(data) == S::no_index)
+          return (ec = std::error_code{error::not_enough_memory}), false;
+        return true;
+      };
+
+      std::size_t kept = 0;
+      for(;;) {
+        auto const n = std::min(file::size_type(buffer.size() - kept), remaining);
+        if(n != 0 && !f.read(buffer.data() + kept, n))
+          return (ec = file::last_error()), false;
+        remaining -= n;
+        char const* first = buffer.data();
+        char const* const last = first + kept + std::size_t(n);
+        // memchr is vectorized by the C library
+        for(;;) {
+          auto const* const eol = static_cast<char const*>(std::memchr(first, '\n', std::size_t(last - first)));
+          if(eol == nullptr)
+            break;
+          if(!insert(first, eol))
+            return false;
+          first = eol + 1;
+        }
+        if(remaining == 0)
+          return insert(first, last);
+        kept = std::size_t(last - first);
+        std::memmove(buffer.data(), first, kept);
+        if(kept == buffer.size())
+          buffer.resize(buffer.size() * 2);
+      }
+    } catch(std::bad_alloc const&) {
+      return (ec = std::error_code{error::not_enough_memory}), false;
+    }
+  }
+
+
+  template<typename S>
+  bool import_json(S& target, std::filesystem::path const& path, std::error_code& ec) noexcept {
+    return import_json(target, path, typename S::value_type{}, ec);
+  }
+
+
+} // cellarium
@@ -0,0 +1,211 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+#include "field.hpp"
+
+
+namespace cellarium {
+
+
+  // Field of a record used as a key. Keys are viewed as their significant
+  // bytes: the whole field, or the characters before the terminating zero
+  // of a string field
+  class record_key {
+  public:
+
+    using size_type = field::size_type;
+
+
+    record_key() noexcept = default;
+
+
+    explicit record_key(field const& f) noexcept:
+      kind_{f.kind()}, offset_{f.offset()}, size_{f.size_of()}
+    { }
+
+
+    explicit operator bool () const noexcept { return size_ != 0; }
+    field_kind kind() const noexcept { return kind_; }
+    size_type offset() const noexcept { return offset_; }
+    size_type size() const noexcept { return size_; }
+
+
+    std::string_view of(void const* record) const noexcept {
+      char const* const bytes = static_cast<char const*>(record) + offset_;
+      switch(kind_) {
+        case field_kind::utf8: {
+          auto const* const zero = static_cast<char const*>(std::memchr(bytes, 0, size_));
+          return std::string_view{bytes, zero != nullptr ? std::size_t(zero - bytes) : size_};
+        }
+        case field_kind::utf16: {
+          size_type n = 0;
+          for(; n + 1 < size_ && (bytes[n] != 0 || bytes[n + 1] != 0); n += 2);
+          return std::string_view{bytes, n};
+        }
+        default:
+          return std::string_view{bytes, size_};
+      }
+    }
+
+
+    // Arithmetic value converted to the field kind, written to out of at
+    // least 8 bytes; empty for fields of other kinds
+    template<typename V> std::string_view encode(V value, char* out) const noexcept {
+      static_assert(std::is_arithmetic_v<V>, "Only arithmetic keys can be converted");
+      switch(kind_) {
+        case field_kind::byte: return put(static_cast<for_kind<field_kind::byte>::type>(value), out);
+        case field_kind::i16:  return put(static_cast<for_kind<field_kind::i16>::type>(value), out);
+        case field_kind::u16:  return put(static_cast<for_kind<field_kind::u16>::type>(value), out);
+        case field_kind::i32:  return put(static_cast<for_kind<field_kind::i32>::type>(value), out);
+        case field_kind::u32:  return put(static_cast<for_kind<field_kind::u32>::type>(value), out);
+        case field_kind::i64:  return put(static_cast<for_kind<field_kind::i64>::type>(value), out);
+        case field_kind::u64:  return put(static_cast<for_kind<field_kind::u64>::type>(value), out);
+        case field_kind::f32:  return put(static_cast<for_kind<field_kind::f32>::type>(value), out);
+        case field_kind::f64:  return put(static_cast<for_kind<field_kind::f64>::type>(value), out);
+        default:               return std::string_view{};
+      }
+    }
+
+
+    // Keys ordered by normalize: scalar numbers, strings of utf8 and bytes
+    bool orderable() const noexcept {
+      return scalar_number() || kind_ == field_kind::utf8 || kind_ == field_kind::byte;
+    }
+
+
+    // Width of normalized keys: eight bytes for scalar numbers, the field
+    // size otherwise
+    size_type normalized_size() const noexcept {
+      return scalar_number() ? 8 : size_;
+    }
+
+
+    // Writes normalized_size bytes which compare with memcmp in the order
+    // of key values: numbers are mapped to unsigned integers of the same
+    // order and stored big-endian, other keys are padded with zeros
+    void normalize(std::string_view key, unsigned char* out) const noexcept {
+      if(!scalar_number()) {
+        std::size_t const n = key.size() < size_ ? key.size() : size_;
+        std::memcpy(out, key.data(), n);
+        std::memset(out + n, 0, size_ - n);
+        return;
+      }
+      std::uint64_t bits = 0;
+      switch(kind_) {
+        case field_kind::byte: bits = ordered<for_kind<field_kind::byte>::type>(key); break;
+        case field_kind::i16:  bits = ordered<for_kind<field_kind::i16>::type>(key); break;
+        case field_kind::u16:  bits = ordered<for_kind<field_kind::u16>::type>(key); break;
+        case field_kind::i32:  bits = ordered<for_kind<field_kind::i32>::type>(key); break;
+        case field_kind::u32:  bits = ordered<for_kind<field_kind::u32>::type>(key); break;
+        case field_kind::i64:  bits = ordered<for_kind<field_kind::i64>::type>(key); break;
+        case field_kind::u64:  bits = ordered<for_kind<field_kind::u64>::type>(key); break;
+        case field_kind::f32:  bits = ordered<for_kind<field_kind::f32>::type>(key); break;
+        case field_kind::f64:  bits = ordered<for_kind<field_kind::f64>::type>(key); break;
+        default: break;
+      }
+      for(int i = 7; i >= 0; --i, bits >>= 8)
+        out[i] = static_cast<unsigned char>(bits);
+    }
+
+
+    // 64-bit mix of eight bytes at a time, finished as in MurmurHash3
+    static std::uint64_t hash(std::string_view key) noexcept {
+      std::uint64_t h = 0x9E3779B97F4A7C15ull ^ key.size();
+      std::size_t i = 0;
+      for(; i + 8 <= key.size(); i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, key.data() + i, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+      }
+      if(i != key.size()) {
+        std::uint64_t word = 0;
+        std::memcpy(&word, key.data() + i, key.size() - i);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+      }
+      h ^= h >> 33;
+      h *= 0xC4CEB9FE1A85EC53ull;
+      h ^= h >> 33;
+      return h;
+    }
+
+
+  private:
+
+    field_kind kind_{field_kind::undefined};
+    size_type offset_{0};
+    size_type size_{0};
+
+
+    bool scalar_number() const noexcept {
+      switch(kind_) {
+        case field_kind::byte: return size_ == sizeof(for_kind<field_kind::byte>::type);
+        case field_kind::i16:
+        case field_kind::u16:  return size_ == 2;
+        case field_kind::i32:
+        case field_kind::u32:
+        case field_kind::f32:  return size_ == 4;
+        case field_kind::i64:
+        case field_kind::u64:
+        case field_kind::f64:  return size_ == 8;
+        default:               return false;
+      }
+    }
+
+
+    // Signed integers are offset by the sign bit, negative floats have
+    // every bit flipped and positive ones the sign bit set
+    template<typename V> static std::uint64_t ordered(std::string_view key) noexcept {
+      V value{};
+      std::memcpy(&value, key.data(), key.size() < sizeof(V) ? key.size() : sizeof(V));
+      if constexpr(std::is_floating_point_v<V>) {
+        using bits_type = std::conditional_t<sizeof(V) == 4, std::uint32_t, std::uint64_t>;
+        bits_type bits;
+        std::memcpy(&bits, &value, sizeof(V));
+        bits_type const sign = bits_type(1) << (sizeof(V) * 8 - 1);
+        return (bits & sign) != 0 ? bits_type(~bits) : bits_type(bits | sign);
+      } else if constexpr(std::is_signed_v<V>) {
+        return std::uint64_t(std::int64_t(value)) ^ (std::uint64_t(1) << 63);
+      } else {
+        return std::uint64_t(value);
+      }
+    }
+
+
+    template<typename V> std::string_view put(V value, char* out) const noexcept {
+      std::memcpy(out, &value, sizeof(V));
+      return std::string_view{out, sizeof(V) < size_ ? sizeof(V) : size_};
+    }
+
+  }; // record_key
+
+
+} // cellarium
@@ -47,8 +47,9 @@
 #include <handleapi.h>
 
 #else
-  
-#error Unsupported system
+
+#include <sys/mman.h>
+#include <unistd.h>
 
 #endif // WIN32
 
@@ -62,11 +63,17 @@ public:
   using offset_type = long long;
 
 
+  enum class access_pattern {
+    normal, sequential, random, will_need, dont_need
+  }; // access_pattern
+
+
   struct region {
     friend class mapped_file;
 
     char* address{nullptr};
     size_type size{0};
+    size_type reserved{0}; // address space kept for growth in place, 0 if none
 
     region() noexcept = default;
     ~region() noexcept { if(!!address) dispose(); }
@@ -80,7 +87,7 @@ public:
     
     
     region(region&& other) noexcept:
-      address(other.address), size(other.size) {
+      address(other.address), size(other.size), reserved(other.reserved) {
       other.address = nullptr;
     }
 
@@ -90,10 +97,49 @@ public:
         dispose();
       address = other.address; other.address = nullptr;
       size = other.size;
+      reserved = other.reserved;
       return *this;
     }
 
 
+    bool advise(access_pattern pattern) const noexcept {
+      return advise(0, size, pattern);
+    }
+
+
+#ifdef _WIN32
+
+    bool advise(offset_type, size_type, access_pattern) const noexcept {
+      return true;
+    }
+
+
+    // Writes modified pages of the range to the file
+    bool flush(offset_type offset, size_type length) const noexcept {
+      return FlushViewOfFile(address + offset, static_cast<SIZE_T>(length)) != 0;
+    }
+
+#else
+
+    // Hints are page granular: the range is widened to whole pages
+    bool advise(offset_type offset, size_type length, access_pattern pattern) const noexcept {
+      if(address == nullptr || length <= 0)
+        return false;
+      offset_type const first = offset - offset % granularity();
+      return ::madvise(address + first, static_cast<std::size_t>(offset + length - first),
+                       to_advice(pattern)) == 0;
+    }
+
+
+    // Writes modified pages of the range to the file and waits for them
+    bool flush(offset_type offset, size_type length) const noexcept {
+      offset_type const first = offset - offset % granularity();
+      return ::msync(address + first, static_cast<std::size_t>(offset + length - first), MS_SYNC) == 0;
+    }
+
+#endif // _WIN32
+
+
   private:
     
     region(char* address, size_type size) noexcept:
@@ -101,9 +147,31 @@ public:
     { }
 
 #ifdef _WIN32
+
     void dispose() noexcept { UnmapViewOfFile(address); }
+
 #else
-    void dispose() noexcept { munmap(address, size); }
+
+    void dispose() noexcept {
+      ::munmap(address, static_cast<std::size_t>(reserved > size ? reserved : size));
+    }
+
+
+    static int to_advice(access_pattern pattern) noexcept {
+      switch(pattern) {
+        case access_pattern::sequential:
+          return MADV_SEQUENTIAL;
+        case access_pattern::random:
+          return MADV_RANDOM;
+        case access_pattern::will_need:
+          return MADV_WILLNEED;
+        case access_pattern::dont_need:
+          return MADV_DONTNEED;
+        default:
+          return MADV_NORMAL;
+      }
+    }
+
 #endif // _WIN32
   }; // region
 
@@ -112,6 +180,12 @@ public:
     return mapped_file{file::open_to_rw(path)};
   }
 
+
+  // Regions of it are mapped read-only, stores through them fault
+  static mapped_file open_to_read(std::filesystem::path const& path) noexcept {
+    return mapped_file{file::open_to_read(path), false};
+  }
+
   
   static std::error_code last_error() noexcept {
     return file::last_error();
@@ -136,6 +210,48 @@ public:
   }
 
 
+#ifdef _WIN32
+
+  // Reservations are not supported, the whole file is mapped as by map()
+  region map_reserved(size_type) noexcept {
+    return map();
+  }
+
+#else
+
+  // Reserves reservation bytes of address space and maps the whole file at
+  // its start; grow() then maps the file further in place, so the address
+  // never changes while the file fits the reservation
+  region map_reserved(size_type reservation) noexcept {
+    auto const size = file_.size();
+    if(size == file::invalid_size)
+      return region{};
+    if(reservation < size)
+      reservation = size;
+    void* const base = ::mmap(nullptr, static_cast<std::size_t>(reservation), PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED)
+      return region{};
+    region r{reinterpret_cast<char*>(base), size};
+    r.reserved = reservation;
+    if(size != 0 && !mmap_fixed(r.address, 0, size))
+      return region{};
+    return r;
+  }
+
+#endif // _WIN32
+
+
+  size_type size() const noexcept {
+    return file_.size();
+  }
+
+
+  bool sync() noexcept {
+    return file_.sync();
+  }
+
+
 #ifdef _WIN32
 
   explicit operator bool() const noexcept {
@@ -145,6 +261,34 @@ public:
   static size_type granularity() {
     return 65536;
   }
+
+
+  // Views have to be unmapped before the file changes size
+  static constexpr bool resizable_while_mapped = false;
+
+
+  // All regions have to be unmapped before
+  bool resize(size_type new_size) noexcept {
+    if(mapping_ != INVALID_HANDLE_VALUE)
+      CloseHandle(mapping_);
+    mapping_ = INVALID_HANDLE_VALUE;
+    if(!file_.resize(new_size))
+      return false;
+    mapping_ = CreateFileMappingW(file_.handle_, nullptr, PAGE_READWRITE,
+                                  0, 0, nullptr);
+    return mapping_ != nullptr;
+  }
+
+
+  // Extends the file and maps the whole-file region r again; views keep
+  // the file mapping alive, so r is unmapped before the resize
+  bool grow(region& r, size_type new_size) noexcept {
+    r = region{};
+    if(!resize(new_size))
+      return false;
+    r = map();
+    return r.address != nullptr;
+  }
   
 #else
   
@@ -153,7 +297,64 @@ public:
   }
 
   static size_type granularity() {
-    return 65536;
+    static size_type const page_size = static_cast<size_type>(::sysconf(_SC_PAGESIZE));
+    return page_size;
+  }
+
+
+  // Regions stay mapped while the file changes size; pages wholly past
+  // its end fault when touched
+  static constexpr bool resizable_while_mapped = true;
+
+
+  // Regions past the new end of file have to be unmapped before
+  bool resize(size_type new_size) noexcept {
+    return file_.resize(new_size);
+  }
+
+
+  // Extends the file and the whole-file region r over it. On Linux the
+  // mapping is extended in place or moved by the kernel without copying
+  // pages; elsewhere r is mapped again. Regions from map_reserved grow in
+  // place and fail with ENOMEM past their reservation. r may change its
+  // address; it stays as it was when the file can not be extended and is
+  // left unmapped when remapping fails
+  bool grow(region& r, size_type new_size) noexcept {
+    if(r.reserved != 0) {
+      if(new_size > r.reserved) {
+        errno = ENOMEM;
+        return false;
+      }
+      if(!file_.resize(new_size))
+        return false;
+      // Pages past the old end are mapped into the reservation, the
+      // partial last page is mapped again as a whole
+      offset_type const first = r.size - r.size % granularity();
+      if(!mmap_fixed(r.address + first, first, new_size - first)) {
+        r = region{};
+        return false;
+      }
+      r.size = new_size;
+      return true;
+    }
+    if(!file_.resize(new_size))
+      return false;
+#ifdef __linux__
+    if(r.address != nullptr) {
+      void* const address = ::mremap(r.address, static_cast<std::size_t>(r.size),
+                                     static_cast<std::size_t>(new_size), MREMAP_MAYMOVE);
+      if(address == MAP_FAILED) {
+        r = region{};
+        return false;
+      }
+      r.address = reinterpret_cast<char*>(address);
+      r.size = new_size;
+      return true;
+    }
+#endif // __linux__
+    r = region{};
+    r = map();
+    return r.address != nullptr;
   }
 
 #endif // _WIN32
@@ -161,38 +362,52 @@ public:
 private:
 
   cellarium::file file_;
+  bool writable_{true};
   
 #ifdef _WIN32
   
   HANDLE mapping_{INVALID_HANDLE_VALUE};
 
-  explicit mapped_file(cellarium::file&& f) noexcept:
-    file_{std::move(f)} {
-    mapping_ = CreateFileMappingW(file_.handle_, nullptr, PAGE_READWRITE,
+  explicit mapped_file(cellarium::file&& f, bool writable = true) noexcept:
+    file_{std::move(f)}, writable_{writable} {
+    mapping_ = CreateFileMappingW(file_.handle_, nullptr, writable_ ? PAGE_READWRITE : PAGE_READONLY,
                                   0, 0, nullptr);
   }
   
   
   char* mmap(offset_type offset, size_type size) noexcept {
     return reinterpret_cast<char*>(
-            MapViewOfFile(mapping_, FILE_MAP_READ | FILE_MAP_WRITE,
+            MapViewOfFile(mapping_, writable_ ? FILE_MAP_READ | FILE_MAP_WRITE : FILE_MAP_READ,
                           DWORD(offset >> 32), DWORD(offset), size));
   }
 
     
 #else
 
-  explicit mapped_file(cellarium::file&& f) noexcept:
-    file_{std::move(f)} {
+  explicit mapped_file(cellarium::file&& f, bool writable = true) noexcept:
+    file_{std::move(f)}, writable_{writable} {
+  }
+  
+  
+  int protection() const noexcept {
+    return writable_ ? PROT_READ | PROT_WRITE : PROT_READ;
   }
   
   
+  // Shared mapping: stores through the region land in the page cache of
+  // the file itself, exactly like a Windows file view
   char* mmap(offset_type offset, size_type size) noexcept {
-    char* address = mmap(nullptr, size, PROT_READ|PROT_WRITE,
-                         MAP_PRIVATE|MAP_NORESERVE, file_.handle_, offset);
+    void* const address = ::mmap(nullptr, static_cast<std::size_t>(size), protection(),
+                                 MAP_SHARED, file_.handle_, static_cast<off_t>(offset));
     if(address == MAP_FAILED)
       return nullptr;
-    return address;
+    return reinterpret_cast<char*>(address);
+  }
+
+
+  bool mmap_fixed(char* address, offset_type offset, size_type size) noexcept {
+    return ::mmap(address, static_cast<std::size_t>(size), protection(),
+                  MAP_SHARED | MAP_FIXED, file_.handle_, static_cast<off_t>(offset)) != MAP_FAILED;
   }
 
  
@@ -0,0 +1,388 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <system_error>
+#include <type_traits>
+
+#include "file.hpp"
+#include "mapped_file.hpp"
+#include "header.hpp"
+#include "occupancy_map.hpp"
+#include "storage.hpp"
+#include "thread_pool.hpp"
+#include "parallel.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  namespace detail {
+
+    template<typename V> V load(char const* from) noexcept {
+      V value;
+      std::memcpy(&value, from, sizeof(V));
+      return value;
+    }
+
+
+    // Integers saturate at the bounds of To, floats are truncated towards
+    // zero when stored to integers and NaN becomes zero
+    template<typename To, typename From> To narrow(From value) noexcept {
+      if constexpr(std::is_floating_point_v<To>) {
+        return static_cast<To>(value);
+      } else if constexpr(std::is_floating_point_v<From>) {
+        if(value != value)
+          return To(0);
+        if(value <= From(std::numeric_limits<To>::min()))
+          return std::numeric_limits<To>::min();
+        if(value >= From(std::numeric_limits<To>::max()))
+          return std::numeric_limits<To>::max();
+        return static_cast<To>(value);
+      } else if constexpr(std::is_signed_v<From>) {
+        if constexpr(std::is_signed_v<To>) {
+          if(value < std::int64_t(std::numeric_limits<To>::min()))
+            return std::numeric_limits<To>::min();
+          if(value > std::int64_t(std::numeric_limits<To>::max()))
+            return std::numeric_limits<To>::max();
+        } else {
+          if(value < 0)
+            return To(0);
+          if(std::uint64_t(value) > std::uint64_t(std::numeric_limits<To>::max()))
+            return std::numeric_limits<To>::max();
+        }
+        return static_cast<To>(value);
+      } else {
+        if(value > std::uint64_t(std::numeric_limits<To>::max()))
+          return std::numeric_limits<To>::max();
+        return static_cast<To>(value);
+      }
+    }
+
+
+    template<typename From> void convert_number(char const* from, field_kind to_kind, char* to) noexcept {
+      using wide = std::conditional_t<std::is_floating_point_v<From>, double,
+                   std::conditional_t<std::is_signed_v<From>, std::int64_t, std::uint64_t>>;
+      wide const value = wide(load<From>(from));
+      auto const store = [&](auto converted) { std::memcpy(to, &converted, sizeof(converted)); };
+      switch(to_kind) {
+        case field_kind::byte: return store(narrow<for_kind<field_kind::byte>::type>(value));
+        case field_kind::i16:  return store(narrow<for_kind<field_kind::i16>::type>(value));
+        case field_kind::u16:  return store(narrow<for_kind<field_kind::u16>::type>(value));
+        case field_kind::i32:  return store(narrow<for_kind<field_kind::i32>::type>(value));
+        case field_kind::u32:  return store(narrow<for_kind<field_kind::u32>::type>(value));
+        case field_kind::i64:  return store(narrow<for_kind<field_kind::i64>::type>(value));
+        case field_kind::u64:  return store(narrow<for_kind<field_kind::u64>::type>(value));
+        case field_kind::f32:  return store(narrow<for_kind<field_kind::f32>::type>(value));
+        case field_kind::f64:  return store(narrow<for_kind<field_kind::f64>::type>(value));
+        default: return;
+      }
+    }
+
+
+    inline bool is_number(field_kind kind) noexcept {
+      return kind >= field_kind::byte && kind <= field_kind::f64;
+    }
+
+  } // detail
+
+
+  // Converts records between two layouts described by header field
+  // catalogs. Fields are matched by name: numbers convert to any number
+  // kind element by element, widening exactly and narrowing with
+  // saturation; strings are cut to the new capacity at a character
+  // boundary. Fields only in the new layout, array elements past the old
+  // capacity and bytes outside fields keep what the target record held
+  class record_converter {
+  public:
+
+    using size_type = header::size_type;
+
+
+    record_converter() noexcept = default;
+    size_type steps_count() const noexcept { return steps_count_; }
+
+
+    // Fails with incompatible_fields when fields of the same name are a
+    // number and a string or strings of different encodings
+    bool build(header const& from, header const& to, std::error_code& ec) noexcept {
+      steps_count_ = 0;
+      for(field const& target: to) {
+        field const* const source = from.find_field(target.name());
+        if(source == nullptr)
+          continue;
+        bool const numbers = detail::is_number(source->kind()) && detail::is_number(target.kind());
+        if(!numbers && source->kind() != target.kind())
+          return (ec = std::error_code{error::incompatible_fields}), false;
+        steps_[steps_count_++] = step{source->kind(), target.kind(), source->offset(), target.offset(),
+                                      source->size_of() / source->capacity(),
+                                      target.size_of() / target.capacity(),
+                                      source->capacity(), target.capacity()};
+      }
+      return true;
+    }
+
+
+    void convert(char const* from, char* to) const noexcept {
+      for(size_type i = 0; i != steps_count_; ++i) {
+        step const& s = steps_[i];
+        char const* const source = from + s.from_offset;
+        char* const target = to + s.to_offset;
+        switch(s.from_kind) {
+          case field_kind::utf8:
+            copy_string<char>(source, s.from_capacity, target, s.to_capacity);
+            continue;
+          case field_kind::utf16:
+            copy_string<char16_t>(source, s.from_capacity, target, s.to_capacity);
+            continue;
+          default:
+            break;
+        }
+        size_type const count = s.from_capacity < s.to_capacity ? s.from_capacity : s.to_capacity;
+        if(s.from_kind == s.to_kind) {
+          std::memcpy(target, source, std::size_t(count) * s.to_element);
+          continue;
+        }
+        for(size_type n = 0; n != count; ++n)
+          convert_element(s.from_kind, source + n * s.from_element, s.to_kind, target + n * s.to_element);
+      }
+    }
+
+
+  private:
+
+    struct step {
+      field_kind from_kind;
+      field_kind to_kind;
+      size_type from_offset;
+      size_type to_offset;
+      size_type from_element;
+      size_type to_element;
+      size_type from_capacity;
+      size_type to_capacity;
+    }; // step
+
+    step steps_[header::fields_capacity];
+    size_type steps_count_{0};
+
+
+    static void convert_element(field_kind from_kind, char const* from, field_kind to_kind, char* to) noexcept {
+      switch(from_kind) {
+        case field_kind::byte: return detail::convert_number<for_kind<field_kind::byte>::type>(from, to_kind, to);
+        case field_kind::i16:  return detail::convert_number<for_kind<field_kind::i16>::type>(from, to_kind, to);
+        case field_kind::u16:  return detail::convert_number<for_kind<field_kind::u16>::type>(from, to_kind, to);
+        case field_kind::i32:  return detail::convert_number<for_kind<field_kind::i32>::type>(from, to_kind, to);
+        case field_kind::u32:  return detail::convert_number<for_kind<field_kind::u32>::type>(from, to_kind, to);
+        case field_kind::i64:  return detail::convert_number<for_kind<field_kind::i64>::type>(from, to_kind, to);
+        case field_kind::u64:  return detail::convert_number<for_kind<field_kind::u64>::type>(from, to_kind, to);
+        case field_kind::f32:  return detail::convert_number<for_kind<field_kind::f32>::type>(from, to_kind, to);
+        case field_kind::f64:  return detail::convert_number<for_kind<field_kind::f64>::type>(from, to_kind, to);
+        default: return;
+      }
+    }
+
+
+    // Copies characters before the terminator, at most capacity - 1 of
+    // them without splitting a UTF-8 sequence or a UTF-16 surrogate pair,
+    // and zeroes the rest of the field
+    template<typename C>
+    static void copy_string(char const* from, size_type from_capacity, char* to, size_type to_capacity) noexcept {
+      size_type length = 0;
+      for(; length != from_capacity && detail::load<C>(from + length * sizeof(C)) != 0; ++length);
+      size_type n = length < to_capacity - 1 ? length : to_capacity - 1;
+      if(n != length) {
+        if constexpr(sizeof(C) == 1) {
+          while(n != 0 && (static_cast<unsigned char>(from[n]) & 0xC0) == 0x80)
+            --n;
+        } else {
+          C const next = detail::load<C>(from + n * sizeof(C));
+          if(n != 0 && next >= 0xDC00 && next <= 0xDFFF)
+            --n;
+        }
+      }
+      std::memcpy(to, from, std::size_t(n) * sizeof(C));
+      std::memset(to + n * sizeof(C), 0, std::size_t(to_capacity - n) * sizeof(C));
+    }
+
+  }; // record_converter
+
+
+  // Placement of records in a storage file of any record type, derived
+  // from its header and file size: records are data_size bytes rounded
+  // up to the alignment of the record type, which is tried from the
+  // largest field alignment up
+  struct record_layout {
+
+    std::size_t record_size;
+    std::size_t records_offset;
+    std::size_t occupancy_offset;
+
+
+    static bool of(header const& h, std::uintmax_t file_size, record_layout& layout) noexcept {
+      std::size_t alignment = 4;
+      for(field const& each: h)
+        if(each.align_of() > alignment)
+          alignment = each.align_of();
+      std::size_t const data_size = h.data_size() > 4 ? h.data_size() : 4;
+      for(; alignment <= 64; alignment *= 2) {
+        std::size_t const record_size = (data_size + alignment - 1) / alignment * alignment;
+        std::size_t const records_end = cellarium::records_offset + std::size_t(h.capacity()) * record_size;
+        std::size_t const occupancy_offset = (records_end + 63) & ~std::size_t(63);
+        if(occupancy_offset + occupancy_map::size_of(h.capacity()) == file_size) {
+          layout = record_layout{record_size, cellarium::records_offset, occupancy_offset};
+          return true;
+        }
+      }
+      return false;
+    }
+
+  }; // record_layout
+
+
+  namespace detail {
+
+    template<typename T>
+    bool migrate(std::filesystem::path const& path, header const& specified, T const& defaults,
+                 thread_pool* pool, std::error_code& ec) noexcept {
+
+      if(!specified)
+        return (ec = std::error_code{error::invalid_specified_header}), false;
+
+      header actual;
+      {
+        auto f = file::open_to_read(path);
+        if(!f)
+          return (ec = file::last_error()), false;
+        if(!f.read(actual))
+          return (ec = file::last_error()), false;
+      }
+      if(!actual.has_valid_signature())
+        return (ec = std::error_code{error::not_a_storage_file}), false;
+      if(!actual.has_valid_format_version())
+        return (ec = std::error_code{error::different_format_version}), false;
+      if(actual.data_version() == specified.data_version()) {
+        if(actual.data_size() != specified.data_size())
+          return (ec = std::error_code{error::different_data_size}), false;
+        return true;
+      }
+
+      auto const file_size = std::filesystem::file_size(path, ec);
+      if(!!ec)
+        return false;
+      record_layout layout;
+      if(!record_layout::of(actual, file_size, layout))
+        return (ec = std::error_code{error::invalid_file_size}), false;
+      record_converter converter;
+      if(!converter.build(actual, specified, ec))
+        return false;
+
+      mapped_file source = mapped_file::open(path);
+      if(!source)
+        return (ec = mapped_file::last_error()), false;
+      mapped_file::region region = source.map();
+      if(region.address == nullptr)
+        return (ec = mapped_file::last_error()), false;
+
+      std::filesystem::path migrating;
+      try {
+        migrating = path;
+        migrating += ".migrating";
+      } catch(std::bad_alloc const&) {
+        return (ec = std::error_code{error::not_enough_memory}), false;
+      }
+
+      // Records keep their indices, so the capacity never shrinks
+      storage<T> target;
+      header::size_type const capacity = specified.capacity() > actual.capacity()
+                                         ? specified.capacity() : actual.capacity();
+      if(!target.create(migrating, header::with_page_number(header::with_capacity(specified, capacity),
+                                                            actual.page_number()), ec))
+        return false;
+
+      char const* const records = region.address + layout.records_offset;
+      occupancy_map const live{reinterpret_cast<occupancy_map::word_type*>(region.address + layout.occupancy_offset),
+                               actual.capacity()};
+      occupancy_map::size_type const words = live.words_count();
+      std::size_t const morsels = (words + morsel_words - 1) / morsel_words;
+      auto const convert = [&](std::size_t, std::size_t morsel) {
+        auto const first = occupancy_map::size_type(morsel) * morsel_words;
+        auto const last = first + morsel_words < words ? first + morsel_words : words;
+        live.for_each(first, last, [&](occupancy_map::index_type i) {
+          T data = defaults;
+          converter.convert(records + std::size_t(i) * layout.record_size, reinterpret_cast<char*>(&data));
+          target.restore(i, data);
+        });
+      };
+      if(pool != nullptr)
+        pool->run(morsels, convert);
+      else
+        for(std::size_t m = 0; m != morsels; ++m)
+          convert(0, m);
+
+      region = mapped_file::region{};
+      source = mapped_file{};
+      std::error_code removing;
+      if(!target.repair(ec) || !target.checkpoint(ec))
+        return target.close(), std::filesystem::remove(migrating, removing), false;
+      target.close();
+      std::filesystem::rename(migrating, path, ec);
+      if(!!ec)
+        return std::filesystem::remove(migrating, removing), false;
+      return true;
+    }
+
+  } // detail
+
+
+  // Rewrites the storage at path, written with another data version, with
+  // records of T laid out as specified, converted by a record_converter
+  // from the field catalog stored in the file. Records start as defaults
+  // and keep their indices. The new file is written beside the old one
+  // (path with ".migrating" appended) and renamed over it when complete,
+  // so the storage is either old or migrated after a crash. Does nothing
+  // when the data version is the same already
+  template<typename T>
+  bool migrate(std::filesystem::path const& path, header const& specified, T const& defaults,
+               std::error_code& ec) noexcept {
+    return detail::migrate(path, specified, defaults, nullptr, ec);
+  }
+
+
+  // Same as migrate, records are converted by pool in morsels of
+  // occupancy words
+  template<typename T>
+  bool migrate(std::filesystem::path const& path, header const& specified, T const& defaults,
+               thread_pool& pool, std::error_code& ec) noexcept {
+    return detail::migrate(path, specified, defaults, &pool, ec);
+  }
+
+
+} // cellarium
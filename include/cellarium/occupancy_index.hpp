@@ -0,0 +1,168 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <vector>
+
+#include "occupancy_map.hpp"
+
+
+namespace cellarium {
+
+
+  // In-memory summary over an occupancy map to find free slots in
+  // O(log64 capacity): bit i of level 0 is set when word i of the map has
+  // a free slot, bit j of level k + 1 is set when word j of level k is not
+  // empty
+  class occupancy_index {
+  public:
+
+    using word_type = occupancy_map::word_type;
+    using size_type = occupancy_map::size_type;
+    using index_type = occupancy_map::index_type;
+
+    static constexpr index_type no_index = index_type(-1);
+    static constexpr size_type bits_per_word = occupancy_map::bits_per_word;
+
+
+    occupancy_index() noexcept = default;
+    occupancy_index(occupancy_index const&) = default;
+    occupancy_index& operator = (occupancy_index const&) = default;
+    occupancy_index(occupancy_index&&) noexcept = default;
+    occupancy_index& operator = (occupancy_index&&) noexcept = default;
+    explicit operator bool () const noexcept { return !levels_.empty(); }
+    void clear() noexcept { levels_.clear(); }
+
+
+    // Throws std::bad_alloc
+    void build(occupancy_map const& map) {
+      levels_.clear();
+      size_type const n = map.words_count();
+      std::vector<word_type> level(occupancy_map::words_for(n));
+      for(size_type i = 0; i != n; ++i)
+        if(map.word(i) != valid_mask(map, i))
+          level[i / bits_per_word] |= bit_of(i);
+      levels_.push_back(std::move(level));
+
+      while(levels_.back().size() > 1) {
+        std::vector<word_type> const& lower = levels_.back();
+        std::vector<word_type> upper(occupancy_map::words_for(size_type(lower.size())));
+        for(size_type j = 0; j != lower.size(); ++j)
+          if(lower[j] != 0)
+            upper[j / bits_per_word] |= bit_of(j);
+        levels_.push_back(std::move(upper));
+      }
+    }
+
+
+    // Call after map.set(index)
+    void occupied(occupancy_map const& map, index_type index) noexcept {
+      size_type const w = index / bits_per_word;
+      if(map.word(w) != valid_mask(map, w))
+        return;
+      for(size_type k = 0, pos = w; k != levels_.size(); ++k, pos /= bits_per_word) {
+        word_type& word = levels_[k][pos / bits_per_word];
+        word &= ~bit_of(pos);
+        if(word != 0)
+          return;
+      }
+    }
+
+
+    // Call after map.reset(index)
+    void released(index_type index) noexcept {
+      for(size_type k = 0, pos = index / bits_per_word; k != levels_.size(); ++k, pos /= bits_per_word) {
+        word_type& word = levels_[k][pos / bits_per_word];
+        bool const was_empty = word == 0;
+        word |= bit_of(pos);
+        if(!was_empty)
+          return;
+      }
+    }
+
+
+    index_type find_first(occupancy_map const& map) const noexcept {
+      return find_next(map, 0);
+    }
+
+
+    // Lowest free slot at or after from
+    index_type find_next(occupancy_map const& map, index_type from) const noexcept {
+      if(from >= map.capacity())
+        return no_index;
+      size_type const w = from / bits_per_word;
+      word_type const free_here = ~map.word(w) & valid_mask(map, w)
+                                  & (~word_type(0) << (from % bits_per_word));
+      if(free_here != 0)
+        return w * bits_per_word + detail::count_trailing_zeros(free_here);
+      size_type const p = next_set(0, w + 1);
+      if(p == no_index)
+        return no_index;
+      return p * bits_per_word + detail::count_trailing_zeros(~map.word(p) & valid_mask(map, p));
+    }
+
+
+  private:
+
+    std::vector<std::vector<word_type>> levels_;
+
+
+    static word_type bit_of(size_type n) noexcept {
+      return word_type(1) << (n % bits_per_word);
+    }
+
+
+    // Bits of the last word past capacity never count as free
+    static word_type valid_mask(occupancy_map const& map, size_type w) noexcept {
+      size_type const tail = map.capacity() % bits_per_word;
+      if(tail == 0 || w + 1 != map.words_count())
+        return ~word_type(0);
+      return (word_type(1) << tail) - 1;
+    }
+
+
+    size_type next_set(size_type k, size_type pos) const noexcept {
+      std::vector<word_type> const& level = levels_[k];
+      size_type i = pos / bits_per_word;
+      if(i >= level.size())
+        return no_index;
+      word_type const word = level[i] & (~word_type(0) << (pos % bits_per_word));
+      if(word != 0)
+        return i * bits_per_word + detail::count_trailing_zeros(word);
+      if(k + 1 == levels_.size()) {
+        for(++i; i != level.size(); ++i)
+          if(level[i] != 0)
+            return i * bits_per_word + detail::count_trailing_zeros(level[i]);
+        return no_index;
+      }
+      size_type const q = next_set(k + 1, i + 1);
+      if(q == no_index)
+        return no_index;
+      return q * bits_per_word + detail::count_trailing_zeros(level[q]);
+    }
+
+  }; // occupancy_index
+
+
+} // cellarium
@@ -0,0 +1,277 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <xmmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+namespace cellarium {
+
+
+  namespace detail {
+
+    inline unsigned count_trailing_zeros(std::uint64_t word) noexcept {
+#if defined(_MSC_VER)
+      unsigned long n;
+      _BitScanForward64(&n, word);
+      return unsigned(n);
+#else
+      return unsigned(__builtin_ctzll(word));
+#endif
+    }
+
+
+    inline unsigned count_leading_zeros(std::uint64_t word) noexcept {
+#if defined(_MSC_VER)
+      unsigned long n;
+      _BitScanReverse64(&n, word);
+      return 63u - unsigned(n);
+#else
+      return unsigned(__builtin_clzll(word));
+#endif
+    }
+
+
+    inline unsigned count_ones(std::uint64_t word) noexcept {
+#if defined(_MSC_VER)
+      return unsigned(__popcnt64(word));
+#else
+      return unsigned(__builtin_popcountll(word));
+#endif
+    }
+
+
+    inline void prefetch(void const* address) noexcept {
+#if defined(_MSC_VER)
+      _mm_prefetch(static_cast<char const*>(address), _MM_HINT_T0);
+#else
+      __builtin_prefetch(address);
+#endif
+    }
+
+  } // detail
+
+
+  // Non-owning view of a packed bitset, one bit per storage slot
+  class occupancy_map {
+  public:
+
+    using word_type = std::uint64_t;
+    using size_type = std::uint32_t;
+    using index_type = std::uint32_t;
+
+    static constexpr size_type bits_per_word = 64;
+    static constexpr index_type no_index = index_type(-1);
+
+
+    static constexpr size_type words_for(size_type capacity) noexcept {
+      return (capacity + bits_per_word - 1) / bits_per_word;
+    }
+
+
+    static constexpr std::size_t size_of(size_type capacity) noexcept {
+      return std::size_t(words_for(capacity)) * sizeof(word_type);
+    }
+
+
+    static size_type count(word_type const* words, size_type words_count) noexcept {
+      size_type n = 0;
+      for(size_type i = 0; i != words_count; ++i)
+        n += detail::count_ones(words[i]);
+      return n;
+    }
+
+
+    occupancy_map() noexcept = default;
+    occupancy_map(occupancy_map const&) noexcept = default;
+    occupancy_map& operator = (occupancy_map const&) noexcept = default;
+    size_type capacity() const noexcept { return capacity_; }
+    size_type words_count() const noexcept { return words_for(capacity_); }
+    word_type const* data() const noexcept { return words_; }
+    word_type* data() noexcept { return words_; }
+    word_type word(size_type n) const noexcept { return words_[n]; }
+    explicit operator bool () const noexcept { return words_ != nullptr; }
+
+
+    occupancy_map(word_type* words, size_type capacity) noexcept:
+      words_{words}, capacity_{capacity}
+    { }
+
+
+    bool test(index_type index) const noexcept {
+      return (words_[index / bits_per_word] & mask_of(index)) != 0;
+    }
+
+
+    void set(index_type index) noexcept {
+      words_[index / bits_per_word] |= mask_of(index);
+    }
+
+
+    void reset(index_type index) noexcept {
+      words_[index / bits_per_word] &= ~mask_of(index);
+    }
+
+
+    void clear() noexcept {
+      std::memset(words_, 0, size_of(capacity_));
+    }
+
+
+    size_type count() const noexcept {
+      return count(words_, words_count());
+    }
+
+
+    // Highest set bit at or below from
+    index_type find_last(index_type from) const noexcept {
+      if(from >= capacity_)
+        from = capacity_ - 1;
+      size_type i = from / bits_per_word;
+      word_type word = words_[i] & (~word_type(0) >> (bits_per_word - 1 - from % bits_per_word));
+      for(;;) {
+        if(word != 0)
+          return i * bits_per_word + (bits_per_word - 1 - detail::count_leading_zeros(word));
+        if(i == 0)
+          return no_index;
+        word = words_[--i];
+      }
+    }
+
+
+    // Calls f(index) for every set bit in ascending order
+    template<typename F> void for_each(F&& f) const {
+      size_type const n = words_count();
+      size_type i = 0;
+#if defined(__AVX2__)
+      // Skip four empty words per test
+      for(; i + 4 <= n; i += 4) {
+        __m256i const block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(words_ + i));
+        if(_mm256_testz_si256(block, block))
+          continue;
+        for_each_in_word(i, f);
+        for_each_in_word(i + 1, f);
+        for_each_in_word(i + 2, f);
+        for_each_in_word(i + 3, f);
+      }
+#endif
+      for(; i != n; ++i)
+        for_each_in_word(i, f);
+    }
+
+
+    // Forward walk over set bits; index() equals capacity past the last one
+    class cursor {
+    public:
+
+      cursor() noexcept = default;
+
+
+      cursor(occupancy_map const& map, index_type from) noexcept:
+        words_{map.words_}, words_count_{map.words_count()}, end_{map.capacity_} {
+        if(from >= end_) {
+          index_ = end_;
+          return;
+        }
+        word_ = from / bits_per_word;
+        bits_ = words_[word_] & (~word_type(0) << (from % bits_per_word));
+        settle();
+      }
+
+
+      index_type index() const noexcept { return index_; }
+
+
+      void next() noexcept {
+        bits_ &= bits_ - 1;
+        settle();
+      }
+
+
+    private:
+
+      word_type const* words_{nullptr};
+      size_type words_count_{0};
+      size_type word_{0};
+      word_type bits_{0};
+      index_type index_{0};
+      index_type end_{0};
+
+
+      void settle() noexcept {
+        while(bits_ == 0) {
+          if(++word_ >= words_count_) {
+            index_ = end_;
+            return;
+          }
+          bits_ = words_[word_];
+        }
+        index_ = word_ * bits_per_word + detail::count_trailing_zeros(bits_);
+      }
+
+    }; // cursor
+
+
+    // Same as for_each, restricted to words [first_word, last_word)
+    template<typename F> void for_each(size_type first_word, size_type last_word, F&& f) const {
+      for(size_type i = first_word; i != last_word; ++i)
+        for_each_in_word(i, f);
+    }
+
+
+  private:
+
+    word_type* words_{nullptr};
+    size_type capacity_{0};
+
+
+    static word_type mask_of(index_type index) noexcept {
+      return word_type(1) << (index % bits_per_word);
+    }
+
+
+    template<typename F> void for_each_in_word(size_type n, F& f) const {
+      word_type word = words_[n];
+      index_type const base = n * bits_per_word;
+      while(word != 0) {
+        f(base + detail::count_trailing_zeros(word));
+        word &= word - 1;
+      }
+    }
+
+  }; // occupancy_map
+
+
+} // cellarium
@@ -0,0 +1,755 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#include "file.hpp"
+#include "mapped_file.hpp"
+#include "header.hpp"
+#include "storage.hpp"
+#include "key.hpp"
+#include "occupancy_map.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  // B+tree of record indices in a mapped file:
+  //   header | node 0 | node 1 | ...
+  // Entries are normalized keys followed by big-endian record indices, so
+  // entries are unique, equal keys are kept in index order and every
+  // comparison is one memcmp. Nodes are whole cache lines holding at
+  // least sixteen separators, and a descent touches one node per level.
+  // Leaves are linked left to right. Erased entries leave leaves in place
+  // without merging; scans step over empty leaves
+  class btree_index {
+  public:
+
+    using path_type = std::filesystem::path;
+    using size_type = std::uint32_t;
+    using index_type = std::uint32_t;
+    using node_type = std::uint32_t;
+
+    static constexpr index_type no_index = index_type(-1);
+    static constexpr node_type no_node = node_type(-1);
+    static constexpr size_type max_key_size = 256;
+    static constexpr size_type max_height = 32;
+    static constexpr size_type cache_line = 64;
+    static constexpr size_type min_fanout = 16;
+    static constexpr std::uint32_t valid_signature = 0xDA1AB7EE;
+    static constexpr std::uint32_t valid_format_version = 1;
+
+
+    // Forward walk over entries in key order
+    class cursor {
+    public:
+
+      cursor() noexcept = default;
+      explicit operator bool () const noexcept { return node_ != no_node; }
+      unsigned char const* key() const noexcept { return tree_->entry(node_, position_); }
+      index_type index() const noexcept { return tree_->index_of(key()); }
+
+
+      void next() noexcept {
+        ++position_;
+        settle();
+      }
+
+
+    private:
+
+      friend class btree_index;
+
+      btree_index const* tree_{nullptr};
+      node_type node_{no_node};
+      size_type position_{0};
+
+
+      cursor(btree_index const* tree, node_type node, size_type position) noexcept:
+        tree_{tree}, node_{node}, position_{position} {
+        settle();
+      }
+
+
+      void settle() noexcept {
+        while(node_ != no_node && position_ >= tree_->node_at(node_).count) {
+          node_ = tree_->node_at(node_).next;
+          position_ = 0;
+        }
+      }
+
+    }; // cursor
+
+
+    btree_index() noexcept = default;
+    ~btree_index() { close(); }
+    btree_index(btree_index const&) = delete;
+    btree_index& operator = (btree_index const&) = delete;
+    explicit operator bool () const noexcept { return header_ != nullptr; }
+    size_type size() const noexcept { return header_->count; }
+    size_type height() const noexcept { return header_->height; }
+    size_type key_size() const noexcept { return header_->key_width; }
+    size_type node_size() const noexcept { return header_->node_size; }
+
+
+    // Smallest node of whole cache lines with min_fanout separators
+    static size_type node_size_for(size_type key_width) noexcept {
+      size_type const needed = size_type(sizeof(node_header)) + sizeof(node_type)
+                               + min_fanout * (key_width + sizeof(index_type) + sizeof(node_type));
+      return (needed + cache_line - 1) / cache_line * cache_line;
+    }
+
+
+    // Empty index; fails with unsupported_field_kind for keys which are
+    // not orderable or wider than max_key_size
+    bool create(path_type const& path, record_key const& key, std::error_code& ec) noexcept {
+      close();
+      if(!key.orderable() || key.normalized_size() > max_key_size)
+        return (ec = std::error_code{error::unsupported_field_kind}), false;
+      size_type const width = key.normalized_size();
+      size_type const nodes = 16;
+      {
+        auto f = file::create(path);
+        if(!f)
+          return (ec = file::last_error()), false;
+        if(!f.resize(file_size(node_size_for(width), nodes)))
+          return (ec = file::last_error()), false;
+      }
+      if(!map(path, ec))
+        return false;
+      *header_ = index_header{valid_signature, valid_format_version, 0,
+                              std::uint32_t(key.kind()), key.offset(), key.size(),
+                              width, node_size_for(width), 0, 1, 1, nodes, 0, {}};
+      bind();
+      node_header& root = node_at(0);
+      root = node_header{0, 1, no_node};
+      return true;
+    }
+
+
+    // Fails with invalid_index unless the index was closed properly and
+    // built for key; rebuild it then
+    bool open(path_type const& path, record_key const& key, std::error_code& ec) noexcept {
+      close();
+      bool const exists = std::filesystem::exists(path, ec);
+      if(!!ec)
+        return false;
+      if(!exists)
+        return (ec = std::error_code{error::invalid_index}), false;
+      if(!map(path, ec))
+        return false;
+      index_header const& h = *header_;
+      if(region_.size < mapped_file::size_type(sizeof(index_header)) || h.signature != valid_signature
+         || h.format_version != valid_format_version || h.clean == 0
+         || h.key_kind != std::uint32_t(key.kind()) || h.key_offset != key.offset() || h.key_size != key.size()
+         || h.key_width != key.normalized_size() || h.node_size != node_size_for(h.key_width)
+         || region_.size != file_size(h.node_size, h.nodes_capacity))
+        return (ec = std::error_code{error::invalid_index}), close(), false;
+      header_->clean = 0;
+      bind();
+      return true;
+    }
+
+
+    void close() noexcept {
+      if(header_ == nullptr)
+        return;
+      header_->clean = 1;
+      header_ = nullptr;
+      nodes_ = nullptr;
+      region_ = mapped_file::region{};
+      mapped_file_ = mapped_file{};
+    }
+
+
+    // key of key_size bytes as written by record_key::normalize. Fails
+    // only when the file can not be extended; the index is closed when it
+    // can not be mapped again
+    bool insert(unsigned char const* key, index_type index, std::error_code& ec) noexcept {
+      if(!reserve(header_->height + 1, ec))
+        return false;
+      unsigned char e[max_key_size + sizeof(index_type)];
+      make_entry(key, index, e);
+
+      path_step path[max_height];
+      node_type const leaf = descend(e, path);
+      node_header& n = node_at(leaf);
+      size_type const pos = lower_bound(leaf, e);
+      if(pos != n.count && compare(entry(leaf, pos), e) == 0)
+        return true;
+      ++header_->count;
+      if(n.count < leaf_capacity_) {
+        insert_entry(leaf, pos, e);
+        return true;
+      }
+
+      unsigned char separator[max_key_size + sizeof(index_type)];
+      node_type right = split_leaf(leaf, pos, e);
+      std::memcpy(separator, entry(right, 0), entry_size_);
+      for(size_type depth = header_->height - 1; depth != 0; --depth) {
+        path_step const& step = path[depth - 1];
+        if(node_at(step.node).count < inner_capacity_) {
+          insert_separator(step.node, step.position, separator, right);
+          return true;
+        }
+        right = split_inner(step.node, step.position, separator, right);
+      }
+
+      node_type const root = allocate();
+      node_header& r = node_at(root);
+      r = node_header{1, 0, no_node};
+      children(root)[0] = header_->root;
+      children(root)[1] = right;
+      std::memcpy(separator_at(root, 0), separator, entry_size_);
+      header_->root = root;
+      ++header_->height;
+      return true;
+    }
+
+
+    bool erase(unsigned char const* key, index_type index) noexcept {
+      unsigned char e[max_key_size + sizeof(index_type)];
+      make_entry(key, index, e);
+      path_step path[max_height];
+      node_type const leaf = descend(e, path);
+      node_header& n = node_at(leaf);
+      size_type const pos = lower_bound(leaf, e);
+      if(pos == n.count || compare(entry(leaf, pos), e) != 0)
+        return false;
+      unsigned char* const at = entry(leaf, pos);
+      std::memmove(at, at + entry_size_, std::size_t(n.count - pos - 1) * entry_size_);
+      --n.count;
+      --header_->count;
+      return true;
+    }
+
+
+    cursor begin() const noexcept {
+      node_type n = header_->root;
+      for(size_type level = header_->height; level != 1; --level)
+        n = children(n)[0];
+      return cursor{this, n, 0};
+    }
+
+
+    // First entry with key not less than key
+    cursor lower_bound(unsigned char const* key) const noexcept {
+      unsigned char e[max_key_size + sizeof(index_type)];
+      make_entry(key, 0, e);
+      node_type const leaf = descend(e, nullptr);
+      return cursor{this, leaf, lower_bound(leaf, e)};
+    }
+
+
+  private:
+
+    struct index_header {
+      std::uint32_t signature;
+      std::uint32_t format_version;
+      std::uint32_t clean;
+      std::uint32_t key_kind;
+      std::uint32_t key_offset;
+      std::uint32_t key_size;
+      size_type key_width;
+      size_type node_size;
+      node_type root;
+      size_type height;
+      size_type nodes_count;
+      size_type nodes_capacity;
+      size_type count;
+      std::uint32_t reserved[3];
+    }; // index_header
+
+    static_assert(sizeof(index_header) == 64, "Nodes start at a cache line");
+
+    // Leaves hold entries after the header, inner nodes hold count + 1
+    // children and then count separators
+    struct node_header {
+      std::uint16_t count;
+      std::uint16_t leaf;
+      node_type next;
+    }; // node_header
+
+    struct path_step {
+      node_type node;
+      size_type position;
+    }; // path_step
+
+    mapped_file mapped_file_;
+    mapped_file::region region_;
+    index_header* header_{nullptr};
+    char* nodes_{nullptr};
+    size_type entry_size_{0};
+    size_type leaf_capacity_{0};
+    size_type inner_capacity_{0};
+
+
+    static file::size_type file_size(size_type node_size, size_type nodes) noexcept {
+      return file::size_type(sizeof(index_header)) + file::size_type(node_size) * nodes;
+    }
+
+
+    bool map(path_type const& path, std::error_code& ec) noexcept {
+      mapped_file_ = mapped_file::open(path);
+      if(!mapped_file_)
+        return (ec = mapped_file::last_error()), false;
+      region_ = mapped_file_.map();
+      if(region_.address == nullptr)
+        return (ec = mapped_file::last_error()), (mapped_file_ = mapped_file{}), false;
+      header_ = reinterpret_cast<index_header*>(region_.address);
+      return true;
+    }
+
+
+    void bind() noexcept {
+      nodes_ = region_.address + sizeof(index_header);
+      entry_size_ = header_->key_width + size_type(sizeof(index_type));
+      size_type const room = header_->node_size - size_type(sizeof(node_header));
+      leaf_capacity_ = room / entry_size_;
+      inner_capacity_ = (room - size_type(sizeof(node_type))) / (entry_size_ + size_type(sizeof(node_type)));
+    }
+
+
+    // Room for nodes more, capacity doubles
+    bool reserve(size_type nodes, std::error_code& ec) noexcept {
+      size_type const needed = header_->nodes_count + nodes;
+      if(needed <= header_->nodes_capacity)
+        return true;
+      size_type capacity = header_->nodes_capacity * 2;
+      if(capacity < needed)
+        capacity = needed;
+      if(!mapped_file_.grow(region_, file_size(header_->node_size, capacity))) {
+        ec = mapped_file::last_error();
+        if(region_.address == nullptr)
+          header_ = nullptr, nodes_ = nullptr, mapped_file_ = mapped_file{};
+        return false;
+      }
+      header_ = reinterpret_cast<index_header*>(region_.address);
+      header_->nodes_capacity = capacity;
+      bind();
+      return true;
+    }
+
+
+    node_type allocate() noexcept {
+      return header_->nodes_count++;
+    }
+
+
+    node_header& node_at(node_type n) const noexcept {
+      return *reinterpret_cast<node_header*>(nodes_ + std::size_t(n) * header_->node_size);
+    }
+
+
+    unsigned char* entry(node_type n, size_type position) const noexcept {
+      return reinterpret_cast<unsigned char*>(&node_at(n) + 1) + std::size_t(position) * entry_size_;
+    }
+
+
+    node_type* children(node_type n) const noexcept {
+      return reinterpret_cast<node_type*>(&node_at(n) + 1);
+    }
+
+
+    unsigned char* separator_at(node_type n, size_type position) const noexcept {
+      return reinterpret_cast<unsigned char*>(children(n) + inner_capacity_ + 1)
+             + std::size_t(position) * entry_size_;
+    }
+
+
+    int compare(unsigned char const* a, unsigned char const* b) const noexcept {
+      return std::memcmp(a, b, entry_size_);
+    }
+
+
+    void make_entry(unsigned char const* key, index_type index, unsigned char* out) const noexcept {
+      size_type const width = header_->key_width;
+      std::memcpy(out, key, width);
+      for(int i = 3; i >= 0; --i, index >>= 8)
+        out[width + i] = static_cast<unsigned char>(index);
+    }
+
+
+    index_type index_of(unsigned char const* e) const noexcept {
+      unsigned char const* const bytes = e + header_->key_width;
+      return index_type(bytes[0]) << 24 | index_type(bytes[1]) << 16 | index_type(bytes[2]) << 8 | bytes[3];
+    }
+
+
+    // Leaf where e belongs; inner nodes and child positions passed are
+    // written to path from the root down
+    node_type descend(unsigned char const* e, path_step* path) const noexcept {
+      node_type n = header_->root;
+      for(size_type level = header_->height, depth = 0; level != 1; --level, ++depth) {
+        size_type first = 0, last = node_at(n).count;
+        while(first != last) {
+          size_type const middle = (first + last) / 2;
+          if(compare(separator_at(n, middle), e) <= 0)
+            first = middle + 1;
+          else
+            last = middle;
+        }
+        if(path != nullptr)
+          path[depth] = path_step{n, first};
+        n = children(n)[first];
+        detail::prefetch(&node_at(n));
+      }
+      return n;
+    }
+
+
+    size_type lower_bound(node_type leaf, unsigned char const* e) const noexcept {
+      size_type first = 0, last = node_at(leaf).count;
+      while(first != last) {
+        size_type const middle = (first + last) / 2;
+        if(compare(entry(leaf, middle), e) < 0)
+          first = middle + 1;
+        else
+          last = middle;
+      }
+      return first;
+    }
+
+
+    void insert_entry(node_type leaf, size_type pos, unsigned char const* e) noexcept {
+      node_header& n = node_at(leaf);
+      unsigned char* const at = entry(leaf, pos);
+      std::memmove(at + entry_size_, at, std::size_t(n.count - pos) * entry_size_);
+      std::memcpy(at, e, entry_size_);
+      ++n.count;
+    }
+
+
+    // Upper half of the full leaf with e inserted at pos moves to a new
+    // right sibling
+    node_type split_leaf(node_type leaf, size_type pos, unsigned char const* e) noexcept {
+      node_type const right = allocate();
+      node_header& l = node_at(leaf);
+      node_header& r = node_at(right);
+      size_type const total = l.count + 1;
+      size_type const half = total / 2;
+      r = node_header{0, 1, l.next};
+      l.next = right;
+      for(size_type i = half; i != total; ++i) {
+        unsigned char const* const source = i < pos ? entry(leaf, i) : i == pos ? e : entry(leaf, i - 1);
+        std::memcpy(entry(right, i - half), source, entry_size_);
+      }
+      r.count = std::uint16_t(total - half);
+      l.count = std::uint16_t(half);
+      if(pos < half) {
+        --l.count;
+        insert_entry(leaf, pos, e);
+      }
+      return right;
+    }
+
+
+    void insert_separator(node_type inner, size_type pos, unsigned char const* separator,
+                          node_type right) noexcept {
+      node_header& n = node_at(inner);
+      unsigned char* const at = separator_at(inner, pos);
+      std::memmove(at + entry_size_, at, std::size_t(n.count - pos) * entry_size_);
+      std::memcpy(at, separator, entry_size_);
+      node_type* const c = children(inner);
+      std::memmove(c + pos + 2, c + pos + 1, std::size_t(n.count - pos) * sizeof(node_type));
+      c[pos + 1] = right;
+      ++n.count;
+    }
+
+
+    // The full node with separator and right inserted at pos is split
+    // around its middle separator, which is written back to separator for
+    // the parent; returns the new right node
+    node_type split_inner(node_type inner, size_type pos, unsigned char* separator,
+                          node_type right) noexcept {
+      node_type const sibling = allocate();
+      node_header& l = node_at(inner);
+      node_header& r = node_at(sibling);
+      size_type const total = l.count + 1;
+      size_type const middle = total / 2;
+      node_type const* const c = children(inner);
+      auto const separator_of = [&](size_type i) {
+        return i < pos ? separator_at(inner, i) : i == pos ? separator : separator_at(inner, i - 1);
+      };
+      auto const child_of = [&](size_type i) {
+        return i <= pos ? c[i] : i == pos + 1 ? right : c[i - 1];
+      };
+
+      r = node_header{std::uint16_t(total - middle - 1), 0, no_node};
+      for(size_type i = middle + 1; i != total; ++i)
+        std::memcpy(separator_at(sibling, i - middle - 1), separator_of(i), entry_size_);
+      for(size_type i = middle + 1; i != total + 1; ++i)
+        children(sibling)[i - middle - 1] = child_of(i);
+      unsigned char promoted[max_key_size + sizeof(index_type)];
+      std::memcpy(promoted, separator_of(middle), entry_size_);
+
+      if(pos < middle) {
+        l.count = std::uint16_t(middle - 1);
+        insert_separator(inner, pos, separator, right);
+      } else {
+        l.count = std::uint16_t(middle);
+      }
+      std::memcpy(separator, promoted, entry_size_);
+      return sibling;
+    }
+
+  }; // btree_index
+
+
+  // Storage with records ordered by one of their fields through a B+tree
+  // kept beside the file (path with ".btree" appended). Keys need not be
+  // unique. Keys are integers, floats, or utf8 and byte strings; a key
+  // may be given as a string of its significant bytes or as an arithmetic
+  // value converted to the field kind
+  template<typename T>
+  class ordered_storage {
+  public:
+
+    using storage_type = cellarium::storage<T>;
+    using path_type = typename storage_type::path_type;
+    using size_type = typename storage_type::size_type;
+    using index_type = typename storage_type::index_type;
+    using value_type = T;
+
+    static constexpr index_type no_index = storage_type::no_index;
+
+
+    static path_type index_path(path_type const& path) {
+      path_type result = path;
+      result += ".btree";
+      return result;
+    }
+
+
+    ordered_storage() noexcept = default;
+    ~ordered_storage() { close(); }
+    ordered_storage(ordered_storage const&) = delete;
+    ordered_storage& operator = (ordered_storage const&) = delete;
+    explicit operator bool () const noexcept { return !!storage_; }
+    cellarium::header const* header() const noexcept { return storage_.header(); }
+    storage_type const& storage() const noexcept { return storage_; }
+    btree_index const& index() const noexcept { return index_; }
+    record_key const& key() const noexcept { return key_; }
+    size_type size() const noexcept { return storage_.size(); }
+    void growth_factor(size_type factor) noexcept { storage_.growth_factor(factor); }
+
+
+    bool create(path_type const& path, class header const& specified, char const* key_name,
+                std::error_code& ec) noexcept {
+      close();
+      if(!bind_key(specified, key_name, ec) || !storage_.create(path, specified, ec))
+        return false;
+      index_path_ = index_path(path);
+      if(!index_.create(index_path_, key_, ec))
+        return storage_.close(), false;
+      return true;
+    }
+
+
+    bool open(path_type const& path, class header const& specified, char const* key_name,
+              std::error_code& ec) noexcept {
+      close();
+      if(!bind_key(specified, key_name, ec))
+        return false;
+      class header actual; size_type items_count;
+      if(!storage_type::read_info(path, actual, items_count, ec) || !storage_.open(path, specified, ec))
+        return false;
+      index_path_ = index_path(path);
+      std::error_code opening;
+      if(actual.clean() && index_.open(index_path_, key_, opening) && index_.size() == storage_.size())
+        return true;
+      if(!rebuild(ec))
+        return storage_.close(), false;
+      return true;
+    }
+
+
+    void close() noexcept {
+      index_.close();
+      storage_.close();
+    }
+
+
+    // No index when the storage is full; ec is set only when the index can
+    // not be extended, the record is not inserted then
+    index_type try_insert(T const& data, std::error_code& ec) noexcept {
+      index_type const index = storage_.try_insert(data);
+      if(index == no_index)
+        return no_index;
+      key_buffer k;
+      normalize(key_.of(&data), k);
+      if(!index_.insert(k.bytes, index, ec))
+        return storage_.remove(index), no_index;
+      return index;
+    }
+
+
+    void remove(index_type index) noexcept {
+      key_buffer k;
+      normalize(key_.of(&record(index)), k);
+      index_.erase(k.bytes, index);
+      storage_.remove(index);
+    }
+
+
+    // Key of the record may change; false when the index can not be
+    // extended, nothing is updated then
+    bool update(index_type index, T const& data, std::error_code& ec) noexcept {
+      key_buffer old_key, new_key;
+      normalize(key_.of(&record(index)), old_key);
+      normalize(key_.of(&data), new_key);
+      if(std::memcmp(old_key.bytes, new_key.bytes, key_.normalized_size()) != 0) {
+        if(!index_.insert(new_key.bytes, index, ec))
+          return false;
+        index_.erase(old_key.bytes, index);
+      }
+      storage_.update(index, data);
+      return true;
+    }
+
+
+    T const& operator [](index_type index) const noexcept {
+      return record(index);
+    }
+
+
+    // Record with the least key not less than key
+    template<typename K> index_type lower_bound(K const& key) const noexcept {
+      key_buffer k;
+      normalize(key, k);
+      btree_index::cursor const c = index_.lower_bound(k.bytes);
+      return c ? c.index() : no_index;
+    }
+
+
+    // Calls f(index) in key order for records with keys in [from, to)
+    template<typename K1, typename K2, typename F>
+    void for_range(K1 const& from, K2 const& to, F&& f) const {
+      key_buffer lower, upper;
+      normalize(from, lower);
+      normalize(to, upper);
+      size_type const width = key_.normalized_size();
+      for(btree_index::cursor c = index_.lower_bound(lower.bytes);
+          c && std::memcmp(c.key(), upper.bytes, width) < 0; c.next())
+        f(c.index());
+    }
+
+
+    // Calls f(index) in key order for records with string keys starting
+    // with prefix
+    template<typename F> void for_prefix(std::string_view prefix, F&& f) const {
+      if(prefix.size() > key_.normalized_size())
+        return;
+      key_buffer lower;
+      normalize(prefix, lower);
+      for(btree_index::cursor c = index_.lower_bound(lower.bytes);
+          c && std::memcmp(c.key(), prefix.data(), prefix.size()) == 0; c.next())
+        f(c.index());
+    }
+
+
+    // Calls f(index) for every record in key order
+    template<typename F> void for_each_ordered(F&& f) const {
+      for(btree_index::cursor c = index_.begin(); c; c.next())
+        f(c.index());
+    }
+
+
+    template<typename F> void for_each(F&& f) const {
+      storage_.for_each(std::forward<F>(f));
+    }
+
+
+  private:
+
+    struct key_buffer {
+      unsigned char bytes[btree_index::max_key_size];
+    }; // key_buffer
+
+    storage_type storage_;
+    btree_index index_;
+    record_key key_;
+    path_type index_path_;
+
+
+    T const& record(index_type index) const noexcept {
+      return storage_[index];
+    }
+
+
+    void normalize(std::string_view key, key_buffer& out) const noexcept {
+      key_.normalize(key, out.bytes);
+    }
+
+
+    void normalize(char const* key, key_buffer& out) const noexcept {
+      key_.normalize(std::string_view{key}, out.bytes);
+    }
+
+
+    template<typename V, typename = std::enable_if_t<std::is_arithmetic_v<V>>>
+    void normalize(V key, key_buffer& out) const noexcept {
+      char buffer[8];
+      key_.normalize(key_.encode(key, buffer), out.bytes);
+    }
+
+
+    bool bind_key(class header const& specified, char const* key_name, std::error_code& ec) noexcept {
+      field const* const found = specified.find_field(key_name);
+      if(found == nullptr)
+        return (ec = std::error_code{error::field_not_found}), false;
+      key_ = record_key{*found};
+      if(!key_.orderable() || key_.normalized_size() > btree_index::max_key_size)
+        return (ec = std::error_code{error::unsupported_field_kind}), false;
+      return true;
+    }
+
+
+    // Index is built again from live records
+    bool rebuild(std::error_code& ec) noexcept {
+      if(!index_.create(index_path_, key_, ec))
+        return false;
+      bool done = true;
+      occupancy_map::cursor c{storage_.occupancy(), 0};
+      for(; done && c.index() != storage_.occupancy().capacity(); c.next()) {
+        key_buffer k;
+        normalize(key_.of(&record(c.index())), k);
+        done = index_.insert(k.bytes, c.index(), ec);
+      }
+      return done;
+    }
+
+  }; // ordered_storage
+
+
+} // cellarium
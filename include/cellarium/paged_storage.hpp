@@ -24,10 +24,13 @@
 
 
 #include <cmath>
+#include <cstddef>
 #include <filesystem>
+#include <iterator>
 #include <system_error>
 #include <memory>
 #include <type_traits>
+#include <vector>
 
 #include "storage.hpp"
 #include "file_manager.hpp"
@@ -57,6 +60,10 @@ namespace cellarium {
     paged_storage(paged_storage const&) = delete;
     paged_storage& operator = (paged_storage const&) = delete;
     explicit operator bool () const noexcept { return pages_count_ != 0; }
+    size_type pages_count() const noexcept { return pages_count_; }
+    size_type page_capacity() const noexcept { return page_capacity_; }
+    storage_type const& page(size_type n) const noexcept { return *pages_[n]; }
+    storage_type& page(size_type n) noexcept { return *pages_[n]; }
     
     
     bool initialize(path_type const& path, size_type max_pages,
@@ -80,15 +87,15 @@ namespace cellarium {
       max_pages_ = max_pages;
       page_capacity_ = specified.capacity();
 
-      if(!file_manager_::remove_all(ec))
+      if(!file_manager_.remove_all(ec))
         return false;
       pages_ = std::make_unique<storage_ptr[]>(max_pages_);      
-      auto storage = std::make_unique<cellarium::storage>();
-      path_type const path = file_manager_.name_for_page(0);
-      if(!storage->create(path, specified, ec))
+      auto storage = std::make_unique<storage_type>();
+      path_type const page_path = file_manager_.name_for_page(0);
+      if(!storage->create(page_path, specified, ec))
         return false;
       pages_[0] = std::move(storage);
-      last_page_ = std::to_address(pages_[0]);
+      last_page_ = pages_[0].get();
       last_page_base_ = 0;
       pages_count_ = 1;
       return true;
@@ -127,7 +134,8 @@ namespace cellarium {
           if(!storage_type::read_info(each_file, each_header, each_size, ec))
             return false;
           if(last_storage_capacity != 0 && last_storage_capacity != each_header.capacity())
-            return (ec = std::error_code{error::merging_incompatible_storages})
+            return (ec = std::error_code{error::merging_incompatible_storages}), false;
+          last_storage_capacity = each_header.capacity();
           total_size += each_size;
         }
         
@@ -154,7 +162,7 @@ namespace cellarium {
             std::filesystem::rename(files[0], path, none);
             return false;
           }
-          each_storage.for_each([&](value_type const& value) { merged_storage.try_insert(value); });
+          each_storage.for_each([&](value_type const& value) { merged_storage->try_insert(value); });
           each_storage.close();
         }
         
@@ -167,7 +175,7 @@ namespace cellarium {
         pages_[0] = std::move(merged_storage);
       }
       
-      last_page_ = std::to_address(pages_[0]);
+      last_page_ = pages_[0].get();
       last_page_base_ = 0;      
       pages_count_ = 1;
         
@@ -204,6 +212,40 @@ namespace cellarium {
       pages_[base]->remove(offset);
     }
 
+
+
+    // Same as storage::update on the page of index
+    void update(index_type index, T const& data) noexcept {
+      pages_[index / page_capacity_]->update(index % page_capacity_, data);
+    }
+
+
+    T const& operator [](index_type index) const noexcept {
+      return (*pages_[index / page_capacity_])[index % page_capacity_];
+    }
+
+
+    T& operator [](index_type index) noexcept {
+      return (*pages_[index / page_capacity_])[index % page_capacity_];
+    }
+
+
+    size_type size() const noexcept {
+      size_type n = 0;
+      for(size_type i = 0; i != pages_count_; ++i)
+        n += pages_[i]->size();
+      return n;
+    }
+
+
+    // Calls f(index) with the paged index of every live record
+    template<typename F> void for_each_index(F&& f) const {
+      for(size_type i = 0; i != pages_count_; ++i) {
+        index_type const base = i * page_capacity_;
+        pages_[i]->occupancy().for_each([&](index_type n) { f(base + n); });
+      }
+    }
+
     
     template<typename F> void for_each(F&& f) {
       for(index_type i = 0; i != pages_count_; ++i)
@@ -217,6 +259,132 @@ namespace cellarium {
     }
 
 
+    // Snapshot of every page, see storage::snapshot. Throws std::bad_alloc
+    paged_snapshot<T> snapshot() {
+      std::vector<storage_snapshot<T>> pages;
+      pages.reserve(pages_count_);
+      for(size_type i = 0; i != pages_count_; ++i)
+        pages.push_back(pages_[i]->snapshot());
+      return paged_snapshot<T>{std::move(pages), page_capacity_};
+    }
+
+
+    // Walks live records page by page; index() is the paged index. Adding a
+    // page invalidates end()
+    template<typename V> class basic_iterator {
+    public:
+
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = T;
+      using difference_type = std::ptrdiff_t;
+      using pointer = V*;
+      using reference = V&;
+
+
+      basic_iterator() noexcept = default;
+      reference operator * () const noexcept { return *current_; }
+      pointer operator -> () const noexcept { return &*current_; }
+
+
+      index_type index() const noexcept {
+        return index_type(page_ * page_capacity_ + current_.index());
+      }
+
+
+      template<typename U, typename = std::enable_if_t<std::is_const_v<V> && std::is_same_v<U, T>>>
+      basic_iterator(basic_iterator<U> const& other) noexcept:
+        pages_{other.pages_}, pages_count_{other.pages_count_}, page_capacity_{other.page_capacity_},
+        page_{other.page_}, current_{other.current_}
+      { }
+
+
+      basic_iterator& operator ++ () noexcept {
+        ++current_;
+        if(current_ == page()->end()) {
+          ++page_;
+          settle();
+        }
+        return *this;
+      }
+
+
+      basic_iterator operator ++ (int) noexcept {
+        basic_iterator const previous{*this};
+        ++*this;
+        return previous;
+      }
+
+
+      friend bool operator == (basic_iterator const& a, basic_iterator const& b) noexcept {
+        return a.page_ == b.page_ && (a.page_ == a.pages_count_ || a.current_ == b.current_);
+      }
+
+
+      friend bool operator != (basic_iterator const& a, basic_iterator const& b) noexcept {
+        return !(a == b);
+      }
+
+
+    private:
+
+      friend class paged_storage;
+      template<typename> friend class basic_iterator;
+
+      using page_iterator = std::conditional_t<std::is_const_v<V>,
+                                               typename storage_type::const_iterator,
+                                               typename storage_type::iterator>;
+      using page_pointer = std::conditional_t<std::is_const_v<V>, storage_type const*, storage_type*>;
+
+      storage_ptr const* pages_{nullptr};
+      size_type pages_count_{0};
+      size_type page_capacity_{0};
+      size_type page_{0};
+      page_iterator current_;
+
+
+      basic_iterator(storage_ptr const* pages, size_type pages_count, size_type page_capacity,
+                     size_type page) noexcept:
+        pages_{pages}, pages_count_{pages_count}, page_capacity_{page_capacity}, page_{page} {
+        settle();
+      }
+
+
+      page_pointer page() const noexcept { return pages_[page_].get(); }
+
+
+      // Moves to the first live record at or after the start of page_
+      void settle() noexcept {
+        for(; page_ < pages_count_; ++page_) {
+          current_ = page()->begin();
+          if(current_ != page()->end())
+            return;
+        }
+        page_ = pages_count_;
+        current_ = page_iterator{};
+      }
+
+    }; // basic_iterator
+
+    using iterator = basic_iterator<T>;
+    using const_iterator = basic_iterator<T const>;
+
+
+    iterator begin() noexcept { return iterator{pages_.get(), pages_count_, page_capacity_, 0}; }
+    iterator end() noexcept { return iterator{pages_.get(), pages_count_, page_capacity_, pages_count_}; }
+    const_iterator begin() const noexcept { return cbegin(); }
+    const_iterator end() const noexcept { return cend(); }
+
+
+    const_iterator cbegin() const noexcept {
+      return const_iterator{pages_.get(), pages_count_, page_capacity_, 0};
+    }
+
+
+    const_iterator cend() const noexcept {
+      return const_iterator{pages_.get(), pages_count_, page_capacity_, pages_count_};
+    }
+
+
   private:
   
     file_manager file_manager_;
@@ -224,21 +392,21 @@ namespace cellarium {
     size_type max_pages_{0};
     size_type pages_count_{0};
     std::unique_ptr<storage_ptr[]> pages_;
-    storage* last_page_{nullptr};
+    storage_type* last_page_{nullptr};
     size_type last_page_base_{0};
     
     
     bool add_page(header const& last_header) {
       if(pages_count_ == max_pages_)
         return false;      
-      auto storage = std::make_unique<cellarium::storage>();
+      auto storage = std::make_unique<storage_type>();
       path_type const path = file_manager_.name_for_page(pages_count_);
       std::error_code ec;
       header new_page_header{header::with_page_number(last_header, pages_count_)};
       if(!storage->create(path, new_page_header, ec))
         return false;
       pages_[pages_count_] = std::move(storage);
-      last_page_ = std::to_address(pages_[pages_count_]);
+      last_page_ = pages_[pages_count_].get();
       last_page_base_ = page_capacity_ * pages_count_;
       ++pages_count_;
       return true;
@@ -0,0 +1,120 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstddef>
+#include <vector>
+
+#include "occupancy_map.hpp"
+#include "storage.hpp"
+#include "paged_storage.hpp"
+#include "sharded_storage.hpp"
+#include "thread_pool.hpp"
+
+
+namespace cellarium {
+
+
+  // Slots are handed to workers in morsels of whole occupancy words, so
+  // workers never share a word of the map
+  constexpr occupancy_map::size_type morsel_words = 16;
+
+
+  namespace detail {
+
+    template<typename T> std::size_t pages_of(storage<T> const&) noexcept { return 1; }
+    template<typename T> storage<T>& page_of(storage<T>& s, std::size_t) noexcept { return s; }
+    template<typename T> storage<T> const& page_of(storage<T> const& s, std::size_t) noexcept { return s; }
+
+    template<typename T> std::size_t pages_of(paged_storage<T> const& s) noexcept { return s.pages_count(); }
+    template<typename T> storage<T>& page_of(paged_storage<T>& s, std::size_t n) noexcept { return s.page(n); }
+    template<typename T> storage<T> const& page_of(paged_storage<T> const& s, std::size_t n) noexcept { return s.page(n); }
+
+    template<typename T> std::size_t pages_of(sharded_storage<T> const& s) noexcept { return s.shards_count(); }
+    template<typename T> storage<T>& page_of(sharded_storage<T>& s, std::size_t n) noexcept { return s.shard(n); }
+    template<typename T> storage<T> const& page_of(sharded_storage<T> const& s, std::size_t n) noexcept { return s.shard(n); }
+
+
+    template<typename T> std::size_t morsels_of(storage<T> const& page) noexcept {
+      return (page.occupancy().words_count() + morsel_words - 1) / morsel_words;
+    }
+
+
+    // Calls f(worker, morsel, record) for live records of every morsel of
+    // every page; pages smaller than the largest one have empty morsels
+    template<typename S, typename F>
+    void run_morsels(thread_pool& pool, S& source, F&& f) {
+      std::size_t const pages = pages_of(source);
+      std::size_t per_page = 0;
+      for(std::size_t i = 0; i != pages; ++i)
+        if(morsels_of(page_of(source, i)) > per_page)
+          per_page = morsels_of(page_of(source, i));
+      if(per_page == 0)
+        return;
+      pool.run(pages * per_page, [&](std::size_t worker, std::size_t morsel) {
+        auto& page = page_of(source, morsel / per_page);
+        auto const words = page.occupancy().words_count();
+        auto const first = occupancy_map::size_type(morsel % per_page) * morsel_words;
+        if(first >= words)
+          return;
+        auto const last = first + morsel_words < words ? first + morsel_words : words;
+        page.occupancy().for_each(first, last, [&](occupancy_map::index_type i) {
+          f(worker, page[i]);
+        });
+      });
+    }
+
+
+    template<typename R> struct alignas(64) padded {
+      R value;
+    }; // padded
+
+  } // detail
+
+
+  // Same as for_each of storage, paged_storage or sharded_storage, but records are visited by
+  // all workers of the pool in no particular order
+  template<typename S, typename F>
+  void parallel_for_each(thread_pool& pool, S& source, F&& f) {
+    detail::run_morsels(pool, source, [&](std::size_t, auto& record) { f(record); });
+  }
+
+
+  // Every worker folds records into its own copy of identity with
+  // fold(R&, record), then copies are merged in worker order with
+  // merge(R&, R const&). Throws std::bad_alloc
+  template<typename S, typename R, typename Fold, typename Merge>
+  R parallel_reduce(thread_pool& pool, S& source, R const& identity, Fold&& fold, Merge&& merge) {
+    std::vector<detail::padded<R>> partial(pool.size(), detail::padded<R>{identity});
+    detail::run_morsels(pool, source, [&](std::size_t worker, auto& record) {
+      fold(partial[worker].value, record);
+    });
+    R result{identity};
+    for(auto const& each: partial)
+      merge(result, each.value);
+    return result;
+  }
+
+
+} // cellarium
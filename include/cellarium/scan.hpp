@@ -0,0 +1,549 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include "field.hpp"
+#include "occupancy_map.hpp"
+#include "simd.hpp"
+#include "storage.hpp"
+#include "paged_storage.hpp"
+#include "columnar_storage.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  enum class comparison {
+    equal, not_equal, less, less_equal, greater, greater_equal, between, in
+  }; // comparison
+
+
+  // Comparison of a scalar numeric field against constants converted to
+  // the field kind
+  class predicate {
+  public:
+
+    using size_type = field::size_type;
+
+
+    template<typename V> static predicate equal(field const& f, V value) {
+      return predicate{f, comparison::equal, {value}};
+    }
+
+
+    template<typename V> static predicate not_equal(field const& f, V value) {
+      return predicate{f, comparison::not_equal, {value}};
+    }
+
+
+    template<typename V> static predicate less(field const& f, V value) {
+      return predicate{f, comparison::less, {value}};
+    }
+
+
+    template<typename V> static predicate less_equal(field const& f, V value) {
+      return predicate{f, comparison::less_equal, {value}};
+    }
+
+
+    template<typename V> static predicate greater(field const& f, V value) {
+      return predicate{f, comparison::greater, {value}};
+    }
+
+
+    template<typename V> static predicate greater_equal(field const& f, V value) {
+      return predicate{f, comparison::greater_equal, {value}};
+    }
+
+
+    // Inclusive range [low, high]
+    template<typename V> static predicate between(field const& f, V low, V high) {
+      return predicate{f, comparison::between, {low, high}};
+    }
+
+
+    template<typename V> static predicate in(field const& f, std::initializer_list<V> values) {
+      return predicate{f, comparison::in, values};
+    }
+
+
+    template<typename V> static predicate in(field const& f, std::vector<V> const& values) {
+      return predicate{f, comparison::in, values};
+    }
+
+
+    predicate(predicate const&) = default;
+    predicate& operator = (predicate const&) = default;
+    predicate(predicate&&) noexcept = default;
+    predicate& operator = (predicate&&) noexcept = default;
+    field_kind kind() const noexcept { return kind_; }
+    comparison op() const noexcept { return op_; }
+    size_type offset() const noexcept { return offset_; }
+    size_type field_size() const noexcept { return field_size_; }
+    std::size_t operands_count() const noexcept { return operands_.size(); }
+
+
+    bool scalar() const noexcept {
+      return field_capacity_ == 1;
+    }
+
+
+    template<typename V> V operand(std::size_t n) const noexcept {
+      V value;
+      std::memcpy(&value, &operands_[n], sizeof(V));
+      return value;
+    }
+
+
+  private:
+
+    field_kind kind_;
+    comparison op_;
+    size_type offset_;
+    size_type field_size_;
+    size_type field_capacity_;
+    std::vector<std::uint64_t> operands_;
+
+
+    template<typename C>
+    predicate(field const& f, comparison op, C const& values):
+      kind_{f.kind()}, op_{op}, offset_{f.offset()},
+      field_size_{f.size_of()}, field_capacity_{f.capacity()} {
+      operands_.reserve(values.size());
+      for(auto const& each: values)
+        operands_.push_back(convert(each));
+    }
+
+
+    template<typename V>
+    predicate(field const& f, comparison op, std::initializer_list<V> values):
+      predicate{f, op, std::vector<V>(values)}
+    { }
+
+
+    template<typename V> std::uint64_t convert(V value) const noexcept {
+      static_assert(std::is_arithmetic_v<V>, "Only arithmetic constants can be compared");
+      switch(kind_) {
+        case field_kind::byte: return pack(static_cast<for_kind<field_kind::byte>::type>(value));
+        case field_kind::i16:  return pack(static_cast<for_kind<field_kind::i16>::type>(value));
+        case field_kind::u16:  return pack(static_cast<for_kind<field_kind::u16>::type>(value));
+        case field_kind::i32:  return pack(static_cast<for_kind<field_kind::i32>::type>(value));
+        case field_kind::u32:  return pack(static_cast<for_kind<field_kind::u32>::type>(value));
+        case field_kind::i64:  return pack(static_cast<for_kind<field_kind::i64>::type>(value));
+        case field_kind::u64:  return pack(static_cast<for_kind<field_kind::u64>::type>(value));
+        case field_kind::f32:  return pack(static_cast<for_kind<field_kind::f32>::type>(value));
+        case field_kind::f64:  return pack(static_cast<for_kind<field_kind::f64>::type>(value));
+        default:               return 0;
+      }
+    }
+
+
+    template<typename V> static std::uint64_t pack(V value) noexcept {
+      std::uint64_t packed = 0;
+      std::memcpy(&packed, &value, sizeof(V));
+      return packed;
+    }
+
+  }; // predicate
+
+
+  // Bit per slot of a scanned storage; slots of paged storage are numbered
+  // the same way as paged_storage indices
+  class selection {
+  public:
+
+    using word_type = occupancy_map::word_type;
+    using size_type = occupancy_map::size_type;
+    using index_type = occupancy_map::index_type;
+
+
+    selection() noexcept = default;
+    selection(selection const&) = default;
+    selection& operator = (selection const&) = default;
+    selection(selection&&) noexcept = default;
+    selection& operator = (selection&&) noexcept = default;
+    size_type capacity() const noexcept { return capacity_; }
+    word_type* data() noexcept { return words_.data(); }
+    word_type const* data() const noexcept { return words_.data(); }
+
+
+    // Throws std::bad_alloc
+    void reset(size_type capacity) {
+      words_.assign(occupancy_map::words_for(capacity), 0);
+      capacity_ = capacity;
+    }
+
+
+    bool test(index_type index) const noexcept {
+      return view().test(index);
+    }
+
+
+    size_type count() const noexcept {
+      return occupancy_map::count(words_.data(), size_type(words_.size()));
+    }
+
+
+    template<typename F> void for_each(F&& f) const {
+      view().for_each(std::forward<F>(f));
+    }
+
+
+    // Throws std::bad_alloc
+    std::vector<index_type> indices() const {
+      std::vector<index_type> result;
+      result.reserve(count());
+      for_each([&](index_type index) { result.push_back(index); });
+      return result;
+    }
+
+
+    // Both selections have to come from the same storage
+    void intersect(selection const& other) noexcept {
+      for(std::size_t i = 0; i != words_.size() && i != other.words_.size(); ++i)
+        words_[i] &= other.words_[i];
+    }
+
+
+    void unite(selection const& other) noexcept {
+      for(std::size_t i = 0; i != words_.size() && i != other.words_.size(); ++i)
+        words_[i] |= other.words_[i];
+    }
+
+
+  private:
+
+    std::vector<word_type> words_;
+    size_type capacity_{0};
+
+
+    occupancy_map view() const noexcept {
+      return occupancy_map{const_cast<word_type*>(words_.data()), capacity_};
+    }
+
+  }; // selection
+
+
+  namespace detail {
+
+#if defined(__AVX2__)
+
+    // Full block of 64 slots; contiguous values are loaded, strided ones
+    // gathered
+    template<typename V, typename F>
+    std::uint64_t match_lanes(char const* p, std::size_t stride, F const& matches) noexcept {
+      using L = lanes<V>;
+      std::uint64_t m = 0;
+      if(stride == sizeof(V)) {
+        for(unsigned j = 0; j != 64; j += L::count)
+          m |= std::uint64_t(L::mask(matches(L::load(p + j * sizeof(V))))) << j;
+      } else {
+        auto const s = std::int32_t(stride);
+        for(unsigned j = 0; j != 64; j += L::count)
+          m |= std::uint64_t(L::mask(matches(L::gather(p + j * stride, s)))) << j;
+      }
+      return m;
+    }
+
+#endif // __AVX2__
+
+
+    template<typename V, typename F>
+    std::uint64_t match_values(char const* p, std::size_t stride, unsigned n, F const& matches) noexcept {
+      std::uint64_t m = 0;
+      for(unsigned j = 0; j != n; ++j) {
+        V value;
+        std::memcpy(&value, p + j * stride, sizeof(V));
+        m |= std::uint64_t(matches(value)) << j;
+      }
+      return m;
+    }
+
+
+    // Calls sink(word_index, matched_bits) for every non-empty occupancy word
+    template<typename V, typename Sink>
+    void scan_values(char const* base, std::size_t stride, occupancy_map const& occupancy,
+                     predicate const& p, Sink&& sink) {
+
+      V const a = p.operand<V>(0);
+      V const b = p.operands_count() > 1 ? p.operand<V>(1) : a;
+      std::vector<V> set;
+      if(p.op() == comparison::in)
+        for(std::size_t i = 0; i != p.operands_count(); ++i)
+          set.push_back(p.operand<V>(i));
+
+      auto const run = [&](auto const& scalar, auto const& vector) {
+        occupancy_map::size_type const words = occupancy.words_count();
+        for(occupancy_map::size_type w = 0; w != words; ++w) {
+          std::uint64_t const occupied = occupancy.word(w);
+          if(occupied == 0)
+            continue;
+          std::size_t const first = std::size_t(w) * occupancy_map::bits_per_word;
+          char const* const block = base + first * stride;
+          auto const left = occupancy.capacity() - first;
+          unsigned const n = left < 64 ? unsigned(left) : 64u;
+#if defined(__AVX2__)
+          if constexpr(lanes<V>::available)
+            if(n == 64) {
+              sink(w, match_lanes<V>(block, stride, vector) & occupied);
+              continue;
+            }
+#else
+          (void)vector;
+#endif
+          sink(w, match_values<V>(block, stride, n, scalar) & occupied);
+        }
+      };
+
+#if defined(__AVX2__)
+      if constexpr(lanes<V>::available) {
+        using L = lanes<V>;
+        auto const va = L::set1(a);
+        auto const vb = L::set1(b);
+        switch(p.op()) {
+          case comparison::equal:
+            return run([a](V v) { return v == a; }, [va](auto v) { return L::eq(v, va); });
+          case comparison::not_equal:
+            return run([a](V v) { return v != a; }, [va](auto v) { return L::negate(L::eq(v, va)); });
+          case comparison::less:
+            return run([a](V v) { return v < a; }, [va](auto v) { return L::lt(v, va); });
+          case comparison::less_equal:
+            return run([a](V v) { return v <= a; }, [va](auto v) { return L::le(v, va); });
+          case comparison::greater:
+            return run([a](V v) { return v > a; }, [va](auto v) { return L::lt(va, v); });
+          case comparison::greater_equal:
+            return run([a](V v) { return v >= a; }, [va](auto v) { return L::le(va, v); });
+          case comparison::between:
+            return run([a, b](V v) { return a <= v && v <= b; },
+                       [va, vb](auto v) { return L::both(L::le(va, v), L::le(v, vb)); });
+          case comparison::in:
+            return run([&set](V v) {
+                         for(V each: set)
+                           if(v == each)
+                             return true;
+                         return false;
+                       },
+                       [&set](auto v) {
+                         auto r = L::none();
+                         for(V each: set)
+                           r = L::either(r, L::eq(v, L::set1(each)));
+                         return r;
+                       });
+        }
+        return;
+      } else
+#endif
+      {
+        auto const none = [](auto) { return 0; };
+        switch(p.op()) {
+          case comparison::equal:
+            return run([a](V v) { return v == a; }, none);
+          case comparison::not_equal:
+            return run([a](V v) { return v != a; }, none);
+          case comparison::less:
+            return run([a](V v) { return v < a; }, none);
+          case comparison::less_equal:
+            return run([a](V v) { return v <= a; }, none);
+          case comparison::greater:
+            return run([a](V v) { return v > a; }, none);
+          case comparison::greater_equal:
+            return run([a](V v) { return v >= a; }, none);
+          case comparison::between:
+            return run([a, b](V v) { return a <= v && v <= b; }, none);
+          case comparison::in:
+            return run([&set](V v) {
+                         for(V each: set)
+                           if(v == each)
+                             return true;
+                         return false;
+                       }, none);
+        }
+      }
+    }
+
+
+    template<typename Sink>
+    bool scan_field(char const* base, std::size_t stride, occupancy_map const& occupancy,
+                    predicate const& p, Sink&& sink, std::error_code& ec) {
+
+      if(!p.scalar() || p.operands_count() == 0)
+        return (ec = std::error_code{error::unsupported_field_kind}), false;
+
+      switch(p.kind()) {
+        case field_kind::byte:
+          scan_values<for_kind<field_kind::byte>::type>(base, stride, occupancy, p, sink);
+          return true;
+        case field_kind::i16:
+          scan_values<for_kind<field_kind::i16>::type>(base, stride, occupancy, p, sink);
+          return true;
+        case field_kind::u16:
+          scan_values<for_kind<field_kind::u16>::type>(base, stride, occupancy, p, sink);
+          return true;
+        case field_kind::i32:
+          scan_values<for_kind<field_kind::i32>::type>(base, stride, occupancy, p, sink);
+          return true;
+        case field_kind::u32:
+          scan_values<for_kind<field_kind::u32>::type>(base, stride, occupancy, p, sink);
+          return true;
+        case field_kind::i64:
+          scan_values<for_kind<field_kind::i64>::type>(base, stride, occupancy, p, sink);
+          return true;
+        case field_kind::u64:
+          scan_values<for_kind<field_kind::u64>::type>(base, stride, occupancy, p, sink);
+          return true;
+        case field_kind::f32:
+          scan_values<for_kind<field_kind::f32>::type>(base, stride, occupancy, p, sink);
+          return true;
+        case field_kind::f64:
+          scan_values<for_kind<field_kind::f64>::type>(base, stride, occupancy, p, sink);
+          return true;
+        default:
+          return (ec = std::error_code{error::unsupported_field_kind}), false;
+      }
+    }
+
+
+    // Predicate of a field lying within records of the header, as fits of
+    // aggregate.hpp
+    inline bool fits(header const& h, predicate const& p, std::error_code& ec) noexcept {
+      if(p.offset() + p.field_size() > h.data_size())
+        return (ec = std::error_code{error::invalid_specified_header}), false;
+      return true;
+    }
+
+
+    template<typename T>
+    bool find_column(columnar_storage<T> const& source, predicate const& p,
+                     field::size_type& column) noexcept {
+      header const& h = *source.header();
+      for(field::size_type i = 0; i != h.fields_count(); ++i)
+        if(h.field_at(i).offset() == p.offset() && h.field_at(i).kind() == p.kind()) {
+          column = i;
+          return true;
+        }
+      return false;
+    }
+
+  } // detail
+
+
+  template<typename T>
+  bool scan(storage<T> const& source, predicate const& p, selection& result, std::error_code& ec) {
+    if(!detail::fits(*source.header(), p, ec))
+      return false;
+    try {
+      result.reset(source.header()->capacity());
+    } catch(std::bad_alloc const&) {
+      return (ec = std::error_code{error::not_enough_memory}), false;
+    }
+    auto const words = result.data();
+    return detail::scan_field(source.data() + p.offset(), storage<T>::record_size,
+                              source.occupancy(), p,
+                              [words](occupancy_map::size_type w, std::uint64_t m) { words[w] = m; },
+                              ec);
+  }
+
+
+  template<typename T>
+  bool scan(paged_storage<T> const& source, predicate const& p, selection& result, std::error_code& ec) {
+    using size_type = typename paged_storage<T>::size_type;
+    if(!detail::fits(*source.page(0).header(), p, ec))
+      return false;
+    try {
+      result.reset(source.pages_count() * source.page_capacity());
+    } catch(std::bad_alloc const&) {
+      return (ec = std::error_code{error::not_enough_memory}), false;
+    }
+    auto const words = result.data();
+    for(size_type n = 0; n != source.pages_count(); ++n) {
+      auto const& page = source.page(n);
+      std::size_t const first = std::size_t(n) * source.page_capacity();
+      bool const scanned = detail::scan_field(
+            page.data() + p.offset(), storage<T>::record_size, page.occupancy(), p,
+            [words, first](occupancy_map::size_type w, std::uint64_t m) {
+              std::size_t const bit = first + std::size_t(w) * occupancy_map::bits_per_word;
+              if(bit % occupancy_map::bits_per_word == 0) {
+                words[bit / occupancy_map::bits_per_word] = m;
+                return;
+              }
+              for(; m != 0; m &= m - 1) {
+                std::size_t const each = bit + detail::count_trailing_zeros(m);
+                words[each / occupancy_map::bits_per_word] |=
+                    std::uint64_t(1) << (each % occupancy_map::bits_per_word);
+              }
+            },
+            ec);
+      if(!scanned)
+        return false;
+    }
+    return true;
+  }
+
+
+  template<typename T>
+  bool scan(columnar_storage<T> const& source, predicate const& p, selection& result, std::error_code& ec) {
+    if(!detail::fits(*source.header(), p, ec))
+      return false;
+    field::size_type column;
+    if(!detail::find_column(source, p, column))
+      return (ec = std::error_code{error::invalid_specified_header}), false;
+    try {
+      result.reset(source.header()->capacity());
+    } catch(std::bad_alloc const&) {
+      return (ec = std::error_code{error::not_enough_memory}), false;
+    }
+    auto const words = result.data();
+    return detail::scan_field(source.column_data(column), p.field_size(), source.occupancy(), p,
+                              [words](occupancy_map::size_type w, std::uint64_t m) { words[w] = m; },
+                              ec);
+  }
+
+
+  // Indices of live records matching the predicate, in ascending order
+  template<typename S>
+  bool select(S const& source, predicate const& p, std::vector<typename S::index_type>& indices,
+              std::error_code& ec) {
+    selection matched;
+    if(!scan(source, p, matched, ec))
+      return false;
+    try {
+      indices = matched.indices();
+      return true;
+    } catch(std::bad_alloc const&) {
+      return (ec = std::error_code{error::not_enough_memory}), false;
+    }
+  }
+
+
+} // cellarium
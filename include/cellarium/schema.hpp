@@ -26,6 +26,7 @@
 #include <cstdint>
 #include <tuple>
 #include <array>
+#include <type_traits>
 #include "field.hpp"
 
 
@@ -35,9 +36,13 @@ namespace cellarium {
   
   namespace detail {
         
+    template<typename T> struct unsupported_field_type: std::false_type { };
+    
+    
     template<typename T> struct describer {
       static field from_type(char const*, char const*) noexcept {
-        static_assert(false, "Unsupported field type");
+        static_assert(unsupported_field_type<T>::value, "Unsupported field type");
+        return field{};
       }
     };
     
@@ -280,11 +285,11 @@ namespace cellarium {
     static constexpr std::size_t fields_count = 1 + sizeof...(Tn);
     
     using tuple = std::tuple<T1, Tn...>;
-    using fields = std::array<field, fields_count>;
+    using fields = std::array<cellarium::field, fields_count>;
     using annotations = std::array<annotation, fields_count>;
 
     template<std::size_t I> static constexpr std::size_t field_size =
-        sizeof(std::tuple_element<I, tuple>::type);
+        sizeof(typename std::tuple_element<I, tuple>::type);
 
     static fields describe(annotations const& as) {
       fields fields;
@@ -315,10 +320,19 @@ namespace cellarium {
     template<std::size_t I, typename V1, typename... Vn>
     static void describe_types(fields& fs, annotations const& as) noexcept {
       fs[I] = detail::describer<V1>::from_type(as[I].title, as[I].description);
+      fs[I].offset(offset_of<I>());
       describe_types<I + 1, Vn...>(fs, as);
     }
     
     
+    template<std::size_t I>
+    static cellarium::field::size_type offset_of() noexcept {
+      schema const sample;
+      return cellarium::field::size_type(reinterpret_cast<char const*>(&std::get<I>(sample))
+                                         - reinterpret_cast<char const*>(&sample));
+    }
+    
+    
     template<std::size_t I>
     static void describe_types(fields&, annotations const&) noexcept {
     }
@@ -0,0 +1,174 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <system_error>
+
+#include "file.hpp"
+#include "mapped_file.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  // Sequence counters shared by a writer and readers in other processes
+  // through a small mapped file. Slots are striped by occupancy word, so a
+  // stripe covers 64 consecutive slots together with their occupancy bits;
+  // the generation counter is odd while the writer moves the mapping.
+  // Counters are lock-free atomics, which are address free, so every
+  // process may map them at its own address
+  class seqlock_table {
+  public:
+
+    using path_type = std::filesystem::path;
+    using index_type = std::uint32_t;
+    using sequence_type = std::uint32_t;
+    using generation_type = std::uint64_t;
+
+    static constexpr std::size_t stripes_count = 1 << 14;
+    static constexpr std::size_t slots_per_stripe = 64;
+    static constexpr std::size_t stripes_offset = 64;
+    static constexpr std::size_t file_size = stripes_offset + stripes_count * sizeof(sequence_type);
+
+    static_assert(std::atomic<sequence_type>::is_always_lock_free, "Counters have to be lock-free");
+    static_assert(std::atomic<generation_type>::is_always_lock_free, "Counters have to be lock-free");
+
+
+    seqlock_table() noexcept = default;
+    seqlock_table(seqlock_table const&) = delete;
+    seqlock_table& operator = (seqlock_table const&) = delete;
+    explicit operator bool () const noexcept { return stripes_ != nullptr; }
+
+
+    // Writer maps existing counters or creates zero ones, readers only map
+    // existing ones
+    bool open(path_type const& path, bool create, std::error_code& ec) noexcept {
+      close();
+      bool const exists = std::filesystem::exists(path, ec);
+      if(!!ec)
+        return false;
+      if(!exists) {
+        if(!create)
+          return (ec = std::error_code{error::storage_not_found_to_open}), false;
+        auto f = file::create(path);
+        if(!f || !f.resize(file::size_type(file_size)))
+          return (ec = file::last_error()), false;
+      }
+      auto const size = std::filesystem::file_size(path, ec);
+      if(!!ec)
+        return false;
+      if(size != file_size)
+        return (ec = std::error_code{error::invalid_file_size}), false;
+
+      mapped_file_ = mapped_file::open(path);
+      if(!mapped_file_)
+        return (ec = mapped_file::last_error()), false;
+      region_ = mapped_file_.map();
+      if(region_.address == nullptr)
+        return (ec = mapped_file::last_error()), (mapped_file_ = mapped_file{}), false;
+
+      generation_ = reinterpret_cast<std::atomic<generation_type>*>(region_.address);
+      stripes_ = reinterpret_cast<std::atomic<sequence_type>*>(region_.address + stripes_offset);
+      return true;
+    }
+
+
+    void close() noexcept {
+      generation_ = nullptr;
+      stripes_ = nullptr;
+      region_ = mapped_file::region{};
+      mapped_file_ = mapped_file{};
+    }
+
+
+    // Writer brackets every change of a slot, stores in between are not
+    // visible to readers before the counter turns odd
+    void begin_write(index_type index) noexcept {
+      auto& stripe = stripe_of(index);
+      stripe.store(stripe.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+
+
+    void end_write(index_type index) noexcept {
+      auto& stripe = stripe_of(index);
+      stripe.store(stripe.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+
+    void begin_remap() noexcept {
+      generation_->store(generation_->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+
+
+    void end_remap() noexcept {
+      generation_->store(generation_->load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+
+    generation_type generation() const noexcept {
+      return generation_->load(std::memory_order_acquire);
+    }
+
+
+    // Reader waits out a write in progress and returns the sequence to
+    // validate against
+    sequence_type read_begin(index_type index) const noexcept {
+      for(;;) {
+        sequence_type const sequence = stripe_of(index).load(std::memory_order_acquire);
+        if((sequence & 1) == 0)
+          return sequence;
+      }
+    }
+
+
+    // True when nothing was written to the stripe since read_begin
+    bool read_validate(index_type index, sequence_type sequence) const noexcept {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return stripe_of(index).load(std::memory_order_relaxed) == sequence;
+    }
+
+
+  private:
+
+    mapped_file mapped_file_;
+    mapped_file::region region_;
+    std::atomic<generation_type>* generation_{nullptr};
+    std::atomic<sequence_type>* stripes_{nullptr};
+
+
+    std::atomic<sequence_type>& stripe_of(index_type index) const noexcept {
+      return stripes_[index / slots_per_stripe % stripes_count];
+    }
+
+  }; // seqlock_table
+
+
+} // cellarium
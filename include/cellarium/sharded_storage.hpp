@@ -0,0 +1,238 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <system_error>
+#include <type_traits>
+
+#include "storage.hpp"
+#include "file_manager.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  // Independent storages, one per writing thread, in files named as pages
+  // of paged storage. High bits of an index hold its shard, low bits the
+  // slot within it. A writing thread owns a shard from acquire_shard till
+  // release_shard and needs no synchronization at all; when every shard is
+  // owned acquire_shard fails instead of sharing one. Removing a record of
+  // another shard has to be serialized with its owner. Scans of
+  // parallel.hpp run over all shards
+  template<typename T>
+  class sharded_storage {
+  public:
+
+    static_assert(std::is_trivial_v<T>, "Only trivial types can be stored");
+
+    using path_type = std::filesystem::path;
+    using storage_type = storage<T>;
+    using value_type = T;
+    using size_type = typename storage_type::size_type;
+    using index_type = typename storage_type::index_type;
+
+    static constexpr index_type no_index = storage_type::no_index;
+    static constexpr size_type max_shards = 256;
+    static constexpr size_type no_shard = max_shards;
+
+
+    sharded_storage() noexcept = default;
+    ~sharded_storage() { close(); }
+    sharded_storage(sharded_storage const&) = delete;
+    sharded_storage& operator = (sharded_storage const&) = delete;
+    explicit operator bool () const noexcept { return shards_count_ != 0; }
+    size_type shards_count() const noexcept { return shards_count_; }
+    storage_type const& shard(size_type n) const noexcept { return shards_[n]; }
+    storage_type& shard(size_type n) noexcept { return shards_[n]; }
+
+
+    static constexpr size_type shard_of(index_type index, size_type bits) noexcept {
+      return bits == 0 ? 0 : size_type(index >> (32 - bits));
+    }
+
+
+    size_type shard_of(index_type index) const noexcept { return shard_of(index, shard_bits_); }
+    index_type slot_of(index_type index) const noexcept { return index & slot_mask_; }
+
+
+    index_type index_of(size_type shard, index_type slot) const noexcept {
+      return shard_bits_ == 0 ? slot : index_type(shard) << (32 - shard_bits_) | slot;
+    }
+
+
+    // Throws std::bad_alloc
+    bool create(path_type const& path, size_type shards, class header const& specified, std::error_code& ec) {
+      close();
+      if(shards == 0 || shards > max_shards)
+        return (ec = std::error_code{error::invalid_specified_header}), false;
+      file_manager_ = file_manager{path};
+      if(!file_manager_.remove_all(ec))
+        return false;
+      if(!bind(shards, specified.capacity(), ec))
+        return false;
+      for(size_type i = 0; i != shards; ++i)
+        if(!shards_[i].create(file_manager_.name_for_page(i), specified, ec))
+          return close(), false;
+      return true;
+    }
+
+
+    // Shards are the files found. Throws std::bad_alloc
+    bool open(path_type const& path, class header const& specified, std::error_code& ec) {
+      close();
+      file_manager_ = file_manager{path};
+      auto const files = file_manager_.list(ec);
+      if(!!ec)
+        return false;
+      if(files.empty())
+        return (ec = std::error_code{error::storage_not_found_to_open}), false;
+      if(files.size() > max_shards)
+        return (ec = std::error_code{error::merging_incompatible_storages}), false;
+      if(!bind(size_type(files.size()), specified.capacity(), ec))
+        return false;
+      for(size_type i = 0; i != shards_count_; ++i) {
+        if(!shards_[i].open(files[i], specified, ec))
+          return close(), false;
+        if(shards_[i].header()->capacity() >= slot_mask_)
+          return (ec = std::error_code{error::merging_incompatible_storages}), close(), false;
+      }
+      return true;
+    }
+
+
+    void close() noexcept {
+      shards_.reset();
+      owned_.reset();
+      shards_count_ = 0;
+      shard_bits_ = 0;
+      slot_mask_ = 0;
+      file_manager_ = file_manager{};
+    }
+
+
+    size_type size() const noexcept {
+      size_type n = 0;
+      for(size_type i = 0; i != shards_count_; ++i)
+        n += shards_[i].size();
+      return n;
+    }
+
+
+    // Same for every shard; growth stops at the slots an index can hold
+    void growth_factor(size_type factor) noexcept {
+      for(size_type i = 0; i != shards_count_; ++i)
+        shards_[i].growth_factor(factor);
+    }
+
+
+    // Shard owned by the calling thread till released, no_shard if every
+    // shard is owned already
+    size_type acquire_shard() noexcept {
+      for(size_type i = 0; i != shards_count_; ++i)
+        if(!owned_[i].load(std::memory_order_relaxed)
+           && !owned_[i].exchange(true, std::memory_order_acquire))
+          return i;
+      return no_shard;
+    }
+
+
+    void release_shard(size_type shard) noexcept {
+      owned_[shard].store(false, std::memory_order_release);
+    }
+
+
+    // Shard has to be owned by the calling thread
+    index_type try_insert(size_type shard, T const& data) noexcept {
+      storage_type& target = shards_[shard];
+      index_type const slot = target.try_insert(data);
+      if(slot == no_index)
+        return no_index;
+      if(slot >= slot_mask_)
+        return target.remove(slot), no_index;
+      return index_of(shard, slot);
+    }
+
+
+    void remove(index_type index) noexcept {
+      shards_[shard_of(index)].remove(slot_of(index));
+    }
+
+
+    T const& operator [](index_type index) const noexcept {
+      return static_cast<storage_type const&>(shards_[shard_of(index)])[slot_of(index)];
+    }
+
+
+    T& operator [](index_type index) noexcept {
+      return shards_[shard_of(index)][slot_of(index)];
+    }
+
+
+    template<typename F> void for_each(F&& f) {
+      for(size_type i = 0; i != shards_count_; ++i)
+        shards_[i].for_each(f);
+    }
+
+
+    template<typename F> void for_each(F&& f) const {
+      for(size_type i = 0; i != shards_count_; ++i)
+        static_cast<storage_type const&>(shards_[i]).for_each(f);
+    }
+
+
+  private:
+
+    file_manager file_manager_;
+    std::unique_ptr<storage_type[]> shards_;
+    std::unique_ptr<std::atomic<bool>[]> owned_;
+    size_type shards_count_{0};
+    size_type shard_bits_{0};
+    index_type slot_mask_{0};
+
+
+    bool bind(size_type shards, size_type capacity, std::error_code& ec) {
+      size_type bits = 0;
+      while((size_type(1) << bits) < shards)
+        ++bits;
+      index_type const mask = bits == 0 ? no_index : index_type((std::uint64_t(1) << (32 - bits)) - 1);
+      // All ones of the last slot of the last shard would read as no_index
+      if(capacity >= mask)
+        return (ec = std::error_code{error::invalid_specified_header}), false;
+      shards_ = std::make_unique<storage_type[]>(shards);
+      owned_ = std::make_unique<std::atomic<bool>[]>(shards);
+      shards_count_ = shards;
+      shard_bits_ = bits;
+      slot_mask_ = mask;
+      return true;
+    }
+
+  }; // sharded_storage
+
+
+} // cellarium
@@ -0,0 +1,279 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+
+namespace cellarium {
+
+
+  namespace detail {
+
+    // Eight or four AVX2 lanes of a field value; available is false without
+    // AVX2 and for byte, i16 and u16, callers fall back to scalar loops then.
+    // Gathers use the masked form with a zero source, so no lane is ever
+    // read uninitialized
+    template<typename V> struct lanes { static constexpr bool available = false; };
+
+#if defined(__AVX2__)
+
+    // Unsigned lanes are biased by the sign bit so signed compares order them
+    template<typename V, bool Biased> struct lanes32 {
+      static constexpr bool available = true;
+      static constexpr unsigned count = 8;
+      using reg = __m256i;
+
+      static reg bias(reg v) noexcept {
+        if constexpr(Biased)
+          return _mm256_xor_si256(v, _mm256_set1_epi32(std::int32_t(0x80000000u)));
+        else
+          return v;
+      }
+
+      static reg set1(V v) noexcept { return bias(_mm256_set1_epi32(std::int32_t(v))); }
+      static reg load(char const* p) noexcept { return bias(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(p))); }
+
+      static reg gather(char const* p, std::int32_t stride) noexcept {
+        __m256i const offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                                   _mm256_set1_epi32(stride));
+        return bias(_mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<int const*>(p),
+                                                offsets, _mm256_set1_epi32(-1), 1));
+      }
+
+      static reg eq(reg a, reg b) noexcept { return _mm256_cmpeq_epi32(a, b); }
+      static reg lt(reg a, reg b) noexcept { return _mm256_cmpgt_epi32(b, a); }
+      static reg le(reg a, reg b) noexcept { return negate(lt(b, a)); }
+      static reg negate(reg a) noexcept { return _mm256_xor_si256(a, _mm256_set1_epi32(-1)); }
+      static reg both(reg a, reg b) noexcept { return _mm256_and_si256(a, b); }
+      static reg either(reg a, reg b) noexcept { return _mm256_or_si256(a, b); }
+      static reg none() noexcept { return _mm256_setzero_si256(); }
+      static unsigned mask(reg m) noexcept { return unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(m))); }
+
+      // Order is kept by bias, so min and max work on biased lanes
+      static reg min(reg a, reg b) noexcept { return _mm256_min_epi32(a, b); }
+      static reg max(reg a, reg b) noexcept { return _mm256_max_epi32(a, b); }
+      static void store(V* out, reg v) noexcept { _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), bias(v)); }
+
+      // Sums are accumulated in four 64-bit lanes
+      using wide = __m256i;
+      using wide_value = std::conditional_t<std::is_signed_v<V>, std::int64_t, std::uint64_t>;
+      static wide wide_zero() noexcept { return _mm256_setzero_si256(); }
+      static void wide_store(wide_value* out, wide v) noexcept { _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v); }
+
+      static wide add_wide(wide sum, reg v) noexcept {
+        reg const raw = bias(v);
+        __m128i const lo = _mm256_castsi256_si128(raw);
+        __m128i const hi = _mm256_extracti128_si256(raw, 1);
+        if constexpr(std::is_signed_v<V>)
+          return _mm256_add_epi64(sum, _mm256_add_epi64(_mm256_cvtepi32_epi64(lo), _mm256_cvtepi32_epi64(hi)));
+        else
+          return _mm256_add_epi64(sum, _mm256_add_epi64(_mm256_cvtepu32_epi64(lo), _mm256_cvtepu32_epi64(hi)));
+      }
+    }; // lanes32
+
+
+    template<typename V, bool Biased> struct lanes64 {
+      static constexpr bool available = true;
+      static constexpr unsigned count = 4;
+      using reg = __m256i;
+
+      static reg bias(reg v) noexcept {
+        if constexpr(Biased)
+          return _mm256_xor_si256(v, _mm256_set1_epi64x(std::int64_t(0x8000000000000000ull)));
+        else
+          return v;
+      }
+
+      static reg set1(V v) noexcept { return bias(_mm256_set1_epi64x(std::int64_t(v))); }
+      static reg load(char const* p) noexcept { return bias(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(p))); }
+
+      static reg gather(char const* p, std::int32_t stride) noexcept {
+        __m128i const offsets = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(stride));
+        return bias(_mm256_mask_i32gather_epi64(_mm256_setzero_si256(), reinterpret_cast<long long const*>(p),
+                                                offsets, _mm256_set1_epi64x(-1), 1));
+      }
+
+      static reg eq(reg a, reg b) noexcept { return _mm256_cmpeq_epi64(a, b); }
+      static reg lt(reg a, reg b) noexcept { return _mm256_cmpgt_epi64(b, a); }
+      static reg le(reg a, reg b) noexcept { return negate(lt(b, a)); }
+      static reg negate(reg a) noexcept { return _mm256_xor_si256(a, _mm256_set1_epi64x(-1)); }
+      static reg both(reg a, reg b) noexcept { return _mm256_and_si256(a, b); }
+      static reg either(reg a, reg b) noexcept { return _mm256_or_si256(a, b); }
+      static reg none() noexcept { return _mm256_setzero_si256(); }
+      static unsigned mask(reg m) noexcept { return unsigned(_mm256_movemask_pd(_mm256_castsi256_pd(m))); }
+
+      static reg min(reg a, reg b) noexcept { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)); }
+      static reg max(reg a, reg b) noexcept { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(b, a)); }
+      static void store(V* out, reg v) noexcept { _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), bias(v)); }
+
+      using wide = __m256i;
+      using wide_value = V;
+      static wide wide_zero() noexcept { return _mm256_setzero_si256(); }
+      static void wide_store(wide_value* out, wide v) noexcept { _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v); }
+      static wide add_wide(wide sum, reg v) noexcept { return _mm256_add_epi64(sum, bias(v)); }
+    }; // lanes64
+
+
+    template<> struct lanes<std::int32_t>: lanes32<std::int32_t, false> { };
+    template<> struct lanes<std::uint32_t>: lanes32<std::uint32_t, true> { };
+    template<> struct lanes<std::int64_t>: lanes64<std::int64_t, false> { };
+    template<> struct lanes<std::uint64_t>: lanes64<std::uint64_t, true> { };
+
+
+    template<> struct lanes<float> {
+      static constexpr bool available = true;
+      static constexpr unsigned count = 8;
+      using reg = __m256;
+
+      static reg set1(float v) noexcept { return _mm256_set1_ps(v); }
+      static reg load(char const* p) noexcept { return _mm256_loadu_ps(reinterpret_cast<float const*>(p)); }
+
+      static reg gather(char const* p, std::int32_t stride) noexcept {
+        __m256i const offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                                   _mm256_set1_epi32(stride));
+        return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), reinterpret_cast<float const*>(p), offsets,
+                                        _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 1);
+      }
+
+      static reg eq(reg a, reg b) noexcept { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+      static reg lt(reg a, reg b) noexcept { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+      static reg le(reg a, reg b) noexcept { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+      static reg negate(reg a) noexcept { return _mm256_xor_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(-1))); }
+      static reg both(reg a, reg b) noexcept { return _mm256_and_ps(a, b); }
+      static reg either(reg a, reg b) noexcept { return _mm256_or_ps(a, b); }
+      static reg none() noexcept { return _mm256_setzero_ps(); }
+      static unsigned mask(reg m) noexcept { return unsigned(_mm256_movemask_ps(m)); }
+
+      // Lanes of a are kept where b is NaN, as a scalar compare would;
+      // the instructions return their second operand on NaN
+      static reg min(reg a, reg b) noexcept { return _mm256_min_ps(b, a); }
+      static reg max(reg a, reg b) noexcept { return _mm256_max_ps(b, a); }
+      static void store(float* out, reg v) noexcept { _mm256_storeu_ps(out, v); }
+
+      // Sums are accumulated in doubles
+      using wide = __m256d;
+      using wide_value = double;
+      static wide wide_zero() noexcept { return _mm256_setzero_pd(); }
+      static void wide_store(double* out, wide v) noexcept { _mm256_storeu_pd(out, v); }
+
+      static wide add_wide(wide sum, reg v) noexcept {
+        return _mm256_add_pd(sum, _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)),
+                                                _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1))));
+      }
+    }; // lanes<float>
+
+
+    template<> struct lanes<double> {
+      static constexpr bool available = true;
+      static constexpr unsigned count = 4;
+      using reg = __m256d;
+
+      static reg set1(double v) noexcept { return _mm256_set1_pd(v); }
+      static reg load(char const* p) noexcept { return _mm256_loadu_pd(reinterpret_cast<double const*>(p)); }
+
+      static reg gather(char const* p, std::int32_t stride) noexcept {
+        __m128i const offsets = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(stride));
+        return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), reinterpret_cast<double const*>(p), offsets,
+                                        _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 1);
+      }
+
+      static reg eq(reg a, reg b) noexcept { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+      static reg lt(reg a, reg b) noexcept { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+      static reg le(reg a, reg b) noexcept { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+      static reg negate(reg a) noexcept { return _mm256_xor_pd(a, _mm256_castsi256_pd(_mm256_set1_epi64x(-1))); }
+      static reg both(reg a, reg b) noexcept { return _mm256_and_pd(a, b); }
+      static reg either(reg a, reg b) noexcept { return _mm256_or_pd(a, b); }
+      static reg none() noexcept { return _mm256_setzero_pd(); }
+      static unsigned mask(reg m) noexcept { return unsigned(_mm256_movemask_pd(m)); }
+
+      static reg min(reg a, reg b) noexcept { return _mm256_min_pd(b, a); }
+      static reg max(reg a, reg b) noexcept { return _mm256_max_pd(b, a); }
+      static void store(double* out, reg v) noexcept { _mm256_storeu_pd(out, v); }
+
+      using wide = __m256d;
+      using wide_value = double;
+      static wide wide_zero() noexcept { return _mm256_setzero_pd(); }
+      static void wide_store(double* out, wide v) noexcept { _mm256_storeu_pd(out, v); }
+      static wide add_wide(wide sum, reg v) noexcept { return _mm256_add_pd(sum, v); }
+    }; // lanes<double>
+
+#endif // __AVX2__
+
+
+    // Bit i is set when byte i of the sixteen at group equals value
+    inline unsigned match_bytes(unsigned char const* group, unsigned char value) noexcept {
+#if defined(__SSE2__) || defined(_M_X64)
+      __m128i const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(group));
+      return unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(char(value)))));
+#else
+      unsigned mask = 0;
+      for(unsigned i = 0; i != 16; ++i)
+        mask |= unsigned(group[i] == value) << i;
+      return mask;
+#endif
+    }
+
+
+    // Bit i is set when the high bit of byte i of the sixteen at group is
+    inline unsigned match_high_bits(unsigned char const* group) noexcept {
+#if defined(__SSE2__) || defined(_M_X64)
+      return unsigned(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(group))));
+#else
+      unsigned mask = 0;
+      for(unsigned i = 0; i != 16; ++i)
+        mask |= unsigned(group[i] >> 7) << i;
+      return mask;
+#endif
+    }
+
+
+    // Bit i is set when byte i of the sixteen at group is below value,
+    // compared as unsigned; value is not zero
+    inline unsigned match_below(unsigned char const* group, unsigned char value) noexcept {
+#if defined(__SSE2__) || defined(_M_X64)
+      __m128i const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(group));
+      __m128i const low = _mm_min_epu8(bytes, _mm_set1_epi8(char(value - 1)));
+      return unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(low, bytes)));
+#else
+      unsigned mask = 0;
+      for(unsigned i = 0; i != 16; ++i)
+        mask |= unsigned(group[i] < value) << i;
+      return mask;
+#endif
+    }
+
+  } // detail
+
+
+} // cellarium
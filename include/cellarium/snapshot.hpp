@@ -0,0 +1,354 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "header.hpp"
+#include "occupancy_map.hpp"
+
+
+namespace cellarium {
+
+
+  // Bytes of a mapped file as they were when the snapshot was taken. The
+  // owner of the mapping calls preserve before it modifies a range, which
+  // copies the original pages aside, so readers on other threads keep
+  // seeing them. Preserving is safe from several writing threads at once.
+  // Pages never modified are read from the mapping itself; before it
+  // moves or is unmapped the owner hands the snapshot another mapping of
+  // the same file with rebase, and before the file is cut it copies the
+  // pages past the cut with truncate. A page that can not be copied for
+  // lack of memory invalidates the snapshot instead of failing the
+  // writer; once cut off such a page reads as zeros
+  class page_snapshot {
+  public:
+
+    using size_type = std::size_t;
+
+
+    // Throws std::bad_alloc
+    page_snapshot(char const* base, size_type size, size_type page_size):
+      base_{base}, size_{size}, page_size_{page_size}, mapped_{size},
+      copies_{new std::atomic<char*>[(size + page_size - 1) / page_size]} {
+      for(size_type i = 0; i != pages_count(); ++i)
+        copies_[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+
+    ~page_snapshot() {
+      for(size_type i = 0; i != pages_count(); ++i)
+        delete[] copies_[i].load(std::memory_order_relaxed);
+    }
+
+
+    page_snapshot(page_snapshot const&) = delete;
+    page_snapshot& operator = (page_snapshot const&) = delete;
+    size_type size() const noexcept { return size_; }
+    char const* base() const noexcept { return base_.load(); }
+    bool valid() const noexcept { return !failed_.load(std::memory_order_acquire); }
+
+
+    void preserve(size_type offset, size_type length) noexcept {
+      if(offset >= size_)
+        return;
+      size_type const last = offset + length < size_ ? offset + length : size_;
+      for(size_type p = offset / page_size_; p * page_size_ < last; ++p)
+        preserve_page(p);
+    }
+
+
+    // Reads go to another mapping of the same file pages from now on;
+    // mapping keeps it alive till the snapshot is gone. Waits for readers
+    // of the old one to leave it
+    void rebase(char const* base, std::shared_ptr<void> mapping) noexcept {
+      base_.store(base);
+      wait_for_readers();
+      mapping_ = std::move(mapping);
+    }
+
+
+    // Copies pages holding bytes from size on, which are about to be cut
+    // off the file, and waits for readers of them to leave
+    void truncate(size_type size) noexcept {
+      if(size >= mapped_.load())
+        return;
+      for(size_type p = size / page_size_; p < pages_count(); ++p)
+        preserve_page(p);
+      mapped_.store(size);
+      wait_for_readers();
+    }
+
+
+    // Copies every page not copied yet and lets the mapping go
+    void detach() noexcept {
+      truncate(0);
+      mapping_.reset();
+    }
+
+
+    // Readers hold the snapshot locked while they read, so rebase and
+    // truncate do not pull pages from under them. Locks are shared
+    void lock() const noexcept { readers_.fetch_add(1); }
+    void unlock() const noexcept { readers_.fetch_sub(1); }
+
+
+    // Has to be called while locked
+    void read(size_type offset, void* buffer, size_type length) const noexcept {
+      char* out = static_cast<char*>(buffer);
+      while(length != 0) {
+        size_type const p = offset / page_size_;
+        size_type const at = offset % page_size_;
+        size_type const n = page_size_ - at < length ? page_size_ - at : length;
+        char const* copy = copies_[p].load();
+        if(copy == nullptr && offset >= mapped_.load()) {
+          std::memset(out, 0, n);
+        } else if(copy == nullptr) {
+          std::memcpy(out, base_.load() + offset, n);
+          // Writer copies the page before it modifies it, so bytes read
+          // while no copy is published are the original ones
+          std::atomic_thread_fence(std::memory_order_acquire);
+          copy = copies_[p].load();
+        }
+        if(copy != nullptr)
+          std::memcpy(out, copy + at, n);
+        out += n;
+        offset += n;
+        length -= n;
+      }
+    }
+
+
+  private:
+
+    std::atomic<char const*> base_;
+    size_type size_;
+    size_type page_size_;
+    std::atomic<size_type> mapped_; // bytes past it are cut off the file
+    std::unique_ptr<std::atomic<char*>[]> copies_;
+    std::shared_ptr<void> mapping_; // of its own after rebase
+    mutable std::atomic<std::size_t> readers_{0};
+    std::atomic<bool> failed_{false};
+
+
+    size_type pages_count() const noexcept { return (size_ + page_size_ - 1) / page_size_; }
+
+
+    void wait_for_readers() const noexcept {
+      while(readers_.load() != 0)
+        std::this_thread::yield();
+    }
+
+
+    // Writers of a page may preserve it at once. Each copies the page
+    // before it writes, and only the first copy is published, so a copy
+    // taken while another writer already wrote is dropped
+    void preserve_page(size_type p) noexcept {
+      size_type const first = p * page_size_;
+      if(copies_[p].load(std::memory_order_acquire) != nullptr || first >= mapped_.load())
+        return;
+      char* const copy = new(std::nothrow) char[page_size_];
+      if(copy == nullptr) {
+        failed_.store(true, std::memory_order_release);
+        return;
+      }
+      std::memcpy(copy, base_.load() + first, size_ - first < page_size_ ? size_ - first : page_size_);
+      char* expected = nullptr;
+      if(!copies_[p].compare_exchange_strong(expected, copy))
+        delete[] copy;
+      // Keeps the writer's following plain stores to the page behind the
+      // published copy on weakly ordered CPUs
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+
+  }; // page_snapshot
+
+
+  // Immutable view of storage records as they were when it was taken.
+  // Reading does not block the storage, the storage may even be closed
+  template<typename T>
+  class storage_snapshot {
+  public:
+
+    using size_type = header::size_type;
+    using index_type = header::index_type;
+    using value_type = T;
+
+
+    storage_snapshot() noexcept = default;
+
+
+    storage_snapshot(std::shared_ptr<page_snapshot> pages, size_type capacity, size_type size,
+                     std::size_t records_offset, std::size_t record_size,
+                     std::size_t occupancy_offset) noexcept:
+      pages_{std::move(pages)}, capacity_{capacity}, size_{size}, records_offset_{records_offset},
+      record_size_{record_size}, occupancy_offset_{occupancy_offset}
+    { }
+
+
+    explicit operator bool () const noexcept { return !!pages_; }
+    size_type capacity() const noexcept { return capacity_; }
+    size_type size() const noexcept { return size_; }
+    // False when the writer ran out of memory preserving pages; what was
+    // read is unreliable then
+    bool valid() const noexcept { return pages_->valid(); }
+
+
+    bool contains(index_type index) const noexcept {
+      if(index >= capacity_)
+        return false;
+      std::lock_guard<page_snapshot const> lock{*pages_};
+      return (word_at(index / occupancy_map::bits_per_word) >> (index % occupancy_map::bits_per_word) & 1) != 0;
+    }
+
+
+    T get(index_type index) const noexcept {
+      std::lock_guard<page_snapshot const> lock{*pages_};
+      return record_at(index);
+    }
+
+
+    // Calls f(index, value) for every record live at the snapshot
+    template<typename F> void for_each(F&& f) const {
+      size_type const words_count = occupancy_map::words_for(capacity_);
+      for(size_type w = 0; w != words_count; ++w) {
+        index_type indices[occupancy_map::bits_per_word];
+        T values[occupancy_map::bits_per_word];
+        size_type n = 0;
+        {
+          std::lock_guard<page_snapshot const> lock{*pages_};
+          for(occupancy_map::word_type bits = word_at(w); bits != 0; bits &= bits - 1, ++n) {
+            indices[n] = w * occupancy_map::bits_per_word + detail::count_trailing_zeros(bits);
+            values[n] = record_at(indices[n]);
+          }
+        }
+        for(size_type i = 0; i != n; ++i)
+          f(indices[i], values[i]);
+      }
+    }
+
+
+  private:
+
+    std::shared_ptr<page_snapshot> pages_;
+    size_type capacity_{0};
+    size_type size_{0};
+    std::size_t records_offset_{0};
+    std::size_t record_size_{0};
+    std::size_t occupancy_offset_{0};
+
+
+    occupancy_map::word_type word_at(size_type w) const noexcept {
+      occupancy_map::word_type word;
+      pages_->read(occupancy_offset_ + w * sizeof(word), &word, sizeof(word));
+      return word;
+    }
+
+
+    T record_at(index_type index) const noexcept {
+      T value;
+      pages_->read(records_offset_ + std::size_t(index) * record_size_, &value, sizeof(T));
+      return value;
+    }
+
+  }; // storage_snapshot
+
+
+  // Snapshot of every page of a paged storage; pages added later are not
+  // part of it
+  template<typename T>
+  class paged_snapshot {
+  public:
+
+    using size_type = header::size_type;
+    using index_type = header::index_type;
+    using value_type = T;
+
+
+    paged_snapshot() noexcept = default;
+
+
+    paged_snapshot(std::vector<storage_snapshot<T>> pages, size_type page_capacity) noexcept:
+      pages_{std::move(pages)}, page_capacity_{page_capacity}
+    { }
+
+
+    explicit operator bool () const noexcept { return !pages_.empty(); }
+    size_type pages_count() const noexcept { return size_type(pages_.size()); }
+    storage_snapshot<T> const& page(size_type n) const noexcept { return pages_[n]; }
+
+
+    size_type size() const noexcept {
+      size_type n = 0;
+      for(auto const& each: pages_)
+        n += each.size();
+      return n;
+    }
+
+
+    bool valid() const noexcept {
+      for(auto const& each: pages_)
+        if(!each.valid())
+          return false;
+      return true;
+    }
+
+
+    bool contains(index_type index) const noexcept {
+      size_type const p = index / page_capacity_;
+      return p < pages_.size() && pages_[p].contains(index % page_capacity_);
+    }
+
+
+    T get(index_type index) const noexcept {
+      return pages_[index / page_capacity_].get(index % page_capacity_);
+    }
+
+
+    // Calls f(index, value) with paged indices
+    template<typename F> void for_each(F&& f) const {
+      for(size_type p = 0; p != pages_.size(); ++p) {
+        index_type const base = p * page_capacity_;
+        pages_[p].for_each([&](index_type index, T const& value) { f(base + index, value); });
+      }
+    }
+
+
+  private:
+
+    std::vector<storage_snapshot<T>> pages_;
+    size_type page_capacity_{0};
+
+  }; // paged_snapshot
+
+
+} // cellarium
@@ -23,18 +23,28 @@
 #pragma once
 
 
+#include <atomic>
+#include <cstddef>
 #include <filesystem>
+#include <iterator>
 #include <system_error>
 #include <type_traits>
 #include <memory>
+#include <mutex>
 #include <cstring>
 #include <cstdio>
 #include <new>
+#include <vector>
 
 #include "file.hpp"
 #include "mapped_file.hpp"
 #include "header.hpp"
 #include "record.hpp"
+#include "occupancy_map.hpp"
+#include "occupancy_index.hpp"
+#include "dirty_pages.hpp"
+#include "snapshot.hpp"
+#include "seqlock.hpp"
 #include "error.hpp"
 
 
@@ -48,16 +58,17 @@ namespace cellarium {
     static_assert(std::is_trivial_v<T>, "Only trivial types can be stored");
 
     using path_type = std::filesystem::path;
-    using size_type = header::size_type;
-    using index_type = header::index_type;
+    using size_type = cellarium::header::size_type;
+    using index_type = cellarium::header::index_type;
     using value_type = T;
     
     using record_type = record<T>;
 
-    static constexpr index_type no_index = header::no_index;
+    static constexpr index_type no_index = cellarium::header::no_index;
+    static constexpr size_type max_capacity = size_type(1) << 31;
     
     
-    static bool read_info(path_type const& path, header& h, size_type& items_count, std::error_code& ec) noexcept {
+    static bool read_info(path_type const& path, cellarium::header& h, size_type& items_count, std::error_code& ec) noexcept {
 
       auto f = file::open_to_read(path);      
       if(!f)
@@ -66,29 +77,28 @@ namespace cellarium {
       if(!f.read(h))
         return (ec = file::last_error()), false;
       
-      auto const target_size = sizeof(class header) + h.capacity() * h.data_size() + h.capacity();
-      
       auto const file_size = std::filesystem::file_size(path, ec);
       if(file_size == static_cast<std::uintmax_t>(-1))
         return false;
       
-      if(file_size != target_size)
+      if(file_size != static_cast<std::uintmax_t>(storage_size(h.capacity())))
         return (ec = std::error_code{error::invalid_file_size}), false;
       
-      if(!f.seek(sizeof(class header) + h.capacity() * h.data_size()))
-        return (ec = file::last_error()), false;
+      if(h.has_valid_items_count()) {
+        items_count = h.items_count();
+        return true;
+      }
       
+      // Storage was not closed properly, so live records are recounted
       try {
-        auto occupancy_map = std::make_unique<bool[]>(h.capacity());
+        auto const words_count = occupancy_map::words_for(h.capacity());
+        auto words = std::make_unique<occupancy_map::word_type[]>(words_count);
         
-        if(!f.read(reinterpret_cast<char*>(&occupancy_map[0]), h.capacity()))
+        if(!f.read_at(occupancy_offset(h.capacity()), reinterpret_cast<char*>(&words[0]),
+                      occupancy_map::size_of(h.capacity())))
           return (ec = file::last_error()), false;
         
-        items_count = 0;
-        for(std::uint32_t i = 0; i != h.capacity(); ++i)
-          if(occupancy_map[i])
-            ++items_count;
-
+        items_count = occupancy_map::count(&words[0], words_count);
         return true;
       } catch(std::bad_alloc const&) {
         return (ec = std::error_code{error::not_enough_memory}), false;
@@ -96,12 +106,41 @@ namespace cellarium {
     }
     
     
+    // Cuts the tail growth left in a file when it was interrupted before
+    // the header named the new capacity; other files are left alone
+    static bool trim_unpublished_growth(path_type const& path, std::error_code& ec) noexcept {
+      cellarium::header h;
+      {
+        auto f = file::open_to_read(path);
+        if(!f)
+          return (ec = file::last_error()), false;
+        if(!f.read(h))
+          return (ec = file::last_error()), false;
+      }
+      if(!h.has_valid_signature())
+        return true;
+      auto const file_size = std::filesystem::file_size(path, ec);
+      if(!!ec)
+        return false;
+      auto const expected = static_cast<std::uintmax_t>(storage_size(h.capacity()));
+      if(file_size <= expected)
+        return true;
+      std::filesystem::resize_file(path, expected, ec);
+      return !ec;
+    }
+    
+    
     storage() noexcept = default;
     ~storage() { close(); }
     storage(storage const&) = delete;
     storage& operator = (storage const&) = delete;
     explicit operator bool () const noexcept { return records_ != nullptr; }
-    header const* header() const noexcept { return header_; }
+    cellarium::header const* header() const noexcept { return header_; }
+    occupancy_map const& occupancy() const noexcept { return occupancy_; }
+    size_type size() const noexcept { return header_->items_count(); }
+    // Raw records, value of slot i starts at data() + i * record_size
+    char const* data() const noexcept { return reinterpret_cast<char const*>(records_); }
+    static constexpr std::size_t record_size = sizeof(record_type);
     
 
     bool create(path_type const& path, class header const& specified, std::error_code& ec) noexcept {
@@ -123,32 +162,25 @@ namespace cellarium {
       if(!mapped_file_)
         return (ec = mapped_file::last_error()), false;
       
-      mapped_region_ = mapped_file_.map();
+      mapped_region_ = map_region();
       if(mapped_region_.address == nullptr)
         return (ec = mapped_file::last_error()), false;
                   
-      header_ = reinterpret_cast<class header*>(mapped_region_.address);
-      records_ = reinterpret_cast<record_type*>(mapped_region_.address + sizeof(class header));
-      occupancy_map_ = reinterpret_cast<bool*>(mapped_region_.address
-                                               + sizeof(class header)
-                                               + sizeof(record_type) * specified.capacity());
-      std::memset(&occupancy_map_[0], 0, specified.capacity());
-      
-      *header_ = specified;      
-      index_type next_index = 0;
-      header_->free_index(next_index);
-      record_type* last_cell = records_ + header_->capacity() - 1;
-            
-      
-      for(record_type* each_cell = records_;
-          each_cell != last_cell;
-          ++each_cell) {
-        new(each_cell) record_type{++next_index};
-      }
+      // Freshly sized file reads as zeros, so neither records nor occupancy
+      // map are touched until the first insert
+      *reinterpret_cast<class header*>(mapped_region_.address) = specified;
+      bind_region();
+      if(!track_mapping(ec))
+        return false;
+      mark_header();
       
-      new(last_cell) record_type{no_index};
+      header_->free_index(no_index);
+      header_->high_water_mark(0);
+      header_->items_count(0);
+      header_->clean(false);
+      writable_ = true;
       
-      return true;
+      return apply_allocation(specified.allocation(), ec) && open_seqlocks(path, ec);
     }
     
     
@@ -156,7 +188,7 @@ namespace cellarium {
 
       close();
       
-      class header actual; header::size_type items_count;
+      class header actual; size_type items_count;
       if(!check_header(path, specified, actual, items_count, ec))
         return false;
       
@@ -169,14 +201,18 @@ namespace cellarium {
       
       if(!map_file(path, specified, ec))
         return false;
-            
-      if(header_->capacity() >= needed_capacity)
-        return true;
       
-      if(!expand_storage(needed_capacity, ec))
+      header_->items_count(items_count);
+      header_->clean(false);
+      writable_ = true;
+            
+      if(header_->capacity() < needed_capacity && !expand_storage(needed_capacity, ec))
         return false;
       
-      return true;
+      // Free list and high-water mark of a storage not closed properly may
+      // lag behind the occupancy map
+      return apply_allocation(specified.allocation(), ec) && (actual.clean() || repair(ec))
+             && open_seqlocks(path, ec);
     }
     
     
@@ -184,42 +220,180 @@ namespace cellarium {
       
       close();
       
-      header actual; header::size_type items_count;      
+      class header actual; size_type items_count;
       if(!check_header(path, specified, actual, items_count, ec))
         return false;
       
-      if(!map_file(path, specified, ec))
-        return false;
+      // Read-only mapping, the header of a writer elsewhere is never touched
+      mapped_file_ = mapped_file::open_to_read(path);
+      if(!mapped_file_)
+        return (ec = mapped_file::last_error()), false;
       
+      mapped_region_ = map_region();
+      if(mapped_region_.address == nullptr)
+        return (ec = mapped_file::last_error()), false;
+      
+      bind_region();
       return true;
     }
     
     
     void close() noexcept {
+      std::lock_guard<std::mutex> lock{mapping_mutex_};
       if(records_ == nullptr)
         return;
+      keep_snapshots_mapped();
+      drop_snapshots();
+      seqlocks_.close();
+      if(writable_)
+        header_->clean(true);
+      writable_ = false;
       mapped_region_ = mapped_file::region{};
       mapped_file_ = mapped_file{};
       header_ = nullptr;
       records_ = nullptr;
-      occupancy_map_ = nullptr;
+      occupancy_ = occupancy_map{};
+      free_slots_.clear();
+      dirty_.clear();
+      compacting_ = false;
+    }
+    
+    
+    // Durable storage tracks pages it modifies, so flush and checkpoint
+    // write only those; otherwise they write the whole mapping. Takes
+    // effect on the next create or open. Writes through iterators and
+    // for_each are not tracked, call mark_dirty for such records or write
+    // with modify_each
+    bool durable() const noexcept { return durable_; }
+    void durable(bool flag) noexcept { durable_ = flag; }
+
+
+    // Shared storage may be read by storage_reader in other processes while
+    // it changes. Every change of a slot is bracketed by a sequence counter
+    // of its stripe and every move of the mapping by a generation counter;
+    // counters live in a file beside the storage, see seqlock_path. Takes
+    // effect on the next create or open. Writes through operator [] and
+    // iterators are not bracketed, use update. Compaction keeps the file
+    // size, as readers would fault on a truncated tail
+    bool shared() const noexcept { return shared_; }
+    void shared(bool flag) noexcept { shared_ = flag; }
+    
+    
+    static path_type seqlock_path(path_type const& path) {
+      path_type result = path;
+      result += ".seqlock";
+      return result;
+    }
+    
+    
+    void mark_dirty(index_type index) noexcept {
+      mark_slot(index);
+    }
+    
+    
+    // Writes modified pages to the file and waits for them. Safe to call
+    // from another thread, while the storage is open
+    bool flush(std::error_code& ec) noexcept {
+      std::lock_guard<std::mutex> lock{mapping_mutex_};
+      return flush_mapping(ec);
+    }
+    
+    
+    // Flush followed by sync of the file, so its size and metadata are
+    // durable too
+    bool checkpoint(std::error_code& ec) noexcept {
+      std::lock_guard<std::mutex> lock{mapping_mutex_};
+      if(!flush_mapping(ec))
+        return false;
+      if(mapped_region_.address != nullptr && !mapped_file_.sync())
+        return (ec = mapped_file::last_error()), false;
+      return true;
+    }
+    
+    
+    // Capacity up to which the next create or open reserves address space.
+    // Growth within it maps the file further in place, so references to
+    // records stay valid; 0, the default, reserves nothing. Reservations
+    // are not supported on Windows
+    size_type reserved_capacity() const noexcept { return reserved_capacity_; }
+    void reserve(size_type max_capacity) noexcept { reserved_capacity_ = max_capacity; }
+    
+    
+    // Multiplier of capacity when an insert finds the storage full;
+    // 0 or 1 keeps capacity fixed, which is the default
+    size_type growth_factor() const noexcept { return growth_factor_; }
+    void growth_factor(size_type factor) noexcept { growth_factor_ = factor; }
+    
+    
+    // Extends capacity of the open storage, rounded up to a power of two.
+    // Unless it fits the reserved capacity, records and occupancy map move,
+    // so references and iterators are invalidated. If the file can not be extended the storage stays as it
+    // was, if it can not be mapped again the storage is closed
+    bool grow(size_type new_capacity, std::error_code& ec) noexcept {
+      size_type const old_capacity = header_->capacity();
+      if(new_capacity <= old_capacity)
+        return true;
+      std::lock_guard<std::mutex> lock{mapping_mutex_};
+      if(new_capacity > max_capacity)
+        return (ec = std::error_code{error::not_enough_memory}), false;
+      new_capacity = cellarium::header::ceil2(new_capacity);
+      if(mapped_region_.reserved != 0 && storage_size(new_capacity) > mapped_region_.reserved)
+        return (ec = std::error_code{error::address_space_exhausted}), false;
+      
+      if(!seqlocks_)
+        return grow_mapping(new_capacity, ec);
+      seqlocks_.begin_remap();
+      bool const grown = grow_mapping(new_capacity, ec);
+      seqlocks_.end_remap();
+      return grown;
     }
     
     
     index_type try_insert(T const& data) noexcept {
-      auto const index = header_->free_index();
-      if(index == cellarium::header::no_index)
-        return cellarium::header::no_index;
-      header_->free_index(records_[index].fill(data));
-      occupancy_map_[index] = true;
-      return index;
+      index_type const index = insert_free(data);
+      if(index != no_index || !grow_when_full())
+        return index;
+      return insert_free(data);
+    }
+    
+    
+    // Takes the first free slot at or after hint, wrapping around;
+    // hint is ignored by free list allocation
+    index_type try_insert(T const& data, index_type hint) noexcept {
+      if(header_->allocation() != allocation_policy::lowest_free)
+        return try_insert(data);
+      auto index = free_slots_.find_next(occupancy_, hint);
+      if(index == no_index)
+        index = free_slots_.find_first(occupancy_);
+      if(index == no_index && grow_when_full())
+        index = free_slots_.find_first(occupancy_);
+      return insert_at(index, data);
     }
     
     
     void remove(index_type index) noexcept {
-      records_[index].clear(header_->free_index());
-      header_->free_index(index);
-      occupancy_map_[index] = false;
+      begin_slot(index);
+      mark_slot(index);
+      if(header_->allocation() == allocation_policy::lowest_free) {
+        occupancy_.reset(index);
+        free_slots_.released(index);
+      } else {
+        records_[index].clear(header_->free_index());
+        header_->free_index(index);
+        occupancy_.reset(index);
+      }
+      end_slot(index);
+      header_->items_count(header_->items_count() - 1);
+    }
+    
+    
+    // Same as assigning through operator [], but seen by shared readers
+    // as a whole
+    void update(index_type index, T const& data) noexcept {
+      begin_slot(index);
+      records_[index].data() = data;
+      mark_slot(index);
+      end_slot(index);
     }
 
 
@@ -228,36 +402,535 @@ namespace cellarium {
     }
 
 
+    // Durable storage counts the record as modified
     T& operator [](index_type index) noexcept {
+      preserve_slot(index);
+      mark_slot(index);
       return records_[index].data();
     }
     
     
+    // Records are handed out directly: writes through them are neither
+    // seen by snapshots nor tracked by durable storage, see modify_each
     template<typename F> void for_each(F&& f) {
-      for(index_type i = 0; i != header_->capacity(); ++i)
-        if(occupancy_map_[i])
-          f(records_[i].data());
+      occupancy_.for_each([&](index_type i) { f(records_[i].data()); });
     }
 
 
     template<typename F> void for_each(F&& f) const {
-      for(index_type i = 0; i != header_->capacity(); ++i)
-        if(occupancy_map_[i])
-          f(records_[i].data());
+      occupancy_.for_each([&](index_type i) { f(records_[i].data()); });
+    }
+
+
+    // Calls f(T&) on every live record handed out as by operator [], so
+    // snapshots keep the originals and durable storage counts them as
+    // modified
+    template<typename F> void modify_each(F&& f) {
+      occupancy_.for_each([&](index_type i) { f((*this)[i]); });
+    }
+
+
+    // Forward iterator over live records in index order. Records a few
+    // slots ahead are prefetched on every step. The occupancy word under
+    // the iterator is cached: slots of that word inserted or removed after
+    // the iterator reached it may be missed or still visited, changes to
+    // later words are seen. Growth and shrinking invalidate all iterators.
+    // Writes through mutable iterators are neither seen by snapshots nor
+    // tracked by durable storage, see modify_each
+    template<typename V> class basic_iterator {
+    public:
+
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = T;
+      using difference_type = std::ptrdiff_t;
+      using pointer = V*;
+      using reference = V&;
+
+      static constexpr index_type prefetch_distance = 8;
+
+
+      basic_iterator() noexcept = default;
+      index_type index() const noexcept { return cursor_.index(); }
+      reference operator * () const noexcept { return records_[cursor_.index()].data(); }
+      pointer operator -> () const noexcept { return &records_[cursor_.index()].data(); }
+
+
+      // iterator converts to const_iterator
+      template<typename U, typename = std::enable_if_t<std::is_const_v<V> && std::is_same_v<U, T>>>
+      basic_iterator(basic_iterator<U> const& other) noexcept:
+        records_{other.records_}, capacity_{other.capacity_}, cursor_{other.cursor_}
+      { }
+
+
+      basic_iterator& operator ++ () noexcept {
+        cursor_.next();
+        index_type const ahead = cursor_.index() + prefetch_distance;
+        if(ahead < capacity_)
+          detail::prefetch(&records_[ahead]);
+        return *this;
+      }
+
+
+      basic_iterator operator ++ (int) noexcept {
+        basic_iterator const previous{*this};
+        ++*this;
+        return previous;
+      }
+
+
+      friend bool operator == (basic_iterator const& a, basic_iterator const& b) noexcept {
+        return a.cursor_.index() == b.cursor_.index();
+      }
+
+
+      friend bool operator != (basic_iterator const& a, basic_iterator const& b) noexcept {
+        return a.cursor_.index() != b.cursor_.index();
+      }
+
+
+    private:
+
+      friend class storage;
+      template<typename> friend class basic_iterator;
+
+      using record_pointer = std::conditional_t<std::is_const_v<V>, record_type const*, record_type*>;
+
+      record_pointer records_{nullptr};
+      index_type capacity_{0};
+      occupancy_map::cursor cursor_;
+
+
+      basic_iterator(record_pointer records, index_type capacity, occupancy_map::cursor cursor) noexcept:
+        records_{records}, capacity_{capacity}, cursor_{cursor}
+      { }
+
+    }; // basic_iterator
+
+    using iterator = basic_iterator<T>;
+    using const_iterator = basic_iterator<T const>;
+
+
+    const_iterator begin() const noexcept { return cbegin(); }
+    const_iterator end() const noexcept { return cend(); }
+
+
+    iterator begin() noexcept {
+      return iterator{records_, occupancy_.capacity(), occupancy_map::cursor{occupancy_, 0}};
+    }
+
+
+    iterator end() noexcept {
+      return iterator{records_, occupancy_.capacity(), occupancy_map::cursor{occupancy_, occupancy_.capacity()}};
+    }
+
+
+    const_iterator cbegin() const noexcept {
+      return const_iterator{records_, occupancy_.capacity(), occupancy_map::cursor{occupancy_, 0}};
+    }
+
+
+    const_iterator cend() const noexcept {
+      return const_iterator{records_, occupancy_.capacity(), occupancy_map::cursor{occupancy_, occupancy_.capacity()}};
+    }
+
+    
+    // Redo of a logged insert or update: stores data at index and marks
+    // the slot occupied, leaving counters and allocation to repair
+    void restore(index_type index, T const& data) noexcept {
+      begin_slot(index);
+      records_[index].fill(data);
+      occupancy_.set(index);
+      mark_slot(index);
+      end_slot(index);
+    }
+    
+    
+    // Redo of a logged remove
+    void restore_free(index_type index) noexcept {
+      begin_slot(index);
+      occupancy_.reset(index);
+      mark_slot(index);
+      end_slot(index);
+    }
+    
+    
+    // Derives items count, high-water mark and free slots from the
+    // occupancy map, so they agree with it after restores or a crash
+    // between updates of the map and the free list
+    bool repair(std::error_code& ec) noexcept {
+      header_->items_count(occupancy_.count());
+      index_type const last = occupancy_.find_last(header_->capacity() - 1);
+      if(last != no_index && last >= header_->high_water_mark())
+        header_->high_water_mark(last + 1);
+      mark_header();
+      if(header_->allocation() != allocation_policy::lowest_free) {
+        rebuild_free_list();
+        mark_all();
+        return true;
+      }
+      try {
+        free_slots_.build(occupancy_);
+        return true;
+      } catch(std::bad_alloc const&) {
+        ec = std::error_code{error::not_enough_memory};
+        return false;
+      }
+    }
+    
+    
+    // Immutable view of records as they are now, readable from any thread
+    // while the storage changes. Pages are copied aside only when first
+    // modified after the snapshot. When growth, shrinking or close move or
+    // unmap the mapping, the snapshot keeps a mapping of its own of the
+    // file; only pages shrinking cuts off are copied then. After close the
+    // file must not be written by another opening while the snapshot is
+    // read. Take it from the writing thread. Throws std::bad_alloc
+    storage_snapshot<T> snapshot() {
+      auto pages = std::make_shared<page_snapshot>(mapped_region_.address, std::size_t(mapped_region_.size),
+                                                   std::size_t(mapped_file::granularity()));
+      {
+        std::lock_guard<std::mutex> lock{snapshots_mutex_};
+        release_snapshots();
+        snapshots_.push_back(pages);
+        snapshotted_.store(true, std::memory_order_release);
+      }
+      return storage_snapshot<T>{std::move(pages), header_->capacity(), header_->items_count(),
+                                 records_offset, record_size,
+                                 std::size_t(occupancy_offset(header_->capacity()))};
+    }
+    
+    
+    bool compacting() const noexcept { return compacting_; }
+    
+    
+    // Moves at most max_moves live records from the top into the lowest free
+    // slots, reporting each move as relocated(old_index, new_index). Inserts
+    // and removes may go on between calls, meanwhile inserts take the lowest
+    // free slot. Returns true when records are dense and the file is
+    // truncated to the capacity fitting them; false with ec untouched means
+    // there is more to move. Truncation remaps the storage, so references
+    // to records are invalidated
+    template<typename F>
+    bool compact(size_type max_moves, F&& relocated, std::error_code& ec) {
+      
+      if(!compacting_) {
+        auto const policy = header_->allocation();
+        if(!apply_allocation(allocation_policy::lowest_free, ec))
+          return false;
+        compaction_policy_ = policy;
+        compaction_top_ = header_->capacity() - 1;
+        compacting_ = true;
+      }
+      
+      for(size_type moved = 0; moved != max_moves; ++moved) {
+        index_type const last = occupancy_.find_last(compaction_top_);
+        index_type const first = free_slots_.find_first(occupancy_);
+        if(last == no_index || first == no_index || first > last)
+          return finish_compaction(ec);
+        begin_slot(first);
+        records_[first].fill(records_[last].data());
+        occupancy_.set(first);
+        mark_slot(first);
+        end_slot(first);
+        free_slots_.occupied(occupancy_, first);
+        begin_slot(last);
+        occupancy_.reset(last);
+        mark_slot(last);
+        end_slot(last);
+        free_slots_.released(last);
+        compaction_top_ = last;
+        relocated(last, first);
+      }
+      
+      return false;
+    }
+    
+    
+    template<typename F>
+    bool compact(F&& relocated, std::error_code& ec) {
+      constexpr size_type moves_per_step = 4096;
+      std::error_code step_ec;
+      while(!compact(moves_per_step, relocated, step_ec))
+        if(!!step_ec)
+          return (ec = step_ec), false;
+      return true;
     }
  
     
   private:
     
+    template<typename> friend class concurrent_storage;
+    template<typename> friend class upgrading_storage;
+    
     mapped_file mapped_file_;
     mapped_file::region mapped_region_;
     cellarium::header* header_{nullptr};
     record_type* records_{nullptr};
-    bool* occupancy_map_{nullptr};
+    occupancy_map occupancy_;
+    occupancy_index free_slots_; // lowest free allocation only
+    bool writable_{false};
+    bool compacting_{false};
+    allocation_policy compaction_policy_{allocation_policy::free_list};
+    index_type compaction_top_{0};
+    size_type growth_factor_{0};
+    size_type reserved_capacity_{0};
+    bool durable_{false};
+    dirty_pages dirty_; // durable only
+    std::mutex mapping_mutex_; // flush against moving the mapping
+    // Writes through operator [] may preserve slots from several threads
+    std::mutex snapshots_mutex_;
+    std::vector<std::shared_ptr<page_snapshot>> snapshots_;
+    std::atomic<bool> snapshotted_{false}; // snapshots_ is not empty
+    bool shared_{false};
+    seqlock_table seqlocks_; // shared only
+    
+    
+    // Occupancy map follows the records, aligned to a cache line
+    static mapped_file::size_type occupancy_offset(size_type capacity) noexcept {
+      mapped_file::size_type const records_end =
+          records_offset + mapped_file::size_type(capacity) * sizeof(record_type);
+      return (records_end + 63) & ~mapped_file::size_type(63);
+    }
         
     
-    static mapped_file::size_type storage_size(index_type capacity) noexcept {
-      return sizeof(class header) + capacity * sizeof(record_type) + capacity;
+    static mapped_file::size_type storage_size(size_type capacity) noexcept {
+      return occupancy_offset(capacity) + occupancy_map::size_of(capacity);
+    }
+    
+    
+    bool track_mapping(std::error_code& ec) noexcept {
+      if(!durable_)
+        return true;
+      try {
+        dirty_.resize(std::size_t(mapped_region_.size), std::size_t(mapped_file::granularity()));
+        return true;
+      } catch(std::bad_alloc const&) {
+        ec = std::error_code{error::not_enough_memory};
+        return false;
+      }
+    }
+    
+    
+    void mark_slot(index_type index) noexcept {
+      if(!durable_)
+        return;
+      dirty_.mark(records_offset + std::size_t(index) * record_size, record_size);
+      dirty_.mark(std::size_t(occupancy_offset(header_->capacity()))
+                  + index / occupancy_map::bits_per_word * sizeof(occupancy_map::word_type),
+                  sizeof(occupancy_map::word_type));
+    }
+    
+    
+    // Call before the slot or its occupancy bit changes
+    void preserve_slot(index_type index) noexcept {
+      if(!snapshotted_.load(std::memory_order_acquire))
+        return;
+      std::lock_guard<std::mutex> lock{snapshots_mutex_};
+      release_snapshots();
+      for(auto const& each: snapshots_) {
+        each->preserve(records_offset + std::size_t(index) * record_size, record_size);
+        each->preserve(std::size_t(occupancy_offset(header_->capacity()))
+                       + index / occupancy_map::bits_per_word * sizeof(occupancy_map::word_type),
+                       sizeof(occupancy_map::word_type));
+      }
+    }
+    
+    
+    // Brackets every change of a slot or its occupancy bit
+    void begin_slot(index_type index) noexcept {
+      preserve_slot(index);
+      if(seqlocks_)
+        seqlocks_.begin_write(index);
+    }
+    
+    
+    void end_slot(index_type index) noexcept {
+      if(seqlocks_)
+        seqlocks_.end_write(index);
+    }
+    
+    
+    // Readers mapped before, possibly another incarnation of the file,
+    // map it again on the generation change
+    bool open_seqlocks(path_type const& path, std::error_code& ec) noexcept {
+      if(!shared_)
+        return true;
+      if(!seqlocks_.open(seqlock_path(path), true, ec))
+        return false;
+      seqlocks_.begin_remap();
+      seqlocks_.end_remap();
+      return true;
+    }
+    
+    
+    // Snapshots held by the storage only. Has to be called under
+    // snapshots_mutex_
+    void release_snapshots() noexcept {
+      for(std::size_t i = snapshots_.size(); i-- != 0;)
+        if(snapshots_[i].use_count() == 1) {
+          snapshots_[i] = std::move(snapshots_.back());
+          snapshots_.pop_back();
+        }
+      snapshotted_.store(!snapshots_.empty(), std::memory_order_release);
+    }
+    
+    
+    // Call before the mapping moves or is unmapped. Snapshots reading it
+    // get a new mapping of the same file pages, unmapped with the last of
+    // them, so nothing is copied. Where the file can not change size under
+    // a mapping they copy the pages aside instead
+    void keep_snapshots_mapped() noexcept {
+      std::lock_guard<std::mutex> lock{snapshots_mutex_};
+      release_snapshots();
+      std::shared_ptr<mapped_file::region> kept;
+      for(auto const& each: snapshots_) {
+        if(each->base() != mapped_region_.address)
+          continue;
+        if(!kept && mapped_file::resizable_while_mapped) {
+          try {
+            kept = std::make_shared<mapped_file::region>(mapped_file_.map(0, mapped_region_.size));
+          } catch(std::bad_alloc const&) { }
+        }
+        if(kept && kept->address != nullptr)
+          each->rebase(kept->address, kept);
+        else
+          each->detach();
+      }
+    }
+
+
+    // Call before a write to the range not bound to a slot
+    void preserve_range(std::size_t offset, std::size_t length) noexcept {
+      if(!snapshotted_.load(std::memory_order_acquire))
+        return;
+      std::lock_guard<std::mutex> lock{snapshots_mutex_};
+      for(auto const& each: snapshots_)
+        each->preserve(offset, length);
+    }
+
+
+    // Call before the file is cut to size bytes
+    void truncate_snapshots(std::size_t size) noexcept {
+      std::lock_guard<std::mutex> lock{snapshots_mutex_};
+      for(auto const& each: snapshots_)
+        each->truncate(size);
+    }
+
+
+    // Storage does not change the file any more
+    void drop_snapshots() noexcept {
+      std::lock_guard<std::mutex> lock{snapshots_mutex_};
+      snapshots_.clear();
+      snapshotted_.store(false, std::memory_order_release);
+    }
+    
+    
+    void mark_header() noexcept {
+      if(durable_)
+        dirty_.mark(0, sizeof(class header));
+    }
+    
+    
+    void mark_all() noexcept {
+      if(durable_)
+        dirty_.mark_all();
+    }
+    
+    
+    // Counters of the header change with every insert and remove, so its
+    // first page is always written
+    bool flush_mapping(std::error_code& ec) noexcept {
+      if(mapped_region_.address == nullptr)
+        return true;
+      if(!durable_) {
+        if(!mapped_region_.flush(0, mapped_region_.size))
+          return (ec = mapped_file::last_error()), false;
+        return true;
+      }
+      dirty_.mark(0, 1);
+      bool flushed = true;
+      auto const mapped = std::size_t(mapped_region_.size);
+      dirty_.drain([&](std::size_t offset, std::size_t length) {
+        if(offset + length > mapped)
+          length = mapped - offset;
+        if(mapped_region_.flush(mapped_file::offset_type(offset), mapped_file::size_type(length)))
+          return;
+        if(flushed)
+          ec = mapped_file::last_error();
+        flushed = false;
+        dirty_.mark(offset, length);
+      });
+      return flushed;
+    }
+    
+    
+    // Writes records of slots [first, last) and their occupancy words
+    bool flush_slots(index_type first, index_type last, std::error_code& ec) noexcept {
+      std::lock_guard<std::mutex> lock{mapping_mutex_};
+      if(last > header_->capacity())
+        last = header_->capacity();
+      if(first >= last)
+        return true;
+      auto const word_size = mapped_file::size_type(sizeof(occupancy_map::word_type));
+      auto const first_word = first / occupancy_map::bits_per_word;
+      auto const last_word = (last - 1) / occupancy_map::bits_per_word;
+      if(!mapped_region_.flush(mapped_file::offset_type(records_offset) + mapped_file::offset_type(first) * record_size,
+                               mapped_file::size_type(last - first) * record_size)
+         || !mapped_region_.flush(occupancy_offset(header_->capacity()) + first_word * word_size,
+                                  (last_word - first_word + 1) * word_size))
+        return (ec = mapped_file::last_error()), false;
+      return true;
+    }
+    
+    
+    mapped_file::region map_region() noexcept {
+      if(reserved_capacity_ == 0)
+        return mapped_file_.map();
+      return mapped_file_.map_reserved(storage_size(reserved_capacity_));
+    }
+    
+    
+    occupancy_map map_occupancy(size_type capacity) noexcept {
+      return occupancy_map{reinterpret_cast<occupancy_map::word_type*>(
+                             mapped_region_.address + occupancy_offset(capacity)),
+                           capacity};
+    }
+
+    
+    void bind_region() noexcept {
+      header_ = reinterpret_cast<class header*>(mapped_region_.address);
+      records_ = reinterpret_cast<record_type*>(mapped_region_.address + records_offset);
+      occupancy_ = map_occupancy(header_->capacity());
+    }
+    
+    
+    // Resizes the file to the header capacity and maps it again
+    bool remap(std::error_code& ec) noexcept {
+      std::lock_guard<std::mutex> lock{mapping_mutex_};
+      auto const size = storage_size(header_->capacity());
+      keep_snapshots_mapped();
+      header_ = nullptr;
+      records_ = nullptr;
+      occupancy_ = occupancy_map{};
+      free_slots_.clear();
+      mapped_region_ = mapped_file::region{};
+      
+      if(!mapped_file_.resize(size)) {
+        ec = mapped_file::last_error();
+        return (mapped_file_ = mapped_file{}), (writable_ = false), false;
+      }
+      
+      mapped_region_ = map_region();
+      if(mapped_region_.address == nullptr) {
+        ec = mapped_file::last_error();
+        return (mapped_file_ = mapped_file{}), (writable_ = false), false;
+      }
+      
+      bind_region();
+      if(!track_mapping(ec))
+        return false;
+      mark_all();
+      return true;
     }
     
     
@@ -286,7 +959,7 @@ namespace cellarium {
       auto const file_size = std::filesystem::file_size(path, ec);
       if(!!ec)
         return false;      
-      if(file_size != storage_size(actual.capacity()))
+      if(file_size != static_cast<std::uintmax_t>(storage_size(actual.capacity())))
         return (ec = std::error_code{error::invalid_file_size}), false;
       
       return true;
@@ -299,46 +972,180 @@ namespace cellarium {
       if(!mapped_file_)
         return (ec = mapped_file::last_error()), false;
       
-      mapped_region_ = mapped_file_.map();
+      mapped_region_ = map_region();
       if(mapped_region_.address == nullptr)
         return (ec = mapped_file::last_error()), false;
                   
-      header_ = reinterpret_cast<class header*>(mapped_region_.address);
+      bind_region();
       header_->occupancy_factor(specified.occupancy_factor());
-      records_ = reinterpret_cast<record_type*>(mapped_region_.address + sizeof(class header));
-      occupancy_map_ = reinterpret_cast<bool*>(mapped_region_.address
-                                               + sizeof(class header)
-                                               + sizeof(record_type) * header_->capacity());
-      return true;
+      return track_mapping(ec);
     }
     
     
+    // Slots past the high-water mark need no initialization, so only the
+    // occupancy map is moved; its new tail lies past the old end of file and
+    // already reads as zeros
+    // A durable storage writes the moved map before the header names the
+    // new capacity, so the file reads right by either capacity
     bool expand_storage(size_type new_capacity, std::error_code& ec) noexcept {
+      occupancy_map expanded = map_occupancy(new_capacity);
+      preserve_range(std::size_t(occupancy_offset(new_capacity)), occupancy_map::size_of(header_->capacity()));
+      std::memmove(expanded.data(), occupancy_.data(), occupancy_map::size_of(header_->capacity()));
+      if(durable_ && !mapped_region_.flush(occupancy_offset(new_capacity), occupancy_map::size_of(new_capacity)))
+        return (ec = mapped_file::last_error()), false;
+      occupancy_ = expanded;
+      header_->capacity(new_capacity);
+      mark_all();
+      
+      if(header_->allocation() != allocation_policy::lowest_free)
+        return true;
+      
       try {
-
-        std::unique_ptr<bool[]> occupancy_map = std::make_unique<bool[]>(header_->capacity());
-        auto const occupancy_ptr = &occupancy_map[0];
-        std::memcpy(occupancy_ptr, occupancy_map_, header_->capacity());      
-
-        index_type next_index = header_->capacity();
-        record_type* last_record = records_ + new_capacity - 1;
-        for(record_type* new_record = records_ + header_->capacity(); new_record != last_record; ++new_record)
-          new(new_record) record_type{++next_index};
-        new(last_record) record_type{header_->free_index()};
-        header_->free_index(header_->capacity());      
-
-        occupancy_map_ = reinterpret_cast<bool*>(records_ + new_capacity);
-        std::memcpy(occupancy_map_, occupancy_ptr, header_->capacity());
-        std::memset(occupancy_map_ + header_->capacity(), 0, new_capacity - header_->capacity());
-
-        header_->capacity(new_capacity);
+        free_slots_.build(occupancy_);
+        return true;
+      } catch(std::bad_alloc const&) {
+        ec = std::error_code{error::not_enough_memory};
+        return false;
+      }
+    }
+    
+    
+    // Occupancy map moves down first: its new place is still mapped while
+    // its tail past the fitting capacity is all zeros
+    bool shrink_storage(size_type new_capacity, std::error_code& ec) noexcept {
+      occupancy_map shrunk = map_occupancy(new_capacity);
+      preserve_range(std::size_t(occupancy_offset(new_capacity)), occupancy_map::size_of(new_capacity));
+      truncate_snapshots(std::size_t(storage_size(new_capacity)));
+      std::memmove(shrunk.data(), occupancy_.data(), occupancy_map::size_of(new_capacity));
+      header_->capacity(new_capacity);
+      return remap(ec);
+    }
+    
+    
+    // High-water mark comes from the occupancy map and the file is never
+    // cut below it, whatever inserts and removes did between steps
+    bool finish_compaction(std::error_code& ec) noexcept {
+      compacting_ = false;
+      index_type const last = occupancy_.find_last(header_->capacity() - 1);
+      size_type const used = last == no_index ? 0 : last + 1;
+      header_->free_index(no_index);
+      header_->high_water_mark(used);
+      
+      // Shared readers would fault on the truncated tail
+      size_type fitting = header_->fitting_capacity(header_->items_count());
+      while(fitting < used)
+        fitting = fitting == 0 ? 1 : fitting * 2;
+      if(!seqlocks_ && fitting < header_->capacity() && !shrink_storage(fitting, ec))
+        return false;
+      
+      return apply_allocation(compaction_policy_, ec);
+    }
+    
+    
+    index_type insert_free(T const& data) noexcept {
+      if(header_->allocation() == allocation_policy::lowest_free)
+        return insert_at(free_slots_.find_first(occupancy_), data);
+      
+      auto index = header_->free_index();
+      if(index != no_index) {
+        begin_slot(index);
+        header_->free_index(records_[index].fill(data));
+      } else {
+        index = header_->high_water_mark();
+        if(index == header_->capacity())
+          return no_index;
+        begin_slot(index);
+        records_[index].fill(data);
+        header_->high_water_mark(index + 1);
+      }
+      occupancy_.set(index);
+      mark_slot(index);
+      end_slot(index);
+      header_->items_count(header_->items_count() + 1);
+      return index;
+    }
+    
+    
+    bool grow_mapping(size_type new_capacity, std::error_code& ec) noexcept {
+      keep_snapshots_mapped();
+      header_ = nullptr;
+      records_ = nullptr;
+      occupancy_ = occupancy_map{};
+      if(!mapped_file_.grow(mapped_region_, storage_size(new_capacity))) {
+        ec = mapped_file::last_error();
+        if(mapped_region_.address != nullptr) {
+          bind_region();
+          return false;
+        }
+        free_slots_.clear();
+        return (mapped_file_ = mapped_file{}), (writable_ = false), false;
+      }
+      
+      bind_region();
+      return track_mapping(ec) && expand_storage(new_capacity, ec);
+    }
+    
+    
+    bool grow_when_full() noexcept {
+      if(growth_factor_ < 2 || header_->capacity() > max_capacity / growth_factor_)
+        return false;
+      std::error_code ec;
+      return grow(header_->capacity() * growth_factor_, ec);
+    }
+    
+    
+    index_type insert_at(index_type index, T const& data) noexcept {
+      if(index == no_index)
+        return no_index;
+      begin_slot(index);
+      records_[index].fill(data);
+      occupancy_.set(index);
+      mark_slot(index);
+      end_slot(index);
+      free_slots_.occupied(occupancy_, index);
+      if(index >= header_->high_water_mark())
+        header_->high_water_mark(index + 1);
+      // Records inserted above the scan have to be moved down too
+      if(compacting_ && index > compaction_top_)
+        compaction_top_ = index;
+      header_->items_count(header_->items_count() + 1);
+      return index;
+    }
+    
+    
+    // Switching to lowest free drops the free list, the occupancy map is
+    // enough to find free slots; switching back threads a new free list
+    // through free slots below the high-water mark, lowest first
+    bool apply_allocation(allocation_policy policy, std::error_code& ec) noexcept {
+      try {
+        if(policy == allocation_policy::lowest_free) {
+          free_slots_.build(occupancy_);
+          header_->free_index(no_index);
+        } else {
+          free_slots_.clear();
+          if(header_->allocation() == allocation_policy::lowest_free) {
+            rebuild_free_list();
+            mark_all();
+          }
+        }
+        header_->allocation(policy);
         return true;
-
       } catch(std::bad_alloc const&) {
         ec = std::error_code{error::not_enough_memory};
-        return false;        
+        return false;
       }
     }
+    
+    
+    void rebuild_free_list() noexcept {
+      index_type head = no_index;
+      for(index_type i = header_->high_water_mark(); i-- != 0;)
+        if(!occupancy_.test(i)) {
+          new(records_ + i) record_type{head};
+          head = i;
+        }
+      header_->free_index(head);
+    }
         
   }; // storage
 
@@ -0,0 +1,193 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <filesystem>
+#include <system_error>
+#include <thread>
+
+#include "storage.hpp"
+#include "seqlock.hpp"
+#include "occupancy_map.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  // Reads a shared storage written by another process, see
+  // storage::shared. Lookups and scans touch only mapped memory: a read
+  // of a slot is retried while the writer changes its stripe, and the
+  // file is mapped again, the only syscalls, after the writer moves the
+  // mapping
+  template<typename T>
+  class storage_reader {
+  public:
+
+    using storage_type = storage<T>;
+    using path_type = typename storage_type::path_type;
+    using size_type = typename storage_type::size_type;
+    using index_type = typename storage_type::index_type;
+    using value_type = T;
+
+
+    storage_reader() noexcept = default;
+    storage_reader(storage_reader const&) = delete;
+    storage_reader& operator = (storage_reader const&) = delete;
+    explicit operator bool () const noexcept { return !!storage_; }
+    // Capacity seen by the current mapping
+    size_type capacity() const noexcept { return storage_.occupancy().capacity(); }
+
+
+    bool open(path_type const& path, class header const& specified, std::error_code& ec) noexcept {
+      close();
+      if(!seqlocks_.open(storage_type::seqlock_path(path), false, ec))
+        return false;
+      path_ = path;
+      specified_ = specified;
+      for(;;) {
+        auto const generation = seqlocks_.generation();
+        if((generation & 1) != 0) {
+          std::this_thread::yield();
+          continue;
+        }
+        if(remap(generation, ec))
+          return true;
+        if(seqlocks_.generation() == generation)
+          return seqlocks_.close(), false;
+        ec.clear();
+      }
+    }
+
+
+    void close() noexcept {
+      storage_.close();
+      seqlocks_.close();
+      generation_ = 0;
+    }
+
+
+    // Live records when the writer last updated the counter
+    size_type size() const noexcept {
+      return storage_.header()->items_count();
+    }
+
+
+    // Copies the record at index when it is live; false with ec untouched
+    // when it is not
+    bool read(index_type index, T& value, std::error_code& ec) noexcept {
+      for(;;) {
+        auto const generation = seqlocks_.generation();
+        if(!settle(generation, ec)) {
+          if(!!ec)
+            return false;
+          continue;
+        }
+        if(index >= capacity()) {
+          if(seqlocks_.generation() == generation)
+            return false;
+          continue;
+        }
+        auto const sequence = seqlocks_.read_begin(index);
+        bool const live = storage_.occupancy().test(index);
+        if(live)
+          value = storage_[index];
+        if(seqlocks_.read_validate(index, sequence) && seqlocks_.generation() == generation)
+          return live;
+      }
+    }
+
+
+    // Calls f(index, value) for records live at some moment of the scan;
+    // every stripe of 64 slots is read consistently
+    template<typename F> bool for_each(F&& f, std::error_code& ec) {
+      index_type indices[seqlock_table::slots_per_stripe];
+      T values[seqlock_table::slots_per_stripe];
+      for(size_type w = 0;; ++w) {
+        size_type n;
+        for(;;) {
+          auto const generation = seqlocks_.generation();
+          if(!settle(generation, ec)) {
+            if(!!ec)
+              return false;
+            continue;
+          }
+          if(w >= storage_.occupancy().words_count()) {
+            if(seqlocks_.generation() == generation)
+              return true;
+            continue;
+          }
+          index_type const first = w * occupancy_map::bits_per_word;
+          auto const sequence = seqlocks_.read_begin(first);
+          n = 0;
+          for(auto bits = storage_.occupancy().word(w); bits != 0; bits &= bits - 1, ++n) {
+            indices[n] = first + detail::count_trailing_zeros(bits);
+            values[n] = storage_[indices[n]];
+          }
+          if(seqlocks_.read_validate(first, sequence) && seqlocks_.generation() == generation)
+            break;
+        }
+        for(size_type i = 0; i != n; ++i)
+          f(indices[i], values[i]);
+      }
+    }
+
+
+  private:
+
+    storage_type storage_;
+    seqlock_table seqlocks_;
+    path_type path_;
+    class header specified_;
+    seqlock_table::generation_type generation_{0};
+
+
+    // True when the mapping matches generation; false with ec untouched
+    // when the writer is moving it, try again then
+    bool settle(seqlock_table::generation_type generation, std::error_code& ec) noexcept {
+      if((generation & 1) != 0) {
+        std::this_thread::yield();
+        return false;
+      }
+      if(generation == generation_)
+        return true;
+      if(remap(generation, ec))
+        return seqlocks_.generation() == generation;
+      if(seqlocks_.generation() != generation)
+        ec.clear();
+      return false;
+    }
+
+
+    bool remap(seqlock_table::generation_type generation, std::error_code& ec) noexcept {
+      if(!storage_.open_to_read(path_, specified_, ec))
+        return false;
+      generation_ = generation;
+      return true;
+    }
+
+  }; // storage_reader
+
+
+} // cellarium
@@ -0,0 +1,220 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+namespace cellarium {
+
+
+  // Fixed set of workers running one job at a time. A job is a number of
+  // morsels; each worker starts with an equal contiguous range of them and,
+  // when it runs dry, steals the back half of another worker's range
+  class thread_pool {
+  public:
+
+    using size_type = std::size_t;
+
+
+    static size_type default_threads() noexcept {
+      unsigned const n = std::thread::hardware_concurrency();
+      return n > 1 ? size_type(n - 1) : 0;
+    }
+
+
+    // Calling thread of run() is a worker too, so threads are the extra ones.
+    // Throws std::system_error and std::bad_alloc
+    explicit thread_pool(size_type threads = default_threads()):
+      ranges_{new range[threads + 1]}, ranges_count_{threads + 1} {
+      threads_.reserve(threads);
+      try {
+        for(size_type i = 1; i != ranges_count_; ++i)
+          threads_.emplace_back([this, i] { work(i); });
+      } catch(...) {
+        stop();
+        throw;
+      }
+    }
+
+
+    ~thread_pool() { stop(); }
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator = (thread_pool const&) = delete;
+    size_type size() const noexcept { return ranges_count_; }
+
+
+    // Calls f(worker, morsel) for every morsel in [0, morsels) and returns
+    // when all of them are done; worker is below size(). Runs from several
+    // threads are serialized. f must not throw
+    template<typename F> void run(size_type morsels, F&& f) {
+      using job_type = std::remove_reference_t<F>;
+      std::lock_guard<std::mutex> serial{run_mutex_};
+
+      // Ranges hold 32-bit bounds, so longer jobs go in several rounds
+      for(size_type base = 0; base < morsels; base += max_round) {
+        std::uint32_t const total = std::uint32_t(std::min(morsels - base, max_round));
+        for(size_type i = 0; i != ranges_count_; ++i)
+          ranges_[i].bounds.store(pack(std::uint32_t(total * i / ranges_count_),
+                                       std::uint32_t(total * (i + 1) / ranges_count_)),
+                                  std::memory_order_relaxed);
+        {
+          std::lock_guard<std::mutex> lock{mutex_};
+          job_ = const_cast<void*>(static_cast<void const*>(&f));
+          invoke_ = [](void* job, size_type worker, size_type morsel) {
+            (*static_cast<job_type*>(job))(worker, morsel);
+          };
+          base_ = base;
+          running_ = threads_.size();
+          ++generation_;
+        }
+        wake_.notify_all();
+
+        process(0);
+
+        std::unique_lock<std::mutex> lock{mutex_};
+        done_.wait(lock, [this] { return running_ == 0; });
+      }
+    }
+
+
+  private:
+
+    struct alignas(64) range {
+      std::atomic<std::uint64_t> bounds{0}; // begin in high half, end in low one
+    }; // range
+
+    std::unique_ptr<range[]> ranges_;
+    size_type ranges_count_;
+    std::vector<std::thread> threads_;
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::uint64_t generation_{0};
+    size_type running_{0};
+    bool stopping_{false};
+    void (*invoke_)(void*, size_type, size_type){nullptr};
+    void* job_{nullptr};
+    size_type base_{0};
+
+    static constexpr size_type max_round = UINT32_MAX;
+
+
+    static std::uint64_t pack(std::uint32_t begin, std::uint32_t end) noexcept {
+      return (std::uint64_t(begin) << 32) | end;
+    }
+
+
+    static std::uint32_t begin_of(std::uint64_t bounds) noexcept { return std::uint32_t(bounds >> 32); }
+    static std::uint32_t end_of(std::uint64_t bounds) noexcept { return std::uint32_t(bounds); }
+
+
+    void stop() noexcept {
+      {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stopping_ = true;
+      }
+      wake_.notify_all();
+      for(std::thread& each: threads_)
+        each.join();
+      threads_.clear();
+    }
+
+
+    void work(size_type worker) noexcept {
+      std::uint64_t seen = 0;
+      for(;;) {
+        {
+          std::unique_lock<std::mutex> lock{mutex_};
+          wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+          if(stopping_)
+            return;
+          seen = generation_;
+        }
+        process(worker);
+        std::lock_guard<std::mutex> lock{mutex_};
+        if(--running_ == 0)
+          done_.notify_one();
+      }
+    }
+
+
+    void process(size_type worker) noexcept {
+      size_type morsel;
+      while(pop(worker, morsel) || steal(worker, morsel))
+        invoke_(job_, worker, base_ + morsel);
+    }
+
+
+    bool pop(size_type worker, size_type& morsel) noexcept {
+      std::atomic<std::uint64_t>& bounds = ranges_[worker].bounds;
+      std::uint64_t current = bounds.load(std::memory_order_acquire);
+      for(;;) {
+        std::uint32_t const begin = begin_of(current), end = end_of(current);
+        if(begin >= end)
+          return false;
+        if(bounds.compare_exchange_weak(current, pack(begin + 1, end), std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+          morsel = begin;
+          return true;
+        }
+      }
+    }
+
+
+    // Own range is empty here, so nobody else changes it until the store
+    bool steal(size_type worker, size_type& morsel) noexcept {
+      for(size_type i = 1; i != ranges_count_; ++i) {
+        std::atomic<std::uint64_t>& bounds = ranges_[(worker + i) % ranges_count_].bounds;
+        std::uint64_t current = bounds.load(std::memory_order_acquire);
+        for(;;) {
+          std::uint32_t const begin = begin_of(current), end = end_of(current);
+          if(begin >= end)
+            break;
+          std::uint32_t const middle = begin + (end - begin) / 2;
+          if(bounds.compare_exchange_weak(current, pack(begin, middle), std::memory_order_acq_rel,
+                                          std::memory_order_acquire)) {
+            morsel = middle;
+            ranges_[worker].bounds.store(pack(middle + 1, end), std::memory_order_release);
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
+  }; // thread_pool
+
+
+} // cellarium
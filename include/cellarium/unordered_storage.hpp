@@ -0,0 +1,463 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#include "file.hpp"
+#include "mapped_file.hpp"
+#include "header.hpp"
+#include "storage.hpp"
+#include "key.hpp"
+#include "simd.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  // Open addressing hash table of record indices in a mapped file:
+  //   header | control bytes | slots
+  // Slots are probed in groups of sixteen. A control byte holds seven bits
+  // of the hash of the key in its slot, or marks the slot empty or deleted,
+  // so a group is matched with a single SIMD compare and keys are read
+  // from records only for matching bytes. Groups are probed quadratically
+  class hash_index {
+  public:
+
+    using path_type = std::filesystem::path;
+    using size_type = std::uint32_t;
+    using index_type = std::uint32_t;
+
+    static constexpr index_type no_index = index_type(-1);
+    static constexpr size_type group_size = 16;
+    static constexpr std::uint32_t valid_signature = 0xDA1A4A54;
+    static constexpr std::uint32_t valid_format_version = 1;
+
+
+    hash_index() noexcept = default;
+    ~hash_index() { close(); }
+    hash_index(hash_index const&) = delete;
+    hash_index& operator = (hash_index const&) = delete;
+    explicit operator bool () const noexcept { return header_ != nullptr; }
+    size_type size() const noexcept { return header_->count; }
+    size_type capacity() const noexcept { return header_->capacity; }
+
+
+    // Load stays under 7/8 of slots, deleted ones included
+    bool needs_growth() const noexcept {
+      return std::uint64_t(header_->used + 1) * 8 > std::uint64_t(header_->capacity) * 7;
+    }
+
+
+    // Slots for at least items at the highest load
+    static size_type capacity_for(size_type items) noexcept {
+      size_type const needed = size_type(std::uint64_t(items) * 8 / 7 + 1);
+      size_type const capacity = header::ceil2(needed);
+      return capacity < group_size ? group_size : capacity;
+    }
+
+
+    // Empty index with room for items
+    bool create(path_type const& path, size_type items, record_key const& key, std::error_code& ec) noexcept {
+      close();
+      size_type const capacity = capacity_for(items);
+      {
+        auto f = file::create(path);
+        if(!f)
+          return (ec = file::last_error()), false;
+        if(!f.resize(file_size(capacity)))
+          return (ec = file::last_error()), false;
+      }
+      if(!map(path, ec))
+        return false;
+      *header_ = index_header{valid_signature, valid_format_version, 0, capacity, 0, 0,
+                              std::uint32_t(key.kind()), key.offset(), key.size(), {}};
+      bind();
+      std::memset(control_, empty, capacity);
+      return true;
+    }
+
+
+    // Fails with invalid_index unless the index was closed properly and
+    // built for key; rebuild it then
+    bool open(path_type const& path, record_key const& key, std::error_code& ec) noexcept {
+      close();
+      bool const exists = std::filesystem::exists(path, ec);
+      if(!!ec)
+        return false;
+      if(!exists)
+        return (ec = std::error_code{error::invalid_index}), false;
+      if(!map(path, ec))
+        return false;
+      index_header const& h = *header_;
+      if(region_.size < mapped_file::size_type(sizeof(index_header)) || h.signature != valid_signature
+         || h.format_version != valid_format_version || h.clean == 0
+         || h.key_kind != std::uint32_t(key.kind()) || h.key_offset != key.offset() || h.key_size != key.size()
+         || region_.size != file_size(h.capacity))
+        return (ec = std::error_code{error::invalid_index}), close(), false;
+      header_->clean = 0;
+      bind();
+      return true;
+    }
+
+
+    void close() noexcept {
+      if(header_ == nullptr)
+        return;
+      header_->clean = 1;
+      header_ = nullptr;
+      control_ = nullptr;
+      slots_ = nullptr;
+      region_ = mapped_file::region{};
+      mapped_file_ = mapped_file{};
+    }
+
+
+    // First index whose record satisfies equal(index) among those stored
+    // with hash
+    template<typename Equal>
+    index_type find(std::uint64_t hash, Equal&& equal) const noexcept {
+      index_type found = no_index;
+      probe(hash, [&](size_type slot) {
+        if(!equal(slots_[slot]))
+          return false;
+        found = slots_[slot];
+        return true;
+      });
+      return found;
+    }
+
+
+    // Calls f(index) for every index stored with hash; keys may differ
+    template<typename F> void for_each_match(std::uint64_t hash, F&& f) const {
+      probe(hash, [&](size_type slot) {
+        f(slots_[slot]);
+        return false;
+      });
+    }
+
+
+    // Needs room, see needs_growth
+    void insert(std::uint64_t hash, index_type index) noexcept {
+      size_type const groups_mask = header_->capacity / group_size - 1;
+      size_type group = size_type(hash >> 7) & groups_mask;
+      for(size_type step = 1;; group = (group + step++) & groups_mask) {
+        unsigned const free = detail::match_high_bits(control_ + group * group_size);
+        if(free == 0)
+          continue;
+        size_type const slot = group * group_size + detail::count_trailing_zeros(free);
+        if(control_[slot] == empty)
+          ++header_->used;
+        control_[slot] = tag_of(hash);
+        slots_[slot] = index;
+        ++header_->count;
+        return;
+      }
+    }
+
+
+    bool erase(std::uint64_t hash, index_type index) noexcept {
+      return probe(hash, [&](size_type slot) {
+        if(slots_[slot] != index)
+          return false;
+        control_[slot] = deleted;
+        --header_->count;
+        return true;
+      });
+    }
+
+
+  private:
+
+    struct index_header {
+      std::uint32_t signature;
+      std::uint32_t format_version;
+      std::uint32_t clean;
+      size_type capacity;
+      size_type count;
+      size_type used; // count and deleted slots
+      std::uint32_t key_kind;
+      std::uint32_t key_offset;
+      std::uint32_t key_size;
+      std::uint32_t reserved[7];
+    }; // index_header
+
+    static_assert(sizeof(index_header) == 64, "Control bytes start at a cache line");
+
+    static constexpr unsigned char empty = 0x80;
+    static constexpr unsigned char deleted = 0xFE;
+
+    mapped_file mapped_file_;
+    mapped_file::region region_;
+    index_header* header_{nullptr};
+    unsigned char* control_{nullptr};
+    index_type* slots_{nullptr};
+
+
+    static file::size_type file_size(size_type capacity) noexcept {
+      return file::size_type(sizeof(index_header)) + capacity + file::size_type(capacity) * sizeof(index_type);
+    }
+
+
+    static unsigned char tag_of(std::uint64_t hash) noexcept {
+      return static_cast<unsigned char>(hash & 0x7F);
+    }
+
+
+    bool map(path_type const& path, std::error_code& ec) noexcept {
+      mapped_file_ = mapped_file::open(path);
+      if(!mapped_file_)
+        return (ec = mapped_file::last_error()), false;
+      region_ = mapped_file_.map();
+      if(region_.address == nullptr)
+        return (ec = mapped_file::last_error()), (mapped_file_ = mapped_file{}), false;
+      header_ = reinterpret_cast<index_header*>(region_.address);
+      return true;
+    }
+
+
+    void bind() noexcept {
+      control_ = reinterpret_cast<unsigned char*>(region_.address + sizeof(index_header));
+      slots_ = reinterpret_cast<index_type*>(control_ + header_->capacity);
+    }
+
+
+    // Calls f(slot) for slots tagged as hash until it returns true; stops
+    // at a group with an empty slot
+    template<typename F> bool probe(std::uint64_t hash, F&& f) const noexcept {
+      size_type const groups_mask = header_->capacity / group_size - 1;
+      unsigned char const tag = tag_of(hash);
+      size_type group = size_type(hash >> 7) & groups_mask;
+      for(size_type step = 1; step <= groups_mask + 1; group = (group + step++) & groups_mask) {
+        unsigned char const* const control = control_ + group * group_size;
+        for(unsigned match = detail::match_bytes(control, tag); match != 0; match &= match - 1)
+          if(f(group * group_size + detail::count_trailing_zeros(match)))
+            return true;
+        if(detail::match_bytes(control, empty) != 0)
+          return false;
+      }
+      return false;
+    }
+
+  }; // hash_index
+
+
+  // Storage with unique keys in one of its fields, found through a hash
+  // index kept beside the file (path with ".hash" appended). The index
+  // persists, so opening needs no rebuild unless the storage or the index
+  // was not closed properly
+  template<typename T>
+  class unordered_storage {
+  public:
+
+    using storage_type = cellarium::storage<T>;
+    using path_type = typename storage_type::path_type;
+    using size_type = typename storage_type::size_type;
+    using index_type = typename storage_type::index_type;
+    using value_type = T;
+
+    static constexpr index_type no_index = storage_type::no_index;
+
+
+    static path_type index_path(path_type const& path) {
+      path_type result = path;
+      result += ".hash";
+      return result;
+    }
+
+
+    unordered_storage() noexcept = default;
+    ~unordered_storage() { close(); }
+    unordered_storage(unordered_storage const&) = delete;
+    unordered_storage& operator = (unordered_storage const&) = delete;
+    explicit operator bool () const noexcept { return !!storage_; }
+    cellarium::header const* header() const noexcept { return storage_.header(); }
+    storage_type const& storage() const noexcept { return storage_; }
+    hash_index const& index() const noexcept { return index_; }
+    record_key const& key() const noexcept { return key_; }
+    size_type size() const noexcept { return storage_.size(); }
+    void growth_factor(size_type factor) noexcept { storage_.growth_factor(factor); }
+
+
+    bool create(path_type const& path, class header const& specified, char const* key_name,
+                std::error_code& ec) noexcept {
+      close();
+      if(!bind_key(specified, key_name, ec) || !storage_.create(path, specified, ec))
+        return false;
+      index_path_ = index_path(path);
+      if(!index_.create(index_path_, specified.capacity(), key_, ec))
+        return storage_.close(), false;
+      return true;
+    }
+
+
+    bool open(path_type const& path, class header const& specified, char const* key_name,
+              std::error_code& ec) noexcept {
+      close();
+      if(!bind_key(specified, key_name, ec))
+        return false;
+      class header actual; size_type items_count;
+      if(!storage_type::read_info(path, actual, items_count, ec) || !storage_.open(path, specified, ec))
+        return false;
+      index_path_ = index_path(path);
+      std::error_code opening;
+      if(actual.clean() && index_.open(index_path_, key_, opening) && index_.size() == storage_.size())
+        return true;
+      if(!rebuild(storage_.size(), ec))
+        return storage_.close(), false;
+      return true;
+    }
+
+
+    void close() noexcept {
+      index_.close();
+      storage_.close();
+    }
+
+
+    index_type find(std::string_view key) const noexcept {
+      return index_.find(record_key::hash(key), [&](index_type i) { return key_.of(&record(i)) == key; });
+    }
+
+
+    template<typename V, typename = std::enable_if_t<std::is_arithmetic_v<V>>>
+    index_type find(V key) const noexcept {
+      char buffer[8];
+      return find(key_.encode(key, buffer));
+    }
+
+
+    // No index when the key is present already or the storage is full; ec
+    // is set only when the index can not be grown
+    index_type try_insert(T const& data, std::error_code& ec) noexcept {
+      std::string_view const key = key_.of(&data);
+      std::uint64_t const hash = record_key::hash(key);
+      if(index_.find(hash, [&](index_type i) { return key_.of(&record(i)) == key; }) != no_index)
+        return no_index;
+      if(index_.needs_growth() && !rebuild(index_.size() + 1, ec))
+        return no_index;
+      index_type const index = storage_.try_insert(data);
+      if(index == no_index)
+        return no_index;
+      index_.insert(hash, index);
+      return index;
+    }
+
+
+    // Replaces the record with the same key or inserts a new one
+    index_type insert_or_assign(T const& data, std::error_code& ec) noexcept {
+      index_type const found = find(key_.of(&data));
+      if(found == no_index)
+        return try_insert(data, ec);
+      storage_.update(found, data);
+      return found;
+    }
+
+
+    void remove(index_type index) noexcept {
+      index_.erase(record_key::hash(key_.of(&record(index))), index);
+      storage_.remove(index);
+    }
+
+
+    bool erase(std::string_view key) noexcept {
+      index_type const found = find(key);
+      if(found == no_index)
+        return false;
+      remove(found);
+      return true;
+    }
+
+
+    // Key of the record may change; false when the new key belongs to
+    // another record, nothing is updated then
+    bool update(index_type index, T const& data) noexcept {
+      std::string_view const old_key = key_.of(&record(index));
+      std::string_view const new_key = key_.of(&data);
+      if(old_key == new_key)
+        return storage_.update(index, data), true;
+      std::uint64_t const hash = record_key::hash(new_key);
+      if(index_.find(hash, [&](index_type i) { return key_.of(&record(i)) == new_key; }) != no_index)
+        return false;
+      index_.erase(record_key::hash(old_key), index);
+      storage_.update(index, data);
+      index_.insert(hash, index);
+      return true;
+    }
+
+
+    T const& operator [](index_type index) const noexcept {
+      return record(index);
+    }
+
+
+    template<typename F> void for_each(F&& f) const {
+      storage_.for_each(std::forward<F>(f));
+    }
+
+
+  private:
+
+    storage_type storage_;
+    hash_index index_;
+    record_key key_;
+    path_type index_path_;
+
+
+    T const& record(index_type index) const noexcept {
+      return storage_[index];
+    }
+
+
+    bool bind_key(class header const& specified, char const* key_name, std::error_code& ec) noexcept {
+      field const* const found = specified.find_field(key_name);
+      if(found == nullptr)
+        return (ec = std::error_code{error::field_not_found}), false;
+      key_ = record_key{*found};
+      return true;
+    }
+
+
+    // Index for at least items is built again from live records
+    bool rebuild(size_type items, std::error_code& ec) noexcept {
+      size_type const needed = storage_.size() > items ? storage_.size() : items;
+      if(!index_.create(index_path_, 2 * needed, key_, ec))
+        return false;
+      storage_.occupancy().for_each([&](index_type i) {
+        index_.insert(record_key::hash(key_.of(&record(i))), i);
+      });
+      return true;
+    }
+
+  }; // unordered_storage
+
+
+} // cellarium
@@ -0,0 +1,535 @@
+/* This file is part of cellarium library
+ * Copyright 2020 Andrei Ilin <ortfero@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#include "file.hpp"
+#include "mapped_file.hpp"
+#include "header.hpp"
+#include "occupancy_map.hpp"
+#include "storage.hpp"
+#include "migration.hpp"
+#include "key.hpp"
+#include "error.hpp"
+
+
+namespace cellarium {
+
+
+  // Storage opened over a file written with an older data version without
+  // converting it first. Records are upgraded a page of 64 slots (one
+  // occupancy word) at a time into a new file beside the old one (path
+  // with ".upgrading" appended), each page the first time one of its
+  // slots is touched. Upgraded pages are marked in a bitmap file (path
+  // with ".upgraded" appended), so the upgrade resumes after a restart.
+  // A background thread may upgrade the rest at a throttled rate. When
+  // the last page is upgraded the new file is renamed over the old one.
+  // Pages not upgraded keep the occupancy of the old file, so slots are
+  // never allocated over records still to convert. Every operation locks
+  // the storage, which is safe to use from several threads therefore
+  template<typename T>
+  class upgrading_storage {
+  public:
+
+    using storage_type = cellarium::storage<T>;
+    using path_type = typename storage_type::path_type;
+    using size_type = typename storage_type::size_type;
+    using index_type = typename storage_type::index_type;
+    using value_type = T;
+    using interval_type = std::chrono::microseconds;
+
+    static constexpr index_type no_index = storage_type::no_index;
+    static constexpr size_type page_slots = occupancy_map::bits_per_word;
+    static constexpr std::uint32_t valid_signature = 0xDA1AB175;
+    static constexpr std::uint32_t valid_format_version = 1;
+
+
+    static path_type upgrading_path(path_type const& path) {
+      path_type result = path;
+      result += ".upgrading";
+      return result;
+    }
+
+
+    static path_type bitmap_path(path_type const& path) {
+      path_type result = path;
+      result += ".upgraded";
+      return result;
+    }
+
+
+    upgrading_storage() noexcept = default;
+    ~upgrading_storage() { close(); }
+    upgrading_storage(upgrading_storage const&) = delete;
+    upgrading_storage& operator = (upgrading_storage const&) = delete;
+
+
+    explicit operator bool () const noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return !!storage_;
+    }
+
+
+    bool upgrading() const noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return bitmap_header_ != nullptr;
+    }
+
+
+    size_type pages_left() const noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return bitmap_header_ != nullptr ? bitmap_header_->pages_left : 0;
+    }
+
+
+    size_type size() const noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return storage_.size();
+    }
+
+
+    void growth_factor(size_type factor) noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      storage_.growth_factor(factor);
+    }
+
+
+    bool create(path_type const& path, class header const& specified, std::error_code& ec) noexcept {
+      close();
+      std::lock_guard<std::mutex> lock{mutex_};
+      return storage_.create(path, specified, ec);
+    }
+
+
+    // Opens a storage of the specified data version right away, or starts
+    // or resumes the upgrade of an older one. Upgraded records start as
+    // defaults, see record_converter
+    bool open(path_type const& path, class header const& specified, T const& defaults,
+              std::error_code& ec) noexcept {
+      close();
+      std::lock_guard<std::mutex> lock{mutex_};
+      try {
+        path_ = path;
+        upgrading_path_ = upgrading_path(path);
+        bitmap_path_ = bitmap_path(path);
+      } catch(std::bad_alloc const&) {
+        return (ec = std::error_code{error::not_enough_memory}), false;
+      }
+      defaults_ = defaults;
+
+      class header actual;
+      {
+        auto f = file::open_to_read(path);
+        if(!f)
+          return (ec = file::last_error()), false;
+        if(!f.read(actual))
+          return (ec = file::last_error()), false;
+      }
+      if(actual.data_version() == specified.data_version()) {
+        std::error_code removing;
+        std::filesystem::remove(bitmap_path_, removing);
+        return storage_.open(path, specified, ec);
+      }
+
+      if(!map_source(actual, specified, ec))
+        return false;
+      if(resume(actual, specified)) {
+        // Interrupted after the last page was upgraded
+        if(bitmap_header_->pages_left == 0 && !finish(ec))
+          return release_bitmap(), release_source(), storage_.close(), false;
+        return true;
+      }
+      if(!begin(actual, specified, ec))
+        return release_bitmap(), release_source(), storage_.close(), false;
+      return true;
+    }
+
+
+    // Stops the background upgrade; an unfinished one resumes on open
+    void close() noexcept {
+      stop();
+      std::lock_guard<std::mutex> lock{mutex_};
+      release_bitmap();
+      release_source();
+      storage_.close();
+    }
+
+
+    // Upgrades pages_per_step pages every interval from another thread
+    // until every page is upgraded. Throws std::system_error
+    void start(size_type pages_per_step, interval_type interval) {
+      stop();
+      stopping_ = false;
+      thread_ = std::thread{[this, pages_per_step, interval] {
+        std::unique_lock<std::mutex> lock{mutex_};
+        while(bitmap_header_ != nullptr && !failed_
+              && !wake_.wait_for(lock, interval, [this] { return stopping_; })) {
+          std::error_code ec;
+          if(!upgrade_pages(pages_per_step, ec))
+            last_error_ = ec, failed_ = true;
+        }
+      }};
+    }
+
+
+    void stop() noexcept {
+      if(!thread_.joinable())
+        return;
+      {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stopping_ = true;
+      }
+      wake_.notify_one();
+      thread_.join();
+    }
+
+
+    // Error which stopped the background upgrade, or the last one of
+    // upgrading a page on access
+    std::error_code last_error() const {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return last_error_;
+    }
+
+
+    // Upgrades every page left and finishes the upgrade
+    bool upgrade_all(std::error_code& ec) noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return bitmap_header_ == nullptr || upgrade_pages(bitmap_header_->pages, ec);
+    }
+
+
+    index_type try_insert(T const& data) noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      index_type const index = storage_.try_insert(data);
+      if(index != no_index)
+        upgrade_page_of(index);
+      return index;
+    }
+
+
+    void remove(index_type index) noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      upgrade_page_of(index);
+      storage_.remove(index);
+    }
+
+
+    void update(index_type index, T const& data) noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      upgrade_page_of(index);
+      storage_.update(index, data);
+    }
+
+
+    // Upgrades the page of index first. The reference stays valid until
+    // the storage grows
+    T const& operator [](index_type index) noexcept {
+      std::lock_guard<std::mutex> lock{mutex_};
+      upgrade_page_of(index);
+      return storage_[index];
+    }
+
+
+    // Upgrades pages as it goes
+    template<typename F> void for_each(F&& f) {
+      std::lock_guard<std::mutex> lock{mutex_};
+      occupancy_map const& live = storage_.occupancy();
+      for(size_type word = 0; word != live.words_count(); ++word) {
+        upgrade_page(word);
+        live.for_each(word, word + 1, [&](index_type i) { f(storage_[i]); });
+      }
+    }
+
+
+  private:
+
+    struct bitmap_header {
+      std::uint32_t signature;
+      std::uint32_t format_version;
+      std::uint32_t from_version;
+      std::uint32_t to_version;
+      size_type pages;
+      size_type pages_left;
+      std::uint32_t ready; // set once the new file is prepared
+      std::uint32_t reserved;
+      std::uint64_t source_hash; // of the old occupancy map
+      std::uint32_t reserved_tail[6];
+    }; // bitmap_header
+
+    static_assert(sizeof(bitmap_header) == 64, "Bitmap starts at a cache line");
+
+    mutable std::mutex mutex_;
+    storage_type storage_;
+    T defaults_{};
+    path_type path_;
+    path_type upgrading_path_;
+    path_type bitmap_path_;
+
+    // Old file
+    mapped_file source_file_;
+    mapped_file::region source_region_;
+    record_layout layout_{};
+    occupancy_map source_occupancy_;
+    record_converter converter_;
+
+    // Upgraded pages
+    mapped_file bitmap_file_;
+    mapped_file::region bitmap_region_;
+    bitmap_header* bitmap_header_{nullptr};
+    occupancy_map upgraded_;
+    size_type next_page_{0};
+
+    std::thread thread_;
+    std::condition_variable wake_;
+    bool stopping_{false};
+    bool failed_{false};
+    std::error_code last_error_;
+
+
+    static file::size_type bitmap_size(size_type pages) noexcept {
+      return file::size_type(sizeof(bitmap_header)) + file::size_type(occupancy_map::size_of(pages));
+    }
+
+
+    bool map_source(class header const& actual, class header const& specified, std::error_code& ec) noexcept {
+      auto const file_size = std::filesystem::file_size(path_, ec);
+      if(!!ec)
+        return false;
+      if(!actual.has_valid_signature())
+        return (ec = std::error_code{error::not_a_storage_file}), false;
+      if(!actual.has_valid_format_version())
+        return (ec = std::error_code{error::different_format_version}), false;
+      if(!record_layout::of(actual, file_size, layout_))
+        return (ec = std::error_code{error::invalid_file_size}), false;
+      if(!converter_.build(actual, specified, ec))
+        return false;
+      source_file_ = mapped_file::open(path_);
+      if(!source_file_)
+        return (ec = mapped_file::last_error()), false;
+      source_region_ = source_file_.map();
+      if(source_region_.address == nullptr)
+        return (ec = mapped_file::last_error()), (source_file_ = mapped_file{}), false;
+      source_occupancy_ = occupancy_map{
+        reinterpret_cast<occupancy_map::word_type*>(source_region_.address + layout_.occupancy_offset),
+        actual.capacity()};
+      return true;
+    }
+
+
+    // Tells the old file the upgrade began from
+    std::uint64_t source_hash() const noexcept {
+      return record_key::hash(std::string_view{reinterpret_cast<char const*>(source_occupancy_.data()),
+                                               occupancy_map::size_of(source_occupancy_.capacity())});
+    }
+
+
+    void release_source() noexcept {
+      source_occupancy_ = occupancy_map{};
+      source_region_ = mapped_file::region{};
+      source_file_ = mapped_file{};
+    }
+
+
+    bool map_bitmap(std::error_code& ec) noexcept {
+      bitmap_file_ = mapped_file::open(bitmap_path_);
+      if(!bitmap_file_)
+        return (ec = mapped_file::last_error()), false;
+      bitmap_region_ = bitmap_file_.map();
+      if(bitmap_region_.address == nullptr)
+        return (ec = mapped_file::last_error()), (bitmap_file_ = mapped_file{}), false;
+      bitmap_header_ = reinterpret_cast<bitmap_header*>(bitmap_region_.address);
+      return true;
+    }
+
+
+    void release_bitmap() noexcept {
+      bitmap_header_ = nullptr;
+      upgraded_ = occupancy_map{};
+      bitmap_region_ = mapped_file::region{};
+      bitmap_file_ = mapped_file{};
+    }
+
+
+    void bind_bitmap() noexcept {
+      upgraded_ = occupancy_map{reinterpret_cast<occupancy_map::word_type*>(
+                                  bitmap_region_.address + sizeof(bitmap_header)),
+                                bitmap_header_->pages};
+      next_page_ = 0;
+    }
+
+
+    // Continues an upgrade prepared before for the same versions
+    bool resume(class header const& actual, class header const& specified) noexcept {
+      std::error_code ec;
+      bool const prepared = std::filesystem::exists(bitmap_path_, ec) && std::filesystem::exists(upgrading_path_, ec);
+      if(!prepared || !map_bitmap(ec))
+        return false;
+      bitmap_header const& h = *bitmap_header_;
+      size_type const pages = source_occupancy_.words_count();
+      if(bitmap_region_.size != bitmap_size(pages) || h.signature != valid_signature
+         || h.format_version != valid_format_version || h.ready == 0 || h.pages != pages
+         || h.from_version != actual.data_version() || h.to_version != specified.data_version()
+         || h.source_hash != source_hash()
+         || !storage_.open(upgrading_path_, specified, ec))
+        return release_bitmap(), false;
+      bind_bitmap();
+      return true;
+    }
+
+
+    // New file takes the occupancy of the old one; slots stay unconverted
+    // until their pages are upgraded
+    bool begin(class header const& actual, class header const& specified, std::error_code& ec) noexcept {
+      size_type const capacity = specified.capacity() > actual.capacity() ? specified.capacity() : actual.capacity();
+      if(!storage_.create(upgrading_path_, header::with_page_number(header::with_capacity(specified, capacity),
+                                                                    actual.page_number()), ec))
+        return false;
+      std::memcpy(storage_.occupancy_.data(), source_occupancy_.data(),
+                  occupancy_map::size_of(actual.capacity()));
+      if(!storage_.repair(ec))
+        return false;
+
+      size_type const pages = source_occupancy_.words_count();
+      {
+        auto f = file::create(bitmap_path_);
+        if(!f)
+          return (ec = file::last_error()), false;
+        if(!f.resize(bitmap_size(pages)))
+          return (ec = file::last_error()), false;
+      }
+      if(!map_bitmap(ec))
+        return false;
+      *bitmap_header_ = bitmap_header{valid_signature, valid_format_version, actual.data_version(),
+                                      specified.data_version(), pages, pages, 0, 0, source_hash(), {}};
+      bind_bitmap();
+      for(size_type page = 0; page != pages; ++page)
+        if(source_occupancy_.word(page) == 0)
+          upgraded_.set(page), --bitmap_header_->pages_left;
+      // Occupancy of the new file is durable before a restart may resume it
+      if(!storage_.checkpoint(ec))
+        return false;
+      bitmap_header_->ready = 1;
+      if(!flush_bitmap(ec))
+        return false;
+      if(bitmap_header_->pages_left == 0)
+        return finish(ec);
+      return true;
+    }
+
+
+    void upgrade_page_of(index_type index) noexcept {
+      if(bitmap_header_ != nullptr && index / page_slots < bitmap_header_->pages)
+        upgrade_page(index / page_slots);
+    }
+
+
+    void upgrade_page(size_type page) noexcept {
+      if(bitmap_header_ == nullptr || page >= bitmap_header_->pages || upgraded_.test(page))
+        return;
+      convert_page(page);
+      std::error_code ec;
+      if(!mark_upgraded(page, page + 1, 1, ec))
+        last_error_ = ec;
+    }
+
+
+    // Converts records live in the old file; slots allocated in the page
+    // meanwhile were free there
+    void convert_page(size_type page) noexcept {
+      char const* const records = source_region_.address + layout_.records_offset;
+      source_occupancy_.for_each(page, page + 1, [&](index_type i) {
+        T data = defaults_;
+        converter_.convert(records + std::size_t(i) * layout_.record_size, reinterpret_cast<char*>(&data));
+        storage_.restore(i, data);
+      });
+    }
+
+
+    // Pages [first, last), converted ones among them, are marked only after
+    // their records reach the new file, so a restart never skips a page
+    // whose records were lost. They are marked even when writing fails,
+    // as converting again would overwrite later changes
+    bool mark_upgraded(size_type first, size_type last, size_type converted, std::error_code& ec) noexcept {
+      bool const written = storage_.flush_slots(first * page_slots, last * page_slots, ec);
+      for(size_type page = first; page != last; ++page)
+        upgraded_.set(page);
+      bitmap_header_->pages_left -= converted;
+      return written && flush_bitmap(ec);
+    }
+
+
+    bool flush_bitmap(std::error_code& ec) noexcept {
+      if(!bitmap_region_.flush(0, bitmap_region_.size))
+        return (ec = mapped_file::last_error()), false;
+      return true;
+    }
+
+
+    // Upgrades at most count pages, written and marked as one batch, and
+    // finishes when none are left
+    bool upgrade_pages(size_type count, std::error_code& ec) noexcept {
+      size_type const pages = bitmap_header_->pages;
+      size_type const first = next_page_;
+      size_type converted = 0;
+      for(; converted != count && next_page_ != pages; ++next_page_)
+        if(!upgraded_.test(next_page_))
+          convert_page(next_page_), ++converted;
+      if(converted != 0 && !mark_upgraded(first, next_page_, converted, ec))
+        return false;
+      if(bitmap_header_->pages_left != 0)
+        return true;
+      return finish(ec);
+    }
+
+
+    // New file is made durable and replaces the old one; the bitmap goes
+    // last, so an interrupted finish is completed on open
+    bool finish(std::error_code& ec) noexcept {
+      if(!storage_.checkpoint(ec))
+        return false;
+      release_source();
+      std::filesystem::rename(upgrading_path_, path_, ec);
+      if(!!ec)
+        return false;
+      release_bitmap();
+      std::filesystem::remove(bitmap_path_, ec);
+      return !ec;
+    }
+
+  }; // upgrading_storage
+
+
+} // cellarium
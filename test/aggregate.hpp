@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <system_error>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/aggregate.hpp>
+
+
+TEST_CASE("aggregate::storage") {
+  cellarium::storage<order> target;
+  std::error_code ec; REQUIRE(target.create("test.aggregate", order_header(256), ec));
+  for(int i = 0; i != 200; ++i)
+    REQUIRE(target.try_insert(order{i - 100, i * 0.5, std::uint32_t(i) * 15000000u, std::int16_t(-i)}) != target.no_index);
+  target.remove(100);
+
+  cellarium::summary result;
+  REQUIRE(cellarium::aggregate(target, "id", result, ec));
+  REQUIRE(result.count == 199);
+  REQUIRE(result.sum == -100.);
+  REQUIRE(result.min == -100.);
+  REQUIRE(result.max == 99.);
+
+  REQUIRE(cellarium::aggregate(target, "price", result, ec));
+  REQUIRE(result.sum == doctest::Approx(199 * 100 / 2. - 50.));
+  REQUIRE(result.average() == doctest::Approx((199 * 100 / 2. - 50.) / 199));
+
+  REQUIRE(cellarium::aggregate(target, "quantity", result, ec));
+  REQUIRE(result.max == 199. * 15000000.);
+  REQUIRE(result.min == 0.);
+
+  REQUIRE(cellarium::aggregate(target, "side", result, ec));
+  REQUIRE(result.min == -199.);
+  REQUIRE(result.sum == -199. * 200 / 2 + 100);
+
+  REQUIRE(!cellarium::aggregate(target, "none", result, ec));
+  REQUIRE(ec == cellarium::error::field_not_found);
+}
+
+
+struct levels {
+  float bids[3];
+}; // levels
+
+
+TEST_CASE("aggregate::nan") {
+  cellarium::storage<order> target;
+  std::error_code ec; REQUIRE(target.create("test.aggregate", order_header(256), ec));
+  for(int i = 0; i != 128; ++i) {
+    double const price = i % 5 == 0 ? std::numeric_limits<double>::quiet_NaN() : double(i);
+    REQUIRE(target.try_insert(order{i, price, 0u, 0}) != target.no_index);
+  }
+
+  // NaN is skipped by min and max in full blocks as in partial ones
+  cellarium::summary result;
+  REQUIRE(cellarium::aggregate(target, "price", result, ec));
+  REQUIRE(result.count == 128);
+  REQUIRE(result.min == 1.);
+  REQUIRE(result.max == 127.);
+}
+
+
+TEST_CASE("aggregate::array") {
+  cellarium::storage<levels> target;
+  auto const header = cellarium::header::make<levels>(1, 128, 0.5f, {cellarium::field::f32_array(3, "bids", "")});
+  std::error_code ec; REQUIRE(target.create("test.aggregate", header, ec));
+  for(int i = 0; i != 128; ++i)
+    REQUIRE(target.try_insert(levels{{float(i), float(i) + 1000, -1.f}}) != target.no_index);
+  cellarium::summary result;
+  REQUIRE(cellarium::aggregate(target, "bids", result, ec));
+  REQUIRE(result.count == 3 * 128);
+  REQUIRE(result.sum == 2 * 127. * 128 / 2 + 1000. * 128 - 128.);
+  REQUIRE(result.min == -1.);
+  REQUIRE(result.max == 1127.);
+}
+
+
+TEST_CASE("aggregate::paged_storage") {
+  cellarium::paged_storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 2, 0.7f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.aggregate.pages", 4, header, ec));
+  for(int i = 1; i != 8; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  cellarium::summary result;
+  REQUIRE(cellarium::aggregate(target, "id", result, ec));
+  REQUIRE(result.count == 7);
+  REQUIRE(result.sum == 28.);
+  REQUIRE(result.max == 7.);
+}
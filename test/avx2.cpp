@@ -0,0 +1,12 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+// Scan and aggregate cases again, built for the AVX2 kernels
+#if !defined(__AVX2__)
+#error "Build with AVX2 enabled"
+#endif
+
+#include "occupancy_map.hpp"
+#include "columnar_storage.hpp"
+#include "scan.hpp"
+#include "aggregate.hpp"
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/columnar_storage.hpp>
+
+
+struct tick {
+  std::int64_t time;
+  double price;
+  std::int32_t volume;
+}; // tick
+
+
+inline cellarium::header tick_header(cellarium::header::size_type capacity) {
+  using cellarium::field;
+  return cellarium::header::make<tick>(1, capacity, 0.5f, {
+    field::with_offset(field::i64("time", ""), offsetof(tick, time)),
+    field::with_offset(field::f64("price", ""), offsetof(tick, price)),
+    field::with_offset(field::i32("volume", ""), offsetof(tick, volume))
+  });
+}
+
+
+TEST_CASE("columnar_storage::columnar_storage") {
+  cellarium::columnar_storage<tick> target;
+  REQUIRE(!target);
+}
+
+
+TEST_CASE("columnar_storage::create") {
+  cellarium::columnar_storage<tick> target;
+  std::error_code ec;
+  REQUIRE(target.create("test.columns", tick_header(64), ec));
+  for(int i = 0; i != 64; ++i)
+    REQUIRE(target.try_insert(tick{i, i * 0.5, i * 10}) == cellarium::header::index_type(i));
+  REQUIRE(target.try_insert(tick{}) == target.no_index);
+  target.remove(5);
+  REQUIRE(target.try_insert(tick{100, 1., 2}) == 5);
+  
+  auto const volumes = target.column<std::int32_t>(2);
+  REQUIRE(volumes[5] == 2);
+  REQUIRE(volumes[63] == 630);
+  auto const prices = target.column<double>(1);
+  REQUIRE(prices[10] == 5.);
+  auto const record = target.get(7);
+  REQUIRE(record.time == 7);
+  REQUIRE(record.price == 3.5);
+  REQUIRE(record.volume == 70);
+}
+
+
+TEST_CASE("columnar_storage::open") {
+  cellarium::columnar_storage<tick> target;
+  std::error_code ec;
+  REQUIRE(target.open("test.columns", tick_header(64), ec));
+  REQUIRE(target.size() == 64);
+  REQUIRE(target.header()->capacity() == 128);
+  auto const times = target.column<std::int64_t>(0);
+  REQUIRE(times[5] == 100);
+  REQUIRE(times[63] == 63);
+  REQUIRE(target.get(20).price == 10.);
+  REQUIRE(target.try_insert(tick{1, 2., 3}) == 64);
+  std::int64_t volume = 0;
+  target.for_each([&](tick const& each) { volume += each.volume; });
+  REQUIRE(volume == 63 * 64 / 2 * 10 - 50 + 2 + 3);
+}
+
+
+TEST_CASE("columnar_storage::invalid_layout") {
+  using cellarium::field;
+  cellarium::columnar_storage<tick> target;
+  auto const overlapped = cellarium::header::make<tick>(1, 64, 0.5f, {
+    field::with_offset(field::i64("time", ""), sizeof(tick))
+  });
+  std::error_code ec;
+  REQUIRE(!target.create("test.columns", overlapped, ec));
+  REQUIRE(ec == cellarium::error::invalid_specified_header);
+
+  auto const aliased = cellarium::header::make<tick>(1, 64, 0.5f, {
+    field::with_offset(field::i64("time", ""), offsetof(tick, time)),
+    field::with_offset(field::i32("low", ""), offsetof(tick, time) + 4)
+  });
+  ec = std::error_code{};
+  REQUIRE(!target.create("test.columns", aliased, ec));
+  REQUIRE(ec == cellarium::error::invalid_specified_header);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/concurrent_storage.hpp>
+
+
+TEST_CASE("concurrent_storage::try_insert") {
+  using cellarium::concurrent_storage;
+  auto const header = cellarium::header::make<int>(1, 1 << 17, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec;
+  {
+    concurrent_storage<int> target;
+    REQUIRE(target.create("test.concurrent", header, ec));
+    
+    // Every thread keeps half of what it inserts, removed slots are reused
+    std::vector<std::vector<concurrent_storage<int>::index_type>> kept(8);
+    std::vector<std::thread> threads;
+    for(int t = 0; t != 8; ++t)
+      threads.emplace_back([&target, &kept, t] {
+        for(int i = 0; i != 20000; ++i) {
+          auto const index = target.try_insert(t * 100000 + i);
+          REQUIRE(index != target.no_index);
+          if(i % 2 == 0)
+            target.remove(index);
+          else
+            kept[t].push_back(index);
+        }
+      });
+    for(auto& each: threads)
+      each.join();
+    
+    REQUIRE(target.size() == 80000);
+    std::vector<concurrent_storage<int>::index_type> all;
+    for(int t = 0; t != 8; ++t) {
+      for(std::size_t i = 0; i != kept[t].size(); ++i)
+        REQUIRE(target[kept[t][i]] == t * 100000 + int(2 * i + 1));
+      all.insert(all.end(), kept[t].begin(), kept[t].end());
+    }
+    std::sort(all.begin(), all.end());
+    REQUIRE(std::adjacent_find(all.begin(), all.end()) == all.end());
+    target.remove(all.front());
+  }
+  
+  // Merged free list and counters survive reopening
+  cellarium::storage<int> reopened;
+  REQUIRE(reopened.open("test.concurrent", header, ec));
+  REQUIRE(reopened.size() == 79999);
+  REQUIRE(reopened.occupancy().count() == 79999);
+  auto const mark = reopened.header()->high_water_mark();
+  for(auto free = mark - 79999; free != 0; --free)
+    REQUIRE(reopened.try_insert(-1) < mark);
+  REQUIRE(reopened.try_insert(-1) == mark);
+}
+
+
+TEST_CASE("concurrent_storage::open unclean") {
+  using cellarium::concurrent_storage;
+  auto const header = cellarium::header::make<int>(1, 64, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec;
+  {
+    concurrent_storage<int> target;
+    REQUIRE(target.create("test.concurrent", header, ec));
+    for(int i = 0; i != 8; ++i)
+      REQUIRE(target.try_insert(i) == concurrent_storage<int>::index_type(i));
+    target.remove(2);
+    target.remove(5);
+  }
+  
+  // Header as of the last close, before two more inserts reused the free list
+  cellarium::header stale;
+  {
+    std::ifstream file("test.concurrent", std::ios::binary);
+    REQUIRE(file.read(reinterpret_cast<char*>(&stale), sizeof(stale)));
+  }
+  {
+    concurrent_storage<int> target;
+    REQUIRE(target.open("test.concurrent", header, ec));
+    REQUIRE(target.try_insert(20) != target.no_index);
+    REQUIRE(target.try_insert(50) != target.no_index);
+  }
+  
+  // Crash before the counters and free list were written back
+  stale.clean(false);
+  {
+    std::fstream file("test.concurrent", std::ios::binary | std::ios::in | std::ios::out);
+    REQUIRE(file.write(reinterpret_cast<char const*>(&stale), sizeof(stale)));
+  }
+  concurrent_storage<int> reopened;
+  REQUIRE(reopened.open("test.concurrent", header, ec));
+  REQUIRE(reopened.size() == 8);
+  REQUIRE(reopened.try_insert(8) == 8);
+  REQUIRE(reopened.size() == 9);
+  for(int i: {0, 1, 3, 4, 6, 7})
+    REQUIRE(reopened[i] == i);
+  REQUIRE(reopened[2] + reopened[5] == 70);
+}
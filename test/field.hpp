@@ -288,3 +288,12 @@ TEST_CASE("field::f64_array") {
   REQUIRE(f.size_of() == sizeof(for_kind<field_kind::f64>::type) * f.capacity());
   REQUIRE(f.align_of() == alignof(for_kind<field_kind::f64>::type));
 }
+
+
+TEST_CASE("field::with_offset") {
+  using namespace cellarium;
+  auto const f = field::with_offset(field::f64("test", "description"), 16);
+  REQUIRE(f);
+  REQUIRE(f.kind() == field_kind::f64);
+  REQUIRE(f.offset() == 16);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <system_error>
+#include <thread>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/storage.hpp>
+#include <cellarium/flusher.hpp>
+
+
+TEST_CASE("flusher::start") {
+  cellarium::storage<int> target;
+  target.durable(true);
+  auto const header = cellarium::header::make<int>(1, 4096, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.flusher", header, ec));
+  
+  cellarium::flusher background;
+  background.start(target, std::chrono::milliseconds{1});
+  REQUIRE(background.running());
+  target.growth_factor(2);
+  for(int i = 0; i != 20000; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  std::this_thread::sleep_for(std::chrono::milliseconds{5});
+  background.stop();
+  REQUIRE(!background.running());
+  REQUIRE(!background.last_error());
+  REQUIRE(target.checkpoint(ec));
+  target.close();
+  
+  REQUIRE(target.open("test.flusher", header, ec));
+  REQUIRE(target.size() == 20000);
+  REQUIRE(target[19999] == 19999);
+}
@@ -21,6 +21,10 @@ TEST_CASE("header::make") {
   REQUIRE(target.page_number() == 0);
   REQUIRE(target.occupancy_factor() == 0.7f);
   REQUIRE(target.free_index() == header::no_index);
+  REQUIRE(target.high_water_mark() == 0);
+  REQUIRE(target.items_count() == 0);
+  REQUIRE(target.clean());
+  REQUIRE(target.has_valid_items_count());
   REQUIRE(target.fields_count() == 1);
 }
 
@@ -41,3 +45,23 @@ TEST_CASE("header::with_page_number") {
   REQUIRE(!!target);
   REQUIRE(target.page_number() == 1);
 }
+
+
+TEST_CASE("header::with_allocation") {
+  using cellarium::header;
+  using cellarium::allocation_policy;
+  auto const base = header::make<std::int32_t>(1, 17, 0.7f, {cellarium::field::i32("field", "")});
+  REQUIRE(base.allocation() == allocation_policy::free_list);
+  auto const target = header::with_allocation(base, allocation_policy::lowest_free);
+  REQUIRE(!!target);
+  REQUIRE(target.allocation() == allocation_policy::lowest_free);
+}
+
+
+TEST_CASE("header::find_field") {
+  using cellarium::header;
+  auto const target = header::make<std::int64_t>(1, 17, 0.7f, {cellarium::field::i32("a", ""),
+                                                               cellarium::field::i32("b", "")});
+  REQUIRE(target.find_field("b") == &target.field_at(1));
+  REQUIRE(target.find_field("c") == nullptr);
+}
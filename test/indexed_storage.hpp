@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <system_error>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/indexed_storage.hpp>
+
+
+TEST_CASE("indexed_storage::update") {
+  using cellarium::index_kind;
+  cellarium::indexed_storage<account> target;
+  auto const header = account_header(256);
+  std::error_code ec;
+  REQUIRE(target.create("test.indexed", header, {{"name", index_kind::hash}, {"balance", index_kind::ordered}}, ec));
+  target.growth_factor(2);
+  for(std::int64_t i = 0; i != 3000; ++i)
+    REQUIRE(target.try_insert(make_account(i, double(i % 100)), ec) != target.no_index);
+  REQUIRE(target.size() == 3000);
+
+  auto const found = target.find("name", "user1234");
+  REQUIRE(found != target.no_index);
+  REQUIRE(target[found].id == 1234);
+  std::size_t count = 0;
+  target.for_each_equal("balance", 34., [&](auto i) { REQUIRE(target[i].balance == 34.); ++count; });
+  REQUIRE(count == 30);
+
+  // Indexes follow updates, in-place modifications and removals
+  REQUIRE(target.update(found, make_account(1234, 500.), ec));
+  REQUIRE(target.modify(target.find("name", "user7"), [](account& a) { a.name[4] = 'X'; }, ec));
+  target.remove(target.find("name", "user8"));
+  REQUIRE(target.find("name", "user7") == target.no_index);
+  REQUIRE(target[target.find("name", "userX")].id == 7);
+  REQUIRE(target.find("name", "user8") == target.no_index);
+  REQUIRE(target.find("balance", 500.) == found);
+
+  // Fields without an index are scanned
+  REQUIRE(target[target.find("id", 2999)].balance == 99.);
+  std::vector<double> balances;
+  target.for_range("balance", 98.5, 1000., [&](auto i) { balances.push_back(target[i].balance); });
+  REQUIRE(balances.size() == 31);
+  REQUIRE(balances.back() == 500.);
+  count = 0;
+  target.for_prefix("name", "user29", [&](auto) { ++count; });
+  REQUIRE(count == 111);
+  count = 0;
+  target.for_range("id", 10, 20, [&](auto) { ++count; });
+  REQUIRE(count == 10);
+}
+
+
+TEST_CASE("indexed_storage::open") {
+  using cellarium::index_kind;
+  auto const header = account_header(64);
+  std::error_code ec;
+  {
+    cellarium::indexed_storage<account, cellarium::paged_storage<account>> target;
+    REQUIRE(target.create("test.indexed", 1, header, {{"id", index_kind::ordered}}, ec));
+    for(std::int64_t i = 0; i != 50; ++i)
+      REQUIRE(target.try_insert(make_account(i * 2, 0.), ec) != target.no_index);
+  }
+  {
+    // Index persists
+    cellarium::indexed_storage<account, cellarium::paged_storage<account>> target;
+    REQUIRE(target.open("test.indexed", 4, header, {{"id", index_kind::ordered}}, ec));
+    REQUIRE(target.find("id", 3) == target.no_index);
+    REQUIRE(target[target.find("id", 48)].id == 48);
+    for(std::int64_t i = 0; i != 100; ++i)
+      REQUIRE(target.try_insert(make_account(i * 2 + 1, 0.), ec) != target.no_index);
+    REQUIRE(target.storage().pages_count() > 1);
+    std::vector<std::int64_t> ids;
+    target.for_range("id", 95, 100, [&](auto i) { ids.push_back(target[i].id); });
+    REQUIRE(ids == std::vector<std::int64_t>{95, 96, 97, 98, 99});
+  }
+
+  // Merged pages get their indexes built again
+  cellarium::indexed_storage<account, cellarium::paged_storage<account>> target;
+  REQUIRE(target.open("test.indexed", 4, header, {{"id", index_kind::ordered}, {"name", index_kind::hash}}, ec));
+  REQUIRE(target.size() == 150);
+  REQUIRE(target[target.find("id", 149)].id == 149);
+  REQUIRE(target[target.find("name", "user77")].id == 77);
+
+  REQUIRE(!target.open("test.indexed", 4, header, {{"missing", index_kind::hash}}, ec));
+  REQUIRE(ec == cellarium::error::field_not_found);
+  REQUIRE(!target.open("test.indexed", 4, header, {{"id", index_kind::hash}, {"id", index_kind::hash}}, ec));
+  REQUIRE(ec == cellarium::error::invalid_specified_header);
+}
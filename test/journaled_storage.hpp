@@ -0,0 +1,105 @@
+#pragma once
+
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/file.hpp>
+#include <cellarium/journal.hpp>
+#include <cellarium/journaled_storage.hpp>
+
+
+TEST_CASE("journaled_storage::open") {
+  using cellarium::journal_entry;
+  auto const header = cellarium::header::make<int>(1, 64, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec;
+  {
+    cellarium::storage<int> plain;
+    REQUIRE(plain.create("test.journaled", header, ec));
+  }
+  
+  // Log left by a crash: committed entries followed by a torn one
+  {
+    cellarium::journal log;
+    REQUIRE(log.open("test.journaled.journal", ec));
+    for(int i = 0; i != 100; ++i)
+      log.append(journal_entry::insert, cellarium::journal::index_type(i), &i, sizeof(i));
+    log.append(journal_entry::remove, 3, nullptr, 0);
+    int const updated = -5;
+    log.append(journal_entry::update, 5, &updated, sizeof(updated));
+    REQUIRE(log.commit(ec));
+  }
+  {
+    auto f = cellarium::file::open_to_append("test.journaled.journal");
+    char const torn[] = {1, 2, 3, 4, 5, 6, 7};
+    REQUIRE(f.write(torn, sizeof(torn)));
+  }
+  
+  cellarium::journaled_storage<int> target;
+  target.growth_factor(2);
+  REQUIRE(target.open("test.journaled", header, ec));
+  REQUIRE(target.size() == 99);
+  REQUIRE(target.header()->capacity() >= 100);
+  REQUIRE(target.get(99) == 99);
+  REQUIRE(target.get(5) == -5);
+  REQUIRE(!target.storage().occupancy().test(3));
+  REQUIRE(std::filesystem::file_size("test.journaled.journal") == 0);
+  
+  // Free slot left by the replayed remove is reused
+  REQUIRE(target.try_insert(42) == 3);
+}
+
+
+TEST_CASE("journaled_storage::commit") {
+  auto const header = cellarium::header::make<int>(1, 1024, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec;
+  {
+    cellarium::journaled_storage<int> target;
+    REQUIRE(target.create("test.journaled", header, ec));
+    target.growth_factor(2);
+    target.checkpoint_size(64 << 10);
+    std::vector<std::thread> writers;
+    for(int t = 0; t != 4; ++t)
+      writers.emplace_back([&target, t] {
+        std::error_code commit_ec;
+        for(int i = 0; i != 500; ++i) {
+          REQUIRE(target.try_insert(t * 1000 + i) != target.no_index);
+          REQUIRE(target.commit(commit_ec));
+        }
+      });
+    for(auto& each: writers)
+      each.join();
+    REQUIRE(target.size() == 2000);
+    target.remove(0);
+    REQUIRE(target.commit(ec));
+  }
+  
+  cellarium::journaled_storage<int> target;
+  REQUIRE(target.open("test.journaled", header, ec));
+  REQUIRE(target.size() == 1999);
+}
+
+
+TEST_CASE("journaled_storage::try_insert") {
+  auto const header = cellarium::header::make<int>(1, 64, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec;
+  {
+    cellarium::journaled_storage<int> target;
+    REQUIRE(target.create("test.journaled", header, ec));
+    target.growth_factor(2);
+    for(int i = 0; i != 100; ++i)
+      REQUIRE(target.try_insert(i) != target.no_index);
+    REQUIRE(target.header()->capacity() == 128);
+    REQUIRE(target.commit(ec));
+  }
+
+  // Growth interrupted before its header reached the disk
+  auto const published = std::filesystem::file_size("test.journaled");
+  std::filesystem::resize_file("test.journaled", published * 2);
+  cellarium::journaled_storage<int> target;
+  REQUIRE(target.open("test.journaled", header, ec));
+  REQUIRE(target.size() == 100);
+  REQUIRE(target.get(99) == 99);
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/json.hpp>
+
+
+namespace {
+
+  struct quote {
+    std::int64_t time;
+    std::int64_t session;
+    double price;
+    float ratio;
+    std::int32_t levels[3];
+    char symbol[12];
+    short venue[6];
+  };
+
+
+  cellarium::header quote_header() {
+    using cellarium::field;
+    using cellarium::field_view;
+    field time = field::with_offset(field::i64("time", ""), offsetof(quote, time));
+    time.view(field_view::utc_time_milliseconds());
+    field session = field::with_offset(field::i64("session", ""), offsetof(quote, session));
+    session.view(field_view::local_time_seconds());
+    field price = field::with_offset(field::f64("price", ""), offsetof(quote, price));
+    price.view(field_view::fixed(10, 2));
+    return cellarium::header::make<quote>(1, 4096, 0.5f, {
+      time, session, price,
+      field::with_offset(field::f32("ratio", ""), offsetof(quote, ratio)),
+      field::with_offset(field::i32_array(3, "levels", ""), offsetof(quote, levels)),
+      field::with_offset(field::string(11, "symbol", ""), offsetof(quote, symbol)),
+      field::with_offset(field::utf16_string(5, "venue", ""), offsetof(quote, venue))
+    });
+  }
+
+
+  void write_text(char const* path, char const* text) {
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    out << text;
+  }
+
+}
+
+
+TEST_CASE("json_format::write") {
+  cellarium::json_format format{quote_header()};
+  quote q{1600000000123, -86399, 1.005, 0.1f, {1, -2, 3}, "A\"B\\\n", {'X', 0x416, short(0xD83D), short(0xDE00), 0, 0}};
+  std::string line(format.max_line_size(), '\0');
+  char* const end = format.write(reinterpret_cast<char const*>(&q), line.data());
+  line.resize(std::size_t(end - line.data()));
+  REQUIRE(line == "{\"time\":\"2020-09-13T12:26:40.123Z\",\"session\":\"1969-12-31T00:00:01\","
+                  "\"price\":1.00,\"ratio\":0.1,\"levels\":[1,-2,3],"
+                  "\"symbol\":\"A\\\"B\\\\\\n\",\"venue\":\"X\xD0\x96\xF0\x9F\x98\x80\"}\n");
+
+  quote back{};
+  REQUIRE(format.read(line.data(), line.data() + line.size(), reinterpret_cast<char*>(&back)));
+  REQUIRE(back.time == q.time);
+  REQUIRE(back.session == q.session);
+  REQUIRE(back.price == 1.);
+  REQUIRE(back.ratio == q.ratio);
+  REQUIRE(back.levels[1] == -2);
+  REQUIRE(std::strcmp(back.symbol, q.symbol) == 0);
+  REQUIRE(std::memcmp(back.venue, q.venue, sizeof(q.venue)) == 0);
+}
+
+
+TEST_CASE("json_format::read") {
+  cellarium::json_format format{quote_header()};
+  quote q{};
+  q.ratio = 7.f;
+  char const line[] = " { \"levels\" : [ 4 ] , \"other\" : {\"a\":[1,\"]\"]}, \"price\":2.5e1,"
+                      " \"time\":1, \"session\":\"2000-01-01 00:00:00.9Z\", \"symbol\":\"\\u00e9tat-long-name\","
+                      " \"venue\":\"\\ud83d\\ude00abcd\" }  ";
+  REQUIRE(format.read(line, line + sizeof(line) - 1, reinterpret_cast<char*>(&q)));
+  REQUIRE(q.levels[0] == 4);
+  REQUIRE(q.levels[1] == 0);
+  REQUIRE(q.price == 25.);
+  REQUIRE(q.ratio == 7.f);
+  REQUIRE(q.time == 1);
+  REQUIRE(q.session == 946684800);
+  REQUIRE(std::strcmp(q.symbol, "\xC3\xA9tat-long-") == 0);
+  REQUIRE(q.venue[0] == short(0xD83D));
+  REQUIRE(q.venue[3] == 'b');
+  REQUIRE(q.venue[5] == 0);
+
+  char const* const invalid[] = {
+    "", "{", "{\"time\":}", "{\"time\":1,}", "{\"time\":1.5}", "{\"levels\":[1,2,3,4]}",
+    "{\"symbol\":\"a\nb\"}", "{\"session\":\"2000-13-01T00:00:00\"}", "{\"time\":1} x"
+  };
+  for(char const* each: invalid)
+    REQUIRE(!format.read(each, each + std::strlen(each), reinterpret_cast<char*>(&q)));
+}
+
+
+TEST_CASE("export_json") {
+  std::error_code ec;
+  cellarium::storage<quote> source;
+  REQUIRE(source.create("test.json.storage", quote_header(), ec));
+  for(std::int32_t i = 0; i != 3000; ++i) {
+    quote q{std::int64_t(i) * 1001, i, i / 4., float(i) / 3.f, {i, -i, 0}, {}, {'v', 0}};
+    std::snprintf(q.symbol, sizeof(q.symbol), "s\"%d", i);
+    REQUIRE(source.try_insert(q) != source.no_index);
+  }
+  REQUIRE(cellarium::export_json(source, "test.json", ec));
+
+  cellarium::storage<quote> target;
+  REQUIRE(target.create("test.json.imported", quote_header(), ec));
+  REQUIRE(cellarium::import_json(target, "test.json", ec));
+  REQUIRE(target.size() == 3000);
+  std::size_t matched = 0;
+  target.for_each([&](quote const& q) {
+    auto const i = q.levels[0];
+    char symbol[12];
+    std::snprintf(symbol, sizeof(symbol), "s\"%d", i);
+    matched += q.time == std::int64_t(i) * 1001 && q.session == i && q.price == i / 4.
+               && q.ratio == float(i) / 3.f && q.levels[1] == -i && std::strcmp(q.symbol, symbol) == 0
+               && q.venue[0] == 'v';
+  });
+  REQUIRE(matched == 3000);
+}
+
+
+TEST_CASE("import_json") {
+  std::error_code ec;
+  cellarium::storage<quote> target;
+  REQUIRE(target.create("test.json.imported", quote_header(), ec));
+  quote defaults{};
+  defaults.ratio = 0.5f;
+
+  write_text("test.json", "{\"time\":5}\r\n\n   \n{\"time\":6}");
+  REQUIRE(cellarium::import_json(target, "test.json", defaults, ec));
+  REQUIRE(target.size() == 2);
+  target.for_each([&](quote const& q) { REQUIRE(q.ratio == 0.5f); });
+
+  write_text("test.json", "{\"time\":7}\n{\"time\":\n{\"time\":8}\n");
+  REQUIRE(!cellarium::import_json(target, "test.json", defaults, ec));
+  REQUIRE(ec == cellarium::error::invalid_json_data);
+  REQUIRE(target.size() == 3);
+}
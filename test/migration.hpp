@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/migration.hpp>
+
+
+namespace {
+
+  struct item_v1 {
+    std::int32_t id;
+    float price;
+    char name[16];
+    std::int64_t stock;
+    std::int64_t obsolete;
+  };
+
+
+  struct item_v2 {
+    std::int64_t id;
+    double price;
+    char name[8];
+    std::int16_t stock;
+    std::int16_t reorder;
+  };
+
+
+  cellarium::header item_v1_header() {
+    using cellarium::field;
+    return cellarium::header::make<item_v1>(1, 256, 0.5f, {
+      field::with_offset(field::i32("id", ""), offsetof(item_v1, id)),
+      field::with_offset(field::f32("price", ""), offsetof(item_v1, price)),
+      field::with_offset(field::string(15, "name", ""), offsetof(item_v1, name)),
+      field::with_offset(field::i64("stock", ""), offsetof(item_v1, stock)),
+      field::with_offset(field::i64("obsolete", ""), offsetof(item_v1, obsolete))
+    });
+  }
+
+
+  cellarium::header item_v2_header() {
+    using cellarium::field;
+    return cellarium::header::make<item_v2>(2, 64, 0.5f, {
+      field::with_offset(field::i64("id", ""), offsetof(item_v2, id)),
+      field::with_offset(field::f64("price", ""), offsetof(item_v2, price)),
+      field::with_offset(field::string(7, "name", ""), offsetof(item_v2, name)),
+      field::with_offset(field::i16("stock", ""), offsetof(item_v2, stock)),
+      field::with_offset(field::i16("reorder", ""), offsetof(item_v2, reorder))
+    });
+  }
+
+}
+
+
+TEST_CASE("migrate") {
+  std::error_code ec;
+  {
+    cellarium::storage<item_v1> source;
+    REQUIRE(source.create("test.migration", item_v1_header(), ec));
+    for(std::int32_t i = 0; i != 200; ++i) {
+      item_v1 item{i, float(i) + .5f, {}, std::int64_t(i) * 400 - 40000, 1};
+      std::snprintf(item.name, sizeof(item.name), "item-%03d-\xC3\xA9", i);
+      REQUIRE(source.try_insert(item) != source.no_index);
+    }
+    for(std::uint32_t i = 0; i < 200; i += 3)
+      source.remove(i);
+  }
+
+  cellarium::thread_pool pool{2};
+  item_v2 defaults{};
+  defaults.reorder = 7;
+  REQUIRE(cellarium::migrate("test.migration", item_v2_header(), defaults, pool, ec));
+  REQUIRE(!std::filesystem::exists("test.migration.migrating"));
+  // Same data version is left as it is
+  REQUIRE(cellarium::migrate("test.migration", item_v2_header(), defaults, ec));
+
+  cellarium::storage<item_v2> target;
+  REQUIRE(target.open("test.migration", item_v2_header(), ec));
+  REQUIRE(target.size() == 133);
+  for(std::uint32_t i = 0; i != 200; ++i) {
+    REQUIRE(target.occupancy().test(i) == (i % 3 != 0));
+    if(i % 3 == 0)
+      continue;
+    item_v2 const& item = target[i];
+    REQUIRE(item.id == i);
+    REQUIRE(item.price == double(i) + .5);
+    char name[16];
+    std::snprintf(name, sizeof(name), "item-%03u", i);
+    name[7] = '\0';
+    REQUIRE(std::strcmp(item.name, name) == 0);
+    // Stock saturates at the bounds of int16
+    std::int64_t const stock = std::int64_t(i) * 400 - 40000;
+    REQUIRE(item.stock == (stock < -32768 ? -32768 : stock > 32767 ? 32767 : stock));
+    REQUIRE(item.reorder == 7);
+  }
+}
+
+
+TEST_CASE("record_converter::build") {
+  using cellarium::field;
+  auto const from = cellarium::header::make<item_v1>(1, 64, 0.5f, {
+    field::with_offset(field::i32("id", ""), 0),
+    field::with_offset(field::string(7, "name", ""), 8)
+  });
+  auto const to = cellarium::header::make<item_v1>(2, 64, 0.5f, {
+    field::with_offset(field::i32("id", ""), 0),
+    field::with_offset(field::i64("name", ""), 8)
+  });
+  cellarium::record_converter converter;
+  std::error_code ec;
+  REQUIRE(!converter.build(from, to, ec));
+  REQUIRE(ec == cellarium::error::incompatible_fields);
+
+  // Strings are cut before an incomplete UTF-8 sequence
+  auto const narrow = cellarium::header::make<item_v1>(2, 64, 0.5f, {
+    field::with_offset(field::string(4, "name", ""), 8)
+  });
+  REQUIRE(converter.build(from, narrow, ec));
+  char source[16] = {0, 0, 0, 0, 0, 0, 0, 0, 'a', 'b', 'c', '\xC3', '\xA9', 0};
+  char target[16];
+  std::memset(target, 'x', sizeof(target));
+  converter.convert(source, target);
+  REQUIRE(std::strcmp(target + 8, "abc") == 0);
+  REQUIRE(target[12] == 0);
+  REQUIRE(target[13] == 'x');
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/occupancy_index.hpp>
+
+
+TEST_CASE("occupancy_index::occupancy_index") {
+  cellarium::occupancy_index target;
+  REQUIRE(!target);
+}
+
+
+TEST_CASE("occupancy_index::find_first") {
+  using namespace cellarium;
+  constexpr occupancy_map::size_type capacity = 1 << 20;
+  std::vector<occupancy_map::word_type> words(occupancy_map::words_for(capacity));
+  occupancy_map map{words.data(), capacity};
+  occupancy_index target;
+  target.build(map);
+  REQUIRE(target);
+  REQUIRE(target.find_first(map) == 0);
+  
+  for(occupancy_map::index_type i = 0; i != capacity - 1; ++i) {
+    map.set(i);
+    target.occupied(map, i);
+  }
+  REQUIRE(target.find_first(map) == capacity - 1);
+  map.set(capacity - 1);
+  target.occupied(map, capacity - 1);
+  REQUIRE(target.find_first(map) == occupancy_index::no_index);
+  
+  map.reset(777777);
+  target.released(777777);
+  map.reset(5000);
+  target.released(5000);
+  REQUIRE(target.find_first(map) == 5000);
+  REQUIRE(target.find_next(map, 5001) == 777777);
+  REQUIRE(target.find_next(map, 777778) == occupancy_index::no_index);
+}
+
+
+TEST_CASE("occupancy_index::build") {
+  using namespace cellarium;
+  std::vector<occupancy_map::word_type> words(occupancy_map::words_for(32));
+  occupancy_map map{words.data(), 32};
+  for(occupancy_map::index_type i = 0; i != 31; ++i)
+    map.set(i);
+  occupancy_index target;
+  target.build(map);
+  REQUIRE(target.find_first(map) == 31);
+  map.set(31);
+  target.occupied(map, 31);
+  REQUIRE(target.find_first(map) == occupancy_index::no_index);
+}
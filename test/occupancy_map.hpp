@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/occupancy_map.hpp>
+
+
+TEST_CASE("occupancy_map::occupancy_map") {
+  cellarium::occupancy_map target;
+  REQUIRE(!target);
+}
+
+
+TEST_CASE("occupancy_map::words_for") {
+  using cellarium::occupancy_map;
+  REQUIRE(occupancy_map::words_for(2) == 1);
+  REQUIRE(occupancy_map::words_for(64) == 1);
+  REQUIRE(occupancy_map::words_for(65) == 2);
+  REQUIRE(occupancy_map::size_of(1024) == 128);
+}
+
+
+TEST_CASE("occupancy_map::set") {
+  using cellarium::occupancy_map;
+  std::vector<occupancy_map::word_type> words(occupancy_map::words_for(1024));
+  occupancy_map target{words.data(), 1024};
+  target.clear();
+  target.set(0);
+  target.set(63);
+  target.set(64);
+  target.set(1023);
+  REQUIRE(target.test(0));
+  REQUIRE(target.test(63));
+  REQUIRE(target.test(64));
+  REQUIRE(!target.test(65));
+  REQUIRE(target.test(1023));
+  REQUIRE(target.count() == 4);
+  target.reset(63);
+  REQUIRE(!target.test(63));
+  REQUIRE(target.count() == 3);
+}
+
+
+TEST_CASE("occupancy_map::for_each") {
+  using cellarium::occupancy_map;
+  std::vector<occupancy_map::word_type> words(occupancy_map::words_for(4096));
+  occupancy_map target{words.data(), 4096};
+  target.clear();
+  std::vector<occupancy_map::index_type> const expected{1, 2, 300, 1000, 4095};
+  for(auto each: expected)
+    target.set(each);
+  std::vector<occupancy_map::index_type> visited;
+  target.for_each([&](occupancy_map::index_type index) { visited.push_back(index); });
+  REQUIRE(visited == expected);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/ordered_storage.hpp>
+
+
+TEST_CASE("ordered_storage::for_range") {
+  cellarium::ordered_storage<account> target;
+  auto const header = account_header(1024);
+  std::error_code ec; REQUIRE(target.create("test.ordered", header, "balance", ec));
+  target.growth_factor(2);
+  // Balances in scrambled order, each one twice, half of them negative
+  for(std::int64_t i = 0; i != 20000; ++i) {
+    std::int64_t const n = (i * 7919) % 10000;
+    REQUIRE(target.try_insert(make_account(i, double(n - 5000) / 4), ec) != target.no_index);
+  }
+  REQUIRE(target.index().size() == 20000);
+  REQUIRE(target.index().height() > 2);
+
+  std::vector<double> keys;
+  target.for_each_ordered([&](auto i) { keys.push_back(target[i].balance); });
+  REQUIRE(keys.size() == 20000);
+  for(std::size_t i = 1; i != keys.size(); ++i)
+    REQUIRE(keys[i - 1] <= keys[i]);
+  REQUIRE(keys.front() == -1250.);
+  REQUIRE(keys.back() == 1249.75);
+
+  keys.clear();
+  target.for_range(-1., 1., [&](auto i) { keys.push_back(target[i].balance); });
+  REQUIRE(keys == std::vector<double>{-1., -1., -.75, -.75, -.5, -.5, -.25, -.25, 0., 0., .25, .25, .5, .5, .75, .75});
+  REQUIRE(target[target.lower_bound(-0.1)].balance == 0.);
+  REQUIRE(target.lower_bound(1250.) == target.no_index);
+
+  // Removed and updated records leave their places
+  std::size_t removed = 0;
+  for(cellarium::header::index_type i = 0; i != 20000; i += 2) {
+    if(target[i].balance >= 0.)
+      target.remove(i), ++removed;
+  }
+  auto const moved = target.lower_bound(-1250.);
+  REQUIRE(target.update(moved, make_account(0, 5000.), ec));
+  REQUIRE(target.index().size() == 20000 - removed);
+  std::size_t count = 0;
+  double previous = -10000.;
+  target.for_each_ordered([&](auto i) { REQUIRE(previous <= target[i].balance); previous = target[i].balance; ++count; });
+  REQUIRE(count == 20000 - removed);
+  REQUIRE(previous == 5000.);
+}
+
+
+TEST_CASE("ordered_storage::for_prefix") {
+  auto const header = account_header(64);
+  std::error_code ec;
+  {
+    cellarium::ordered_storage<account> target;
+    REQUIRE(target.create("test.ordered", header, "name", ec));
+    target.growth_factor(2);
+    for(std::int64_t i = 1000; i-- != 0;)
+      REQUIRE(target.try_insert(make_account(i, double(i)), ec) != target.no_index);
+  }
+  {
+    // Index persists, scans work right after open
+    cellarium::ordered_storage<account> target;
+    REQUIRE(target.open("test.ordered", header, "name", ec));
+    std::vector<std::string> names;
+    target.for_prefix("user12", [&](auto i) { names.push_back(target[i].name); });
+    REQUIRE(names == std::vector<std::string>{"user12", "user120", "user121", "user122", "user123",
+                                              "user124", "user125", "user126", "user127", "user128", "user129"});
+    REQUIRE(target[target.lower_bound("user00")].id == 1);
+    REQUIRE(target.lower_bound("user9990") == target.no_index);
+  }
+
+  // Missing index is built again
+  std::filesystem::remove("test.ordered.btree");
+  cellarium::ordered_storage<account> target;
+  REQUIRE(target.open("test.ordered", header, "name", ec));
+  REQUIRE(target.index().size() == 1000);
+  std::size_t count = 0;
+  target.for_range("user5", "user6", [&](auto) { ++count; });
+  REQUIRE(count == 111);
+
+  REQUIRE(!target.open("test.ordered", header, "missing", ec));
+  REQUIRE(ec == cellarium::error::field_not_found);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/paged_storage.hpp>
+
+
+TEST_CASE("paged_storage::paged_storage") {
+  cellarium::paged_storage<int> target;
+  REQUIRE(!target);
+}
+
+
+TEST_CASE("paged_storage::create") {
+  cellarium::paged_storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 2, 0.7f, {cellarium::field::i32("id", "")});
+  std::error_code ec; bool const created = target.create("test.pages", 4, header, ec);
+  REQUIRE(created);
+  REQUIRE(target);
+  for(int i = 0; i != 5; ++i)
+    REQUIRE(target.try_insert(i) == cellarium::paged_storage<int>::index_type(i));
+  int sum = 0;
+  target.for_each([&](int value) { sum += value; });
+  REQUIRE(sum == 10);
+}
+
+
+TEST_CASE("paged_storage::iterator") {
+  cellarium::paged_storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 2, 0.7f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.pages", 4, header, ec));
+  for(int i = 0; i != 7; ++i)
+    REQUIRE(target.try_insert(i) == cellarium::paged_storage<int>::index_type(i));
+  target.remove(2);
+  target.remove(3);
+  
+  std::vector<cellarium::paged_storage<int>::index_type> indices;
+  for(auto it = target.cbegin(); it != target.cend(); ++it) {
+    REQUIRE(*it == int(it.index()));
+    indices.push_back(it.index());
+  }
+  REQUIRE(indices == std::vector<cellarium::paged_storage<int>::index_type>{0, 1, 4, 5, 6});
+  REQUIRE(std::count_if(target.begin(), target.end(), [](int value) { return value > 4; }) == 2);
+}
+
+
+TEST_CASE("paged_storage::snapshot") {
+  cellarium::paged_storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 1 << 12, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.pages", 16, header, ec));
+  for(int i = 0; i != 6000; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  
+  auto const taken = target.snapshot();
+  REQUIRE(taken.pages_count() == 2);
+  REQUIRE(taken.size() == 6000);
+  
+  // Reader sees the same records while the writer keeps changing them
+  std::thread reader{[&taken] {
+    for(int pass = 0; pass != 20; ++pass) {
+      long long sum = 0;
+      taken.for_each([&](cellarium::paged_storage<int>::index_type, int value) { sum += value; });
+      REQUIRE(sum == 17997000);
+    }
+  }};
+  for(int round = 0; round != 20; ++round) {
+    for(cellarium::paged_storage<int>::index_type i = 0; i < 6000; i += 7)
+      if(target.page(i / 4096).occupancy().test(i % 4096))
+        target.remove(i);
+    for(int i = 0; i != 900; ++i)
+      target.try_insert(-1);
+  }
+  reader.join();
+  REQUIRE(taken.valid());
+  REQUIRE(taken.get(4095) == 4095);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <system_error>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/parallel.hpp>
+
+
+TEST_CASE("parallel::parallel_for_each") {
+  cellarium::storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 8192, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.parallel", header, ec));
+  for(int i = 0; i != 5000; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  target.remove(7);
+
+  cellarium::thread_pool pool{3};
+  std::atomic<std::int64_t> sum{0};
+  cellarium::parallel_for_each(pool, target, [&](int& value) { sum += value; value = -value; });
+  REQUIRE(sum == 4999 * 5000 / 2 - 7);
+  REQUIRE(target[10] == -10);
+
+  auto const total = cellarium::parallel_reduce(pool, target, std::int64_t(0),
+    [](std::int64_t& acc, int value) { acc += value; },
+    [](std::int64_t& acc, std::int64_t partial) { acc += partial; });
+  REQUIRE(total == -(4999 * 5000 / 2 - 7));
+}
+
+
+TEST_CASE("parallel::paged_storage") {
+  cellarium::paged_storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 1024, 0.7f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.parallel.pages", 8, header, ec));
+  for(int i = 0; i != 3000; ++i)
+    REQUIRE(target.try_insert(1) != target.no_index);
+  cellarium::thread_pool pool{2};
+  auto const& view = target;
+  auto const count = cellarium::parallel_reduce(pool, view, 0,
+    [](int& acc, int value) { acc += value; },
+    [](int& acc, int partial) { acc += partial; });
+  REQUIRE(count == 3000);
+}
+
+
+TEST_CASE("parallel::snapshot") {
+  cellarium::storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 1 << 18, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.parallel", header, ec));
+  for(int i = 0; i != 1 << 17; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+
+  // Workers preserve pages of the live snapshot at once
+  auto const taken = target.snapshot();
+  cellarium::thread_pool pool{4};
+  cellarium::parallel_for_each(pool, target, [](int& value) { value = -1; });
+  REQUIRE(target[12345] == -1);
+
+  REQUIRE(taken.valid());
+  std::size_t count = 0, wrong = 0;
+  taken.for_each([&](cellarium::storage<int>::index_type index, int value) {
+    wrong += value != int(index);
+    ++count;
+  });
+  REQUIRE(count == 1 << 17);
+  REQUIRE(wrong == 0);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/scan.hpp>
+
+
+struct order {
+  std::int64_t id;
+  double price;
+  std::uint32_t quantity;
+  std::int16_t side;
+}; // order
+
+
+inline cellarium::header order_header(cellarium::header::size_type capacity) {
+  using cellarium::field;
+  return cellarium::header::make<order>(1, capacity, 0.5f, {
+    field::with_offset(field::i64("id", ""), offsetof(order, id)),
+    field::with_offset(field::f64("price", ""), offsetof(order, price)),
+    field::with_offset(field::u32("quantity", ""), offsetof(order, quantity)),
+    field::with_offset(field::i16("side", ""), offsetof(order, side))
+  });
+}
+
+
+TEST_CASE("scan::storage") {
+  cellarium::storage<order> target;
+  auto const header = order_header(256);
+  std::error_code ec; REQUIRE(target.create("test.scan", header, ec));
+  for(int i = 0; i != 200; ++i)
+    REQUIRE(target.try_insert(order{i, i * 0.25, std::uint32_t(i) * 15000000u, std::int16_t(i % 2)}) != target.no_index);
+  target.remove(10);
+
+  using cellarium::predicate;
+  cellarium::selection matched;
+  REQUIRE(cellarium::scan(target, predicate::less(header.field_at(0), 20), matched, ec));
+  REQUIRE(matched.count() == 19);
+  REQUIRE(!matched.test(10));
+  REQUIRE(matched.test(19));
+
+  REQUIRE(cellarium::scan(target, predicate::between(header.field_at(1), 10., 12.), matched, ec));
+  REQUIRE(matched.indices() == std::vector<cellarium::selection::index_type>{40, 41, 42, 43, 44, 45, 46, 47, 48});
+
+  // Unsigned values above INT32_MAX
+  REQUIRE(cellarium::scan(target, predicate::greater_equal(header.field_at(2), 150u * 15000000u), matched, ec));
+  REQUIRE(matched.count() == 50);
+
+  REQUIRE(cellarium::scan(target, predicate::equal(header.field_at(3), 1), matched, ec));
+  cellarium::selection cheap;
+  REQUIRE(cellarium::scan(target, predicate::in(header.field_at(0), {3, 4, 5, 10, 300}), cheap, ec));
+  REQUIRE(cheap.count() == 3);
+  cheap.intersect(matched);
+  REQUIRE(cheap.indices() == std::vector<cellarium::selection::index_type>{3, 5});
+
+  std::vector<cellarium::storage<order>::index_type> indices;
+  REQUIRE(cellarium::select(target, predicate::not_equal(header.field_at(3), 0), indices, ec));
+  REQUIRE(indices.size() == 100);
+}
+
+
+TEST_CASE("scan::unsupported") {
+  cellarium::storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 16, 0.5f, {cellarium::field::string(3, "name", "")});
+  std::error_code ec; REQUIRE(target.create("test.scan", header, ec));
+  cellarium::selection matched;
+  REQUIRE(!cellarium::scan(target, cellarium::predicate::equal(header.field_at(0), 0), matched, ec));
+  REQUIRE(ec == cellarium::error::unsupported_field_kind);
+}
+
+
+TEST_CASE("scan::foreign field") {
+  cellarium::storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 16, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.scan", header, ec));
+  // Field of another catalog lies past the record
+  auto const foreign = cellarium::field::with_offset(cellarium::field::i64("id", ""), 8);
+  cellarium::selection matched;
+  REQUIRE(!cellarium::scan(target, cellarium::predicate::equal(foreign, 0), matched, ec));
+  REQUIRE(ec == cellarium::error::invalid_specified_header);
+}
+
+
+TEST_CASE("scan::paged_storage") {
+  cellarium::paged_storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 2, 0.7f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.scan.pages", 4, header, ec));
+  for(int i = 0; i != 7; ++i)
+    REQUIRE(target.try_insert(i) == cellarium::paged_storage<int>::index_type(i));
+  cellarium::selection matched;
+  REQUIRE(cellarium::scan(target, cellarium::predicate::greater(header.field_at(0), 2), matched, ec));
+  REQUIRE(matched.indices() == std::vector<cellarium::selection::index_type>{3, 4, 5, 6});
+}
+
+
+TEST_CASE("scan::columnar_storage") {
+  cellarium::columnar_storage<tick> target;
+  auto const header = tick_header(256);
+  std::error_code ec; REQUIRE(target.create("test.scan.columns", header, ec));
+  for(int i = 0; i != 256; ++i)
+    REQUIRE(target.try_insert(tick{i, i * 0.5, i % 7}) != target.no_index);
+  cellarium::selection matched;
+  REQUIRE(cellarium::scan(target, cellarium::predicate::equal(header.field_at(2), 3), matched, ec));
+  REQUIRE(matched.count() == 37);
+  REQUIRE(cellarium::scan(target, cellarium::predicate::less_equal(header.field_at(1), 10.), matched, ec));
+  REQUIRE(matched.count() == 21);
+}
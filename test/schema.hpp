@@ -47,5 +47,10 @@ public:
 TEST_CASE("schema") {
   std::array<cellarium::field, 4> fields = data_type::describe(annotations);
   //auto const header = cellarium::header::make(1, 17, 0.7f, );
-
+  data_type const sample;
+  auto const base = reinterpret_cast<char const*>(&sample);
+  REQUIRE(fields[0].offset() == reinterpret_cast<char const*>(&sample.field<0>()) - base);
+  REQUIRE(fields[1].offset() == reinterpret_cast<char const*>(&sample.field<1>()) - base);
+  REQUIRE(fields[2].offset() == reinterpret_cast<char const*>(&sample.field<2>()) - base);
+  REQUIRE(fields[3].offset() == reinterpret_cast<char const*>(&sample.field<3>()) - base);
 }
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/sharded_storage.hpp>
+#include <cellarium/parallel.hpp>
+
+
+TEST_CASE("sharded_storage::try_insert") {
+  using cellarium::sharded_storage;
+  auto const header = cellarium::header::make<int>(1, 1024, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec;
+  {
+    sharded_storage<int> target;
+    REQUIRE(target.create("test.sharded", 4, header, ec));
+    target.growth_factor(2);
+    
+    // Threads write their own shards with no synchronization
+    std::vector<std::vector<sharded_storage<int>::index_type>> inserted(4);
+    std::vector<std::thread> threads;
+    for(int t = 0; t != 4; ++t)
+      threads.emplace_back([&target, &inserted, t] {
+        auto const shard = target.acquire_shard();
+        REQUIRE(shard != target.no_shard);
+        for(int i = 0; i != 3000; ++i)
+          inserted[t].push_back(target.try_insert(shard, t * 10000 + i));
+      });
+    for(auto& each: threads)
+      each.join();
+    
+    REQUIRE(target.size() == 12000);
+    for(int t = 0; t != 4; ++t) {
+      auto const shard = target.shard_of(inserted[t].front());
+      REQUIRE(target.shard(shard).size() == 3000);
+      for(std::size_t i = 0; i != inserted[t].size(); ++i) {
+        REQUIRE(target.shard_of(inserted[t][i]) == shard);
+        REQUIRE(target[inserted[t][i]] == t * 10000 + int(i));
+      }
+    }
+    target.remove(inserted[2][5]);
+    REQUIRE(target.size() == 11999);
+  }
+  
+  sharded_storage<int> target;
+  REQUIRE(target.open("test.sharded", header, ec));
+  REQUIRE(target.shards_count() == 4);
+  REQUIRE(target.size() == 11999);
+  REQUIRE(target.shard_of(target.try_insert(2, -1)) == 2);
+  
+  cellarium::thread_pool pool{3};
+  auto const total = cellarium::parallel_reduce(pool, target, std::int64_t(0),
+    [](std::int64_t& acc, int value) { acc += value; },
+    [](std::int64_t& acc, std::int64_t partial) { acc += partial; });
+  std::int64_t expected = -1;
+  for(int t = 0; t != 4; ++t)
+    expected += 3000 * std::int64_t(t) * 10000 + 2999 * 3000 / 2;
+  REQUIRE(total == expected - 20005);
+}
+
+
+TEST_CASE("sharded_storage::acquire_shard") {
+  using cellarium::sharded_storage;
+  auto const header = cellarium::header::make<int>(1, 1024, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec;
+  sharded_storage<int> target;
+  REQUIRE(target.create("test.sharded", 4, header, ec));
+  
+  // More threads than shards: the ones left over are refused, not shared
+  std::atomic<int> attempted{0};
+  std::atomic<int> refused{0};
+  std::vector<std::thread> threads;
+  for(int t = 0; t != 8; ++t)
+    threads.emplace_back([&target, &attempted, &refused, t] {
+      auto const shard = target.acquire_shard();
+      attempted.fetch_add(1);
+      while(attempted.load() != 8)
+        std::this_thread::yield();
+      if(shard == target.no_shard) {
+        refused.fetch_add(1);
+        return;
+      }
+      for(int i = 0; i != 500; ++i)
+        REQUIRE(target.shard_of(target.try_insert(shard, t)) == shard);
+      target.release_shard(shard);
+    });
+  for(auto& each: threads)
+    each.join();
+  
+  REQUIRE(refused == 4);
+  REQUIRE(target.size() == 2000);
+  for(std::size_t n = 0; n != target.shards_count(); ++n)
+    REQUIRE(target.shard(n).size() == 500);
+  
+  // Released shards are handed out again
+  for(std::size_t n = 0; n != target.shards_count(); ++n)
+    REQUIRE(target.acquire_shard() != target.no_shard);
+  REQUIRE(target.acquire_shard() == target.no_shard);
+}
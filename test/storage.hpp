@@ -1,6 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <numeric>
 #include <system_error>
+#include <thread>
+#include <vector>
 
 #include <doctest/doctest.h>
 
@@ -31,3 +40,484 @@ TEST_CASE("storage::open") {
   REQUIRE(opened);
 }
 
+
+
+TEST_CASE("storage::create aligned") {
+  struct alignas(16) wide {
+    double value;
+    std::int64_t id;
+  };
+  cellarium::storage<wide> target;
+  auto const header = cellarium::header::make<wide>(1, 64, 0.5f, {cellarium::field::f64("value", ""),
+                                                                   cellarium::field::i64("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.storage", header, ec));
+  auto const index = target.try_insert(wide{1., 2});
+  REQUIRE(index != target.no_index);
+  REQUIRE(reinterpret_cast<std::uintptr_t>(&target[index]) % alignof(wide) == 0);
+  REQUIRE(cellarium::records_offset % 64 == 0);
+}
+
+
+TEST_CASE("storage::try_insert") {
+  cellarium::storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 128, 0.7f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.storage", header, ec));
+  for(int i = 0; i != 100; ++i)
+    REQUIRE(target.try_insert(i) == cellarium::storage<int>::index_type(i));
+  target.remove(10);
+  target.remove(70);
+  REQUIRE(!target.occupancy().test(10));
+  REQUIRE(target.occupancy().count() == 98);
+  int sum = 0;
+  target.for_each([&](int value) { sum += value; });
+  REQUIRE(sum == 99 * 100 / 2 - 10 - 70);
+  REQUIRE(target.try_insert(-1) == 70);
+}
+
+
+TEST_CASE("storage::open/expand") {
+  cellarium::storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 128, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.open("test.storage", header, ec));
+  REQUIRE(target.header()->capacity() == 256);
+  REQUIRE(target.occupancy().count() == 99);
+  REQUIRE(target[70] == -1);
+  int sum = 0;
+  target.for_each([&](int value) { sum += value; });
+  REQUIRE(sum == 99 * 100 / 2 - 10 - 70 - 1);
+  for(int i = 0; i != 157; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  REQUIRE(target.try_insert(0) == target.no_index);
+}
+
+
+TEST_CASE("storage::read_info") {
+  using cellarium::storage;
+  auto const header = cellarium::header::make<int>(1, 128, 0.5f, {cellarium::field::i32("id", "")});
+  cellarium::header actual; storage<int>::size_type items_count = 0;
+  std::error_code ec;
+  REQUIRE(storage<int>::read_info("test.storage", actual, items_count, ec));
+  REQUIRE(actual.clean());
+  REQUIRE(items_count == 256);
+  
+  storage<int> target;
+  REQUIRE(target.open("test.storage", header, ec));
+  target.remove(0);
+  REQUIRE(target.size() == 255);
+  // Opened storage is not clean, so live records are recounted
+  REQUIRE(storage<int>::read_info("test.storage", actual, items_count, ec));
+  REQUIRE(!actual.clean());
+  REQUIRE(items_count == 255);
+  target.close();
+  REQUIRE(storage<int>::read_info("test.storage", actual, items_count, ec));
+  REQUIRE(actual.clean());
+  REQUIRE(items_count == 255);
+}
+
+
+TEST_CASE("storage::high_water_mark") {
+  cellarium::storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 4, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.storage", header, ec));
+  REQUIRE(target.header()->high_water_mark() == 0);
+  REQUIRE(target.try_insert(1) == 0);
+  REQUIRE(target.try_insert(2) == 1);
+  target.remove(0);
+  REQUIRE(target.try_insert(3) == 0);
+  REQUIRE(target.header()->high_water_mark() == 2);
+  REQUIRE(target.try_insert(4) == 2);
+  REQUIRE(target.try_insert(5) == 3);
+  REQUIRE(target.try_insert(6) == target.no_index);
+  target.close();
+  
+  REQUIRE(target.open("test.storage", header, ec));
+  REQUIRE(target.header()->capacity() == 8);
+  REQUIRE(target.header()->high_water_mark() == 4);
+  REQUIRE(target.try_insert(6) == 4);
+  int sum = 0;
+  target.for_each([&](int value) { sum += value; });
+  REQUIRE(sum == 2 + 3 + 4 + 5 + 6);
+}
+
+
+TEST_CASE("storage::lowest_free") {
+  using namespace cellarium;
+  storage<int> target;
+  auto const header = header::with_allocation(
+        header::make<int>(1, 256, 0.5f, {field::i32("id", "")}),
+        allocation_policy::lowest_free);
+  std::error_code ec; REQUIRE(target.create("test.storage", header, ec));
+  for(int i = 0; i != 200; ++i)
+    REQUIRE(target.try_insert(i) == storage<int>::index_type(i));
+  target.remove(150);
+  target.remove(3);
+  target.remove(100);
+  REQUIRE(target.try_insert(-1) == 3);
+  REQUIRE(target.try_insert(-1, 120) == 150);
+  REQUIRE(target.try_insert(-1, 160) == 200);
+  REQUIRE(target.try_insert(-1) == 100);
+  REQUIRE(target.size() == 201);
+  target.remove(10);
+  target.remove(20);
+  target.close();
+  
+  // Switching back to free list threads slots below high-water mark
+  auto const listed = header::with_allocation(header, allocation_policy::free_list);
+  REQUIRE(target.open("test.storage", listed, ec));
+  REQUIRE(target.header()->allocation() == allocation_policy::free_list);
+  REQUIRE(target.try_insert(1) == 10);
+  REQUIRE(target.try_insert(2) == 20);
+  REQUIRE(target.try_insert(3) == 201);
+}
+
+
+TEST_CASE("storage::compact") {
+  using namespace cellarium;
+  storage<int> target;
+  auto const header = header::make<int>(1, 1024, 0.5f, {field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.storage", header, ec));
+  for(int i = 0; i != 1000; ++i)
+    target.try_insert(i);
+  for(storage<int>::index_type i = 0; i != 1000; ++i)
+    if(i % 10 != 0)
+      target.remove(i);
+  REQUIRE(target.size() == 100);
+  auto const uncompacted_size = std::filesystem::file_size("test.storage");
+  
+  std::vector<int> values(1024, -1);
+  for(int i = 0; i != 1000; i += 10)
+    values[i] = i;
+  int moves = 0;
+  auto const relocated = [&](storage<int>::index_type from, storage<int>::index_type to) {
+    REQUIRE(values[from] == target[to]);
+    values[to] = values[from];
+    values[from] = -1;
+    ++moves;
+  };
+  
+  REQUIRE(!target.compact(10, relocated, ec));
+  REQUIRE(!ec);
+  REQUIRE(target.compacting());
+  REQUIRE(moves == 10);
+  // Interleaved traffic takes the lowest free slot
+  auto const inserted = target.try_insert(-5);
+  REQUIRE(inserted < 100);
+  values[inserted] = -5;
+  
+  REQUIRE(target.compact(relocated, ec));
+  REQUIRE(!target.compacting());
+  REQUIRE(target.size() == 101);
+  REQUIRE(target.header()->capacity() == 256);
+  REQUIRE(target.header()->high_water_mark() == 101);
+  REQUIRE(std::filesystem::file_size("test.storage") < uncompacted_size);
+  for(storage<int>::index_type i = 0; i != 101; ++i) {
+    REQUIRE(target.occupancy().test(i));
+    REQUIRE(target[i] == values[i]);
+  }
+  REQUIRE(target.header()->allocation() == allocation_policy::free_list);
+  REQUIRE(target.try_insert(7) == 101);
+  target.close();
+  
+  REQUIRE(target.open("test.storage", header::with_capacity(header, 2), ec));
+  REQUIRE(target.size() == 102);
+}
+
+
+TEST_CASE("storage::compact interleaved") {
+  using namespace cellarium;
+  storage<int> target;
+  auto const header = header::make<int>(1, 16, 0.5f, {field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.storage", header, ec));
+  std::map<storage<int>::index_type, int> live;
+  auto const insert = [&](int value) {
+    auto const index = target.try_insert(value);
+    REQUIRE(index != target.no_index);
+    REQUIRE(live.count(index) == 0);
+    live[index] = value;
+  };
+  auto const relocated = [&](storage<int>::index_type from, storage<int>::index_type to) {
+    REQUIRE(live.count(to) == 0);
+    live[to] = live[from];
+    live.erase(from);
+  };
+  for(int i = 0; i != 16; ++i)
+    insert(100 + i);
+  for(storage<int>::index_type i = 0; i != 12; ++i) {
+    target.remove(i);
+    live.erase(i);
+  }
+
+  // Inserts during compaction land above the slots already scanned
+  REQUIRE(!target.compact(2, relocated, ec));
+  for(int i = 0; i != 12; ++i)
+    insert(200 + i);
+  for(storage<int>::index_type i = 3; i != 9; i += 2) {
+    target.remove(i);
+    live.erase(i);
+  }
+  REQUIRE(!target.compact(2, relocated, ec));
+  insert(300);
+  while(!target.compact(2, relocated, ec))
+    REQUIRE(!ec);
+
+  REQUIRE(target.size() == live.size());
+  REQUIRE(target.header()->high_water_mark() == live.rbegin()->first + 1);
+  for(auto const& [index, value]: live)
+    REQUIRE(target[index] == value);
+  while(live.size() != target.header()->capacity())
+    insert(400);
+  REQUIRE(target.try_insert(500) == target.no_index);
+  REQUIRE(target.size() == live.size());
+}
+
+
+TEST_CASE("storage::iterator") {
+  cellarium::storage<int> target;
+  auto const header = cellarium::header::make<int>(1, 256, 0.5f, {cellarium::field::i32("id", "")});
+  std::error_code ec; REQUIRE(target.create("test.storage", header, ec));
+  REQUIRE(target.begin() == target.end());
+  for(int i = 0; i != 150; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  for(int i = 0; i != 150; i += 3)
+    target.remove(cellarium::storage<int>::index_type(i));
+  
+  REQUIRE(std::distance(target.begin(), target.end()) == 100);
+  REQUIRE(std::accumulate(target.cbegin(), target.cend(), 0) == 149 * 150 / 2 - 49 * 50 / 2 * 3);
+  auto const found = std::find_if(target.begin(), target.end(), [](int value) { return value > 64; });
+  REQUIRE(found != target.end());
+  REQUIRE(found.index() == 65);
+  *found = -1;
+  REQUIRE(target[65] == -1);
+  cellarium::storage<int>::const_iterator const converted = found;
+  REQUIRE(*converted == -1);
+  
+  cellarium::storage<int>::index_type previous = 0;
+  for(auto it = target.begin(); it != target.end(); ++it) {
+    REQUIRE(it.index() % 3 != 0);
+    REQUIRE(it.index() >= previous);
+    previous = it.index();
+  }
+}
+
+
+TEST_CASE("storage::grow") {
+  using cellarium::storage;
+  using cellarium::header;
+  auto const specified = header::make<int>(1, 64, 0.5f, {cellarium::field::i32("id", "")});
+  for(auto const policy: {cellarium::allocation_policy::free_list, cellarium::allocation_policy::lowest_free}) {
+    storage<int> target;
+    std::error_code ec; REQUIRE(target.create("test.storage", header::with_allocation(specified, policy), ec));
+    for(int i = 0; i != 64; ++i)
+      REQUIRE(target.try_insert(i) != target.no_index);
+    REQUIRE(target.try_insert(64) == target.no_index);
+    
+    target.growth_factor(2);
+    for(int i = 64; i != 1000; ++i)
+      REQUIRE(target.try_insert(i) == storage<int>::index_type(i));
+    REQUIRE(target.header()->capacity() == 1024);
+    REQUIRE(target.size() == 1000);
+    REQUIRE(target.occupancy().count() == 1000);
+    for(int i = 0; i != 1000; ++i)
+      REQUIRE(target[storage<int>::index_type(i)] == i);
+    
+    REQUIRE(target.grow(3000, ec));
+    REQUIRE(target.header()->capacity() == 4096);
+    target.close();
+    REQUIRE(std::filesystem::file_size("test.storage") > 4096 * sizeof(int));
+    
+    REQUIRE(target.open("test.storage", header::with_allocation(specified, policy), ec));
+    REQUIRE(target.size() == 1000);
+    REQUIRE(target[999] == 999);
+    REQUIRE(target.try_insert(1000) == 1000);
+  }
+}
+
+
+#if !defined(_WIN32)
+
+TEST_CASE("storage::reserve") {
+  using cellarium::storage;
+  auto const specified = cellarium::header::make<int>(1, 64, 0.5f, {cellarium::field::i32("id", "")});
+  storage<int> target;
+  target.reserve(1 << 16);
+  target.growth_factor(2);
+  std::error_code ec; REQUIRE(target.create("test.storage", specified, ec));
+  REQUIRE(target.try_insert(-1) == 0);
+  int& first = target[0];
+  for(int i = 1; i != 10000; ++i)
+    REQUIRE(target.try_insert(i) == storage<int>::index_type(i));
+  REQUIRE(target.header()->capacity() == 16384);
+  REQUIRE(&first == &target[0]);
+  first = 7;
+  REQUIRE(target[0] == 7);
+  REQUIRE(target[9999] == 9999);
+  
+  REQUIRE(!target.grow(1 << 17, ec));
+  REQUIRE(ec == cellarium::error::address_space_exhausted);
+  REQUIRE(target[5000] == 5000);
+  target.close();
+  
+  REQUIRE(target.open("test.storage", specified, ec));
+  REQUIRE(target.size() == 10000);
+  REQUIRE(target[0] == 7);
+}
+
+#endif
+
+
+TEST_CASE("storage::flush") {
+  using cellarium::storage;
+  auto const specified = cellarium::header::make<int>(1, 1 << 16, 0.5f, {cellarium::field::i32("id", "")});
+  for(bool const durable: {false, true}) {
+    storage<int> target;
+    target.durable(durable);
+    std::error_code ec; REQUIRE(target.create("test.storage", specified, ec));
+    for(int i = 0; i != 100; ++i)
+      REQUIRE(target.try_insert(i) != target.no_index);
+    REQUIRE(target.flush(ec));
+    target.remove(3);
+    REQUIRE(target.checkpoint(ec));
+    
+    // Flushed contents are in the file without closing the storage
+    cellarium::header actual; storage<int>::size_type items_count;
+    REQUIRE(storage<int>::read_info("test.storage", actual, items_count, ec));
+    REQUIRE(actual.items_count() == 99);
+    auto f = cellarium::file::open_to_read("test.storage");
+    int value = 0;
+    REQUIRE(f.read_at(cellarium::records_offset + 7 * storage<int>::record_size,
+                      reinterpret_cast<char*>(&value), sizeof(value)));
+    REQUIRE(value == 7);
+  }
+}
+
+
+TEST_CASE("storage::snapshot") {
+  using cellarium::storage;
+  auto const specified = cellarium::header::make<int>(1, 1 << 14, 0.5f, {cellarium::field::i32("id", "")});
+  storage<int> target;
+  std::error_code ec; REQUIRE(target.create("test.storage", specified, ec));
+  for(int i = 0; i != 10000; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  
+  auto const taken = target.snapshot();
+  REQUIRE(taken.size() == 10000);
+  target.remove(0);
+  target[1] = -1;
+  REQUIRE(target.try_insert(-2) == 0);
+  target.growth_factor(2);
+  for(int i = 0; i != 10000; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  REQUIRE(target.occupancy().capacity() > taken.capacity());
+  
+  // Growth moved the mapping, the snapshot still shows the original state
+  REQUIRE(taken.valid());
+  REQUIRE(taken.contains(0));
+  REQUIRE(taken.get(0) == 0);
+  REQUIRE(taken.get(1) == 1);
+  REQUIRE(!taken.contains(10000));
+  long long sum = 0; std::size_t count = 0;
+  taken.for_each([&](storage<int>::index_type index, int value) {
+    REQUIRE(value == int(index));
+    sum += value; ++count;
+  });
+  REQUIRE(count == 10000);
+  REQUIRE(sum == 49995000);
+  target.close();
+  REQUIRE(taken.get(9999) == 9999);
+}
+
+
+TEST_CASE("storage::snapshot remapped") {
+  using cellarium::storage;
+  auto const specified = cellarium::header::make<int>(1, 1024, 0.5f, {cellarium::field::i32("id", "")});
+  storage<int> target;
+  std::error_code ec; REQUIRE(target.create("test.storage", specified, ec));
+  for(int i = 0; i != 1000; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  auto const taken = target.snapshot();
+  
+  // Snapshot reads the old mapping after growth moved the storage, and
+  // later writes, shrinking and close still leave it as it was
+  target.growth_factor(2);
+  for(int i = 0; i != 3000; ++i)
+    REQUIRE(target.try_insert(-1) != target.no_index);
+  target[5] = -5;
+  for(storage<int>::index_type i = 6; i != 4000; ++i)
+    if(i % 100 != 0)
+      target.remove(i);
+  REQUIRE(target.compact([](storage<int>::index_type, storage<int>::index_type) { }, ec));
+  REQUIRE(target.header()->capacity() < 1024 / 2);
+  target.close();
+  
+  REQUIRE(taken.valid());
+  REQUIRE(taken.contains(6));
+  REQUIRE(!taken.contains(1000));
+  std::size_t count = 0;
+  taken.for_each([&](storage<int>::index_type index, int value) {
+    REQUIRE(value == int(index));
+    ++count;
+  });
+  REQUIRE(count == 1000);
+  
+  // Shrinking cuts off pages of the snapshot never written since
+  auto const sparse = cellarium::header::make<int>(1, 1 << 16, 0.5f, {cellarium::field::i32("id", "")});
+  REQUIRE(target.create("test.storage", sparse, ec));
+  for(int i = 0; i != 1000; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  auto const before = target.snapshot();
+  REQUIRE(target.compact([](storage<int>::index_type, storage<int>::index_type) { }, ec));
+  REQUIRE(target.header()->capacity() < (1 << 16) / 8);
+  target.close();
+  REQUIRE(before.valid());
+  count = 0;
+  before.for_each([&](storage<int>::index_type index, int value) {
+    REQUIRE(value == int(index));
+    ++count;
+  });
+  REQUIRE(count == 1000);
+}
+
+
+TEST_CASE("storage::snapshot concurrent") {
+  using cellarium::storage;
+  auto const specified = cellarium::header::make<int>(1, 1 << 14, 0.5f, {cellarium::field::i32("id", "")});
+  storage<int> target;
+  std::error_code ec; REQUIRE(target.create("test.storage", specified, ec));
+  for(int i = 0; i != 10000; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+
+  auto const taken = target.snapshot();
+  std::atomic<bool> writing{true};
+  std::atomic<int> mismatches{0}, passes{0};
+  std::thread reader{[&] {
+    do {
+      int count = 0;
+      taken.for_each([&](storage<int>::index_type index, int value) {
+        if(value != int(index))
+          ++mismatches;
+        ++count;
+      });
+      if(count != 10000)
+        ++mismatches;
+      ++passes;
+    } while(writing.load());
+  }};
+
+  // Writes through modify_each and operator [], then growth moves the
+  // mapping under the reader
+  for(int round = 0; round != 20; ++round) {
+    target.modify_each([](int& value) { value = -value - 1; });
+    target.modify_each([](int& value) { value += 1; });
+    target[round] = -1;
+    target.remove(storage<int>::index_type(round + 100));
+  }
+  target.growth_factor(2);
+  for(int i = 0; i != 30000; ++i)
+    REQUIRE(target.try_insert(i) != target.no_index);
+  writing.store(false);
+  reader.join();
+
+  REQUIRE(passes.load() != 0);
+  REQUIRE(mismatches.load() == 0);
+  REQUIRE(taken.valid());
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <system_error>
+#include <thread>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/storage.hpp>
+#include <cellarium/storage_reader.hpp>
+
+
+TEST_CASE("storage_reader::read") {
+  auto const header = cellarium::header::make<int>(1, 1024, 0.5f, {cellarium::field::i32("id", "")});
+  cellarium::storage<int> writer;
+  writer.shared(true);
+  writer.growth_factor(2);
+  std::error_code ec; REQUIRE(writer.create("test.shared", header, ec));
+  for(int i = 0; i != 1000; ++i)
+    REQUIRE(writer.try_insert(i) != writer.no_index);
+  
+  // Reader maps the file read-only and leaves the writer's header alone
+  cellarium::storage_reader<int> reader;
+  auto const reading = cellarium::header::make<int>(1, 1024, 0.75f, {cellarium::field::i32("id", "")});
+  REQUIRE(reader.open("test.shared", reading, ec));
+  REQUIRE(writer.header()->occupancy_factor() == 0.5f);
+  REQUIRE(reader.size() == 1000);
+  int value = 0;
+  REQUIRE(reader.read(5, value, ec));
+  REQUIRE(value == 5);
+  writer.remove(5);
+  writer.update(6, -6);
+  REQUIRE(!reader.read(5, value, ec));
+  REQUIRE(!ec);
+  REQUIRE(reader.read(6, value, ec));
+  REQUIRE(value == -6);
+  
+  // Growth is noticed and the file mapped again
+  for(int i = 0; i != 2000; ++i)
+    REQUIRE(writer.try_insert(i) != writer.no_index);
+  REQUIRE(reader.read(2500, value, ec));
+  REQUIRE(reader.capacity() == writer.occupancy().capacity());
+}
+
+
+TEST_CASE("storage_reader::for_each") {
+  struct pair { std::uint64_t value; std::uint64_t complement; };
+  auto const header = cellarium::header::make<pair>(1, 4096, 0.5f, {cellarium::field::u64("value", "")});
+  cellarium::storage<pair> writer;
+  writer.shared(true);
+  writer.growth_factor(2);
+  std::error_code ec; REQUIRE(writer.create("test.shared", header, ec));
+  for(std::uint64_t i = 0; i != 4000; ++i)
+    REQUIRE(writer.try_insert(pair{i, ~i}) != writer.no_index);
+  
+  cellarium::storage_reader<pair> reader;
+  REQUIRE(reader.open("test.shared", header, ec));
+  std::atomic<bool> done{false};
+  std::thread writing{[&] {
+    for(std::uint64_t round = 1; round != 200; ++round) {
+      for(cellarium::storage<pair>::index_type i = 0; i < 4000; i += 3)
+        writer.update(i, pair{round, ~round});
+      writer.try_insert(pair{round, ~round});
+    }
+    done = true;
+  }};
+  
+  bool consistent = true;
+  while(!done) {
+    REQUIRE(reader.for_each([&](cellarium::storage<pair>::index_type, pair const& each) {
+      consistent = consistent && each.complement == ~each.value;
+    }, ec));
+    pair one;
+    if(reader.read(3, one, ec))
+      consistent = consistent && one.complement == ~one.value;
+  }
+  writing.join();
+  REQUIRE(consistent);
+  REQUIRE(!ec);
+}
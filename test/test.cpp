@@ -3,8 +3,27 @@
 
 #include "file.hpp"
 #include "mapped_file.hpp"
+#include "occupancy_map.hpp"
+#include "occupancy_index.hpp"
 #include "field.hpp"
 #include "record.hpp"
 #include "header.hpp"
 #include "schema.hpp"
 #include "storage.hpp"
+#include "paged_storage.hpp"
+#include "columnar_storage.hpp"
+#include "scan.hpp"
+#include "aggregate.hpp"
+#include "thread_pool.hpp"
+#include "parallel.hpp"
+#include "flusher.hpp"
+#include "journaled_storage.hpp"
+#include "storage_reader.hpp"
+#include "concurrent_storage.hpp"
+#include "sharded_storage.hpp"
+#include "unordered_storage.hpp"
+#include "ordered_storage.hpp"
+#include "indexed_storage.hpp"
+#include "migration.hpp"
+#include "upgrading_storage.hpp"
+#include "json.hpp"
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/thread_pool.hpp>
+
+
+TEST_CASE("thread_pool::run") {
+  cellarium::thread_pool target{3};
+  REQUIRE(target.size() == 4);
+  std::size_t const morsels = 10000;
+  std::unique_ptr<std::atomic<int>[]> visits{new std::atomic<int>[morsels]};
+  for(std::size_t i = 0; i != morsels; ++i)
+    visits[i] = 0;
+  std::atomic<bool> valid_worker{true};
+  for(int pass = 0; pass != 3; ++pass)
+    target.run(morsels, [&](std::size_t worker, std::size_t morsel) {
+      if(worker >= target.size())
+        valid_worker = false;
+      ++visits[morsel];
+    });
+  REQUIRE(valid_worker);
+  for(std::size_t i = 0; i != morsels; ++i)
+    REQUIRE(visits[i] == 3);
+}
+
+
+TEST_CASE("thread_pool::run/no threads") {
+  cellarium::thread_pool target{0};
+  std::size_t sum = 0;
+  target.run(100, [&](std::size_t, std::size_t morsel) { sum += morsel; });
+  REQUIRE(sum == 99 * 100 / 2);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/unordered_storage.hpp>
+
+
+namespace {
+
+  struct account {
+    std::int64_t id;
+    char name[16];
+    double balance;
+  };
+
+
+  account make_account(std::int64_t id, double balance) {
+    account a{id, {}, balance};
+    std::snprintf(a.name, sizeof(a.name), "user%lld", static_cast<long long>(id));
+    return a;
+  }
+
+
+  cellarium::header account_header(cellarium::header::size_type capacity) {
+    using cellarium::field;
+    return cellarium::header::make<account>(1, capacity, 0.5f, {
+      field::with_offset(field::i64("id", ""), offsetof(account, id)),
+      field::with_offset(field::string(15, "name", ""), offsetof(account, name)),
+      field::with_offset(field::f64("balance", ""), offsetof(account, balance))
+    });
+  }
+
+}
+
+
+TEST_CASE("unordered_storage::find") {
+  cellarium::unordered_storage<account> target;
+  auto const header = account_header(1024);
+  std::error_code ec; REQUIRE(target.create("test.unordered", header, "id", ec));
+  target.growth_factor(2);
+  for(std::int64_t i = 0; i != 10000; ++i)
+    REQUIRE(target.try_insert(make_account(i * 7, double(i)), ec) != target.no_index);
+  REQUIRE(target.index().size() == 10000);
+  REQUIRE(target.try_insert(make_account(70, 0.), ec) == target.no_index);
+  REQUIRE(!ec);
+  
+  for(std::int64_t i = 0; i != 10000; ++i) {
+    auto const found = target.find(i * 7);
+    REQUIRE(found != target.no_index);
+    REQUIRE(target[found].balance == double(i));
+  }
+  REQUIRE(target.find(std::int64_t(3)) == target.no_index);
+  
+  REQUIRE(target.erase(std::string_view{"\x0e\0\0\0\0\0\0\0", 8}));
+  REQUIRE(target.find(14) == target.no_index);
+  target.remove(target.find(21));
+  REQUIRE(target.find(21) == target.no_index);
+  REQUIRE(target.size() == 9998);
+  
+  // Changing the key moves the record in the index
+  auto const moved = target.find(28);
+  REQUIRE(!target.update(moved, make_account(35, 0.)));
+  REQUIRE(target.update(moved, make_account(3, 1.)));
+  REQUIRE(target.find(28) == target.no_index);
+  REQUIRE(target.find(3) == moved);
+  REQUIRE(target.insert_or_assign(make_account(3, 2.), ec) == moved);
+  REQUIRE(target[moved].balance == 2.);
+}
+
+
+TEST_CASE("unordered_storage::open") {
+  auto const header = account_header(64);
+  std::error_code ec;
+  cellarium::hash_index::size_type capacity;
+  {
+    cellarium::unordered_storage<account> target;
+    REQUIRE(target.create("test.unordered", header, "name", ec));
+    target.growth_factor(2);
+    for(std::int64_t i = 0; i != 1000; ++i)
+      REQUIRE(target.try_insert(make_account(i, double(i)), ec) != target.no_index);
+    capacity = target.index().capacity();
+  }
+  {
+    // Index persists, lookups work right after open
+    cellarium::unordered_storage<account> target;
+    REQUIRE(target.open("test.unordered", header, "name", ec));
+    REQUIRE(target.index().capacity() == capacity);
+    REQUIRE(target[target.find("user777")].id == 777);
+    REQUIRE(target.find("user1000") == target.no_index);
+  }
+  
+  // Missing index is built again
+  std::filesystem::remove("test.unordered.hash");
+  cellarium::unordered_storage<account> target;
+  REQUIRE(target.open("test.unordered", header, "name", ec));
+  REQUIRE(target.index().size() == 1000);
+  REQUIRE(target[target.find("user5")].balance == 5.);
+  
+  REQUIRE(!target.open("test.unordered", header, "missing", ec));
+  REQUIRE(ec == cellarium::error::field_not_found);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+#include <thread>
+
+#include <doctest/doctest.h>
+
+#include <cellarium/upgrading_storage.hpp>
+
+
+namespace {
+
+  void write_items_v1(char const* path, std::int32_t count) {
+    std::error_code ec;
+    std::filesystem::remove(cellarium::upgrading_storage<item_v2>::bitmap_path(path));
+    cellarium::storage<item_v1> source;
+    REQUIRE(source.create(path, cellarium::header::with_capacity(item_v1_header(), 4096), ec));
+    for(std::int32_t i = 0; i != count; ++i) {
+      item_v1 item{i, float(i), {}, i, 0};
+      std::snprintf(item.name, sizeof(item.name), "n%d", i);
+      REQUIRE(source.try_insert(item) != source.no_index);
+    }
+  }
+
+}
+
+
+TEST_CASE("upgrading_storage::open") {
+  write_items_v1("test.upgrading", 1000);
+  item_v2 defaults{};
+  defaults.reorder = 3;
+  std::error_code ec;
+  cellarium::upgrading_storage<item_v2>::size_type left;
+  {
+    cellarium::upgrading_storage<item_v2> target;
+    REQUIRE(target.open("test.upgrading", item_v2_header(), defaults, ec));
+    REQUIRE(target.upgrading());
+    REQUIRE(target.size() == 1000);
+    left = target.pages_left();
+    REQUIRE(left == 16);
+
+    // Touched pages are upgraded, new records never land on old ones
+    REQUIRE(target[700].id == 700);
+    REQUIRE(target[700].reorder == 3);
+    target.remove(5);
+    target.update(6, item_v2{-6, 0., "six", 0, 0});
+    auto const inserted = target.try_insert(item_v2{5000, 0., "new", 0, 0});
+    REQUIRE(inserted != target.no_index);
+    REQUIRE(target[inserted].id == 5000);
+    REQUIRE(target.pages_left() == left - 2);
+    left = target.pages_left();
+  }
+  {
+    // Upgrade resumes where it stopped
+    cellarium::upgrading_storage<item_v2> target;
+    REQUIRE(target.open("test.upgrading", item_v2_header(), defaults, ec));
+    REQUIRE(target.pages_left() == left);
+    REQUIRE(target[6].id == -6);
+    REQUIRE(target.upgrade_all(ec));
+    REQUIRE(!target.upgrading());
+    REQUIRE(!std::filesystem::exists("test.upgrading.upgrading"));
+    REQUIRE(!std::filesystem::exists("test.upgrading.upgraded"));
+    REQUIRE(target[999].price == 999.);
+  }
+
+  cellarium::storage<item_v2> upgraded;
+  REQUIRE(upgraded.open("test.upgrading", item_v2_header(), ec));
+  REQUIRE(upgraded.size() == 1000);
+  std::size_t removed = 0, inserted = 0;
+  upgraded.for_each([&](item_v2 const& item) { removed += item.id == 5; inserted += item.id == 5000; });
+  REQUIRE(removed == 0);
+  REQUIRE(inserted == 1);
+  REQUIRE(upgraded[6].id == -6);
+  REQUIRE(upgraded[998].stock == 998);
+}
+
+
+TEST_CASE("upgrading_storage::start") {
+  write_items_v1("test.upgrading", 3000);
+  std::error_code ec;
+  cellarium::upgrading_storage<item_v2> target;
+  REQUIRE(target.open("test.upgrading", item_v2_header(), item_v2{}, ec));
+  target.start(4, std::chrono::microseconds{100});
+  // Foreground access goes on meanwhile
+  for(std::uint32_t i = 0; i < 3000; i += 97)
+    REQUIRE(target[i].id == i);
+  auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+  while(target.upgrading() && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  REQUIRE(!target.upgrading());
+  REQUIRE(!target.last_error());
+  std::size_t count = 0;
+  target.for_each([&](item_v2 const& item) { REQUIRE(std::int64_t(item.price) == item.id); ++count; });
+  REQUIRE(count == 3000);
+}
+
+
+TEST_CASE("upgrading_storage::open upgraded") {
+  write_items_v1("test.upgrading", 200);
+  std::error_code ec;
+  {
+    // Every page upgraded on access, closed before finishing
+    cellarium::upgrading_storage<item_v2> target;
+    REQUIRE(target.open("test.upgrading", item_v2_header(), item_v2{}, ec));
+    std::size_t count = 0;
+    target.for_each([&](item_v2 const&) { ++count; });
+    REQUIRE(count == 200);
+    REQUIRE(target.pages_left() == 0);
+    REQUIRE(target.upgrading());
+    REQUIRE(!target.last_error());
+  }
+
+  cellarium::upgrading_storage<item_v2> target;
+  REQUIRE(target.open("test.upgrading", item_v2_header(), item_v2{}, ec));
+  REQUIRE(!target.upgrading());
+  REQUIRE(!std::filesystem::exists("test.upgrading.upgrading"));
+  REQUIRE(!std::filesystem::exists("test.upgrading.upgraded"));
+  REQUIRE(target.size() == 200);
+  REQUIRE(target[150].id == 150);
+}
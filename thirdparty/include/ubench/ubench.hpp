@@ -85,7 +85,7 @@ struct result {
 #ifdef _MSC_VER
 #define UBENCH_NOINLINE __declspec(noinline)
 #else
-#define UBENCH_NOINLINE __attribute__(noinline)
+#define UBENCH_NOINLINE __attribute__((noinline))
 #endif
 
 